@@ -11,7 +11,7 @@ namespace assignment_03 {
     }
 
     bytefile::bytefile(std::string_view name, uint32_t string_tab_size, uint32_t public_symbols_size, uint32_t code_size)
-        : base_(static_cast<::bytefile*>(static_cast<void*>(new (std::align_val_t{alignof(::bytefile)}) std::byte[4 * sizeof(char*) + 3 * sizeof(int) + 2 * public_symbols_size * sizeof(int) + string_tab_size * sizeof(char) + code_size * sizeof(char)])))
+        : base_(static_cast<::bytefile*>(static_cast<void*>(new (std::align_val_t{alignof(::bytefile)}) std::byte[4 * sizeof(char*) + 3 * sizeof(int) + 2 * public_symbols_size * sizeof(int) + string_tab_size * sizeof(char) + code_size * sizeof(char)]{})))
         , name_(name)
         , code_pos_(0)
         , code_size_(0) {
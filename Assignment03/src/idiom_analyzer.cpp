@@ -1,13 +1,16 @@
 #include "idiom_analyzer.h"
 
 #include <algorithm>
+#include <cctype>
 #include <cstdio>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <span>
 #include <sstream>
 
 #include "byterun_interface.h"
+#include "file_reader.h"
 
 namespace assignment_03 {
 
@@ -130,7 +133,7 @@ namespace assignment_03 {
         }
     }
 
-    void idiom_processor::find_idioms() {
+    void idiom_processor::find_idioms(uint32_t max_size) {
         uint32_t addr = 0;
         while (addr < bytefile_.get_code_size()) {
             while (!reachable_.at(addr)) {
@@ -143,10 +146,16 @@ namespace assignment_03 {
             uint32_t length = disassemble_instruction(stdin, bytefile_.get_base(), static_cast<int>(addr));
             validate(addr + length < bytefile_.get_code_size(), "Unexpected end of code", addr + length);
             idioms_.emplace_back(addr, 1);
-            if (!is_call(op) && !is_terminal(op) && reachable_.at(addr + length) && !jump_targets_.at(addr + length)) {
-                uint32_t next_length = disassemble_instruction(stdin, bytefile_.get_base(), static_cast<int>(addr + length));
-                validate(addr + length + next_length < bytefile_.get_code_size(), "Unexpected end of code", addr + length + next_length);
-                idioms_.emplace_back(addr, 2);
+            uint32_t idiom_length = length;
+            for (uint32_t size = 2; size <= max_size; ++size) {
+                if (is_call(op) || is_terminal(op) || !reachable_.at(addr + idiom_length) || jump_targets_.at(addr + idiom_length)) {
+                    break;
+                }
+                op = get_op(addr + idiom_length);
+                uint32_t next_length = disassemble_instruction(stdin, bytefile_.get_base(), static_cast<int>(addr + idiom_length));
+                validate(addr + idiom_length + next_length < bytefile_.get_code_size(), "Unexpected end of code", addr + idiom_length + next_length);
+                idiom_length += next_length;
+                idioms_.emplace_back(addr, size);
             }
             addr += length;
         }
@@ -189,6 +198,226 @@ namespace assignment_03 {
         }
     }
 
+    void superinstruction_generator::add_bytefile(const bytefile& file, std::span<const uint64_t> executed) {
+        idiom_processor processor(file);
+        processor.find_reachable_instructions();
+        processor.find_idioms(MAX_SUPERINSTRUCTION_SIZE);
+        for (idiom value : processor.get_idioms()) {
+            if (value.get_size() < 2) {
+                continue;
+            }
+            std::vector<bytecode> ops;
+            uint32_t length = 0;
+            for (uint32_t i = 0; i < value.get_size(); ++i) {
+                ops.push_back(file.get_code(value.get_pos() + length));
+                length += disassemble_instruction(stdin, file.get_base(), static_cast<int>(value.get_pos() + length));
+            }
+            if (is_fusable(ops)) {
+                frequencies_[ops] += executed.empty() ? 1 : executed[value.get_pos()];
+            }
+        }
+    }
+
+    void superinstruction_generator::add_profile(const std::string& path) {
+        std::ifstream is(path);
+        if (!is) {
+            throw std::runtime_error("Profile not found: " + path);
+        }
+        std::string bytefile_path;
+        std::vector<std::pair<uint32_t, uint64_t>> offsets;
+        std::string line;
+        while (std::getline(is, line)) {
+            std::istringstream fields(line);
+            std::string kind;
+            fields >> kind;
+            if (kind == "file") {
+                fields >> std::ws;
+                std::getline(fields, bytefile_path);
+            } else if (kind == "offset") {
+                uint32_t offset = 0;
+                std::string op;
+                uint64_t count = 0;
+                if (!(fields >> offset >> op >> count)) {
+                    throw std::runtime_error("Invalid profile line: " + line);
+                }
+                offsets.emplace_back(offset, count);
+            }
+        }
+        if (bytefile_path.empty()) {
+            throw std::runtime_error("Profile names no bytefile: " + path);
+        }
+        bytefile file = read_file(bytefile_path);
+        std::vector<uint64_t> executed(file.get_code_size());
+        for (const auto& [offset, count] : offsets) {
+            if (offset >= executed.size()) {
+                throw std::runtime_error("Profile does not match " + bytefile_path);
+            }
+            executed[offset] = count;
+        }
+        add_bytefile(file, executed);
+    }
+
+    // Sequences are picked one at a time by the dispatches they save on top of the ones picked before. The decoder fuses
+    // the longest match, so a sequence inside a picked longer one only saves where the longer one does not match, and a
+    // longer sequence only saves the dispatches a picked shorter one inside it does not already save.
+    void superinstruction_generator::print(std::ostream& os, size_t count) const {
+        auto contains = [](const std::vector<bytecode>& outer, const std::vector<bytecode>& inner) {
+            return outer.size() > inner.size() && std::search(outer.begin(), outer.end(), inner.begin(), inner.end()) != outer.end();
+        };
+        std::vector<std::pair<size_t, std::vector<bytecode>>> sequences;
+        std::vector<bool> is_picked(frequencies_.size());
+        while (sequences.size() < count) {
+            auto best = frequencies_.end();
+            size_t best_index = 0;
+            size_t best_saved = 0;
+            size_t index = 0;
+            for (auto it = frequencies_.begin(); it != frequencies_.end(); ++it, ++index) {
+                const auto& [ops, frequency] = *it;
+                if (is_picked[index]) {
+                    continue;
+                }
+                size_t saved = frequency * (ops.size() - 1);
+                for (const auto& entry : sequences) {
+                    const std::vector<bytecode>& picked = entry.second;
+                    size_t covered = 0;
+                    if (contains(picked, ops)) {
+                        covered = frequencies_.at(picked) * (ops.size() - 1);
+                    } else if (contains(ops, picked)) {
+                        covered = frequency * (picked.size() - 1);
+                    }
+                    saved -= std::min(saved, covered);
+                }
+                if (saved > best_saved) {
+                    best = it;
+                    best_index = index;
+                    best_saved = saved;
+                }
+            }
+            if (best == frequencies_.end()) {
+                break;
+            }
+            is_picked[best_index] = true;
+            sequences.emplace_back(best_saved, best->first);
+        }
+        os << "#ifndef SUPERINSTRUCTIONS_H\n";
+        os << "#define SUPERINSTRUCTIONS_H\n\n";
+        os << "// Generated by Assignment03 --superinstructions=" << count << ", do not edit.\n";
+        os << "// Each entry is X(name, opcodes...), ordered by the number of dispatches it saves on the corpus on top of the\n";
+        os << "// entries before it.\n\n";
+        os << "#define ASSIGNMENT04_SUPERINSTRUCTIONS(X)";
+        for (const auto& [saved, ops] : sequences) {
+            os << " \\\n    X(";
+            for (size_t i = 0; i < ops.size(); ++i) {
+                if (i > 0) {
+                    os << "__";
+                }
+                std::string name(get_op_name(ops[i]));
+                std::transform(name.begin(), name.end(), name.begin(), [](char c) {
+                    return static_cast<char>(std::tolower(c));
+                });
+                os << name;
+            }
+            for (bytecode op : ops) {
+                os << ", bytecode::" << get_op_name(op);
+            }
+            os << ")";
+        }
+        os << "\n\n#endif\n";
+    }
+
+    bool superinstruction_generator::is_fusable(const std::vector<bytecode>& ops) noexcept {
+        for (size_t i = 0; i < ops.size(); ++i) {
+            switch (ops[i]) {
+                case bytecode::END:
+                case bytecode::RET:
+                case bytecode::FAIL:
+                case bytecode::STOP:
+                    return false;
+                case bytecode::JMP:
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ:
+                case bytecode::CALLC:
+                case bytecode::CALL:
+                    if (i + 1 < ops.size()) {
+                        return false;
+                    }
+                    break;
+                default:
+                    if (get_op_name(ops[i]).empty()) {
+                        return false;
+                    }
+            }
+        }
+        return true;
+    }
+
+    std::string_view superinstruction_generator::get_op_name(bytecode op) noexcept {
+        switch (op) {
+            case bytecode::LOW_ADD: return "LOW_ADD";
+            case bytecode::LOW_SUB: return "LOW_SUB";
+            case bytecode::LOW_MUL: return "LOW_MUL";
+            case bytecode::LOW_DIV: return "LOW_DIV";
+            case bytecode::LOW_MOD: return "LOW_MOD";
+            case bytecode::LOW_LT: return "LOW_LT";
+            case bytecode::LOW_LE: return "LOW_LE";
+            case bytecode::LOW_GT: return "LOW_GT";
+            case bytecode::LOW_GE: return "LOW_GE";
+            case bytecode::LOW_EQ: return "LOW_EQ";
+            case bytecode::LOW_NE: return "LOW_NE";
+            case bytecode::LOW_AND: return "LOW_AND";
+            case bytecode::LOW_OR: return "LOW_OR";
+            case bytecode::CONST: return "CONST";
+            case bytecode::STRING: return "STRING";
+            case bytecode::SEXP: return "SEXP";
+            case bytecode::STI: return "STI";
+            case bytecode::STA: return "STA";
+            case bytecode::JMP: return "JMP";
+            case bytecode::END: return "END";
+            case bytecode::RET: return "RET";
+            case bytecode::DROP: return "DROP";
+            case bytecode::DUP: return "DUP";
+            case bytecode::SWAP: return "SWAP";
+            case bytecode::ELEM: return "ELEM";
+            case bytecode::LD_GLOBAL: return "LD_GLOBAL";
+            case bytecode::LD_LOCAL: return "LD_LOCAL";
+            case bytecode::LD_ARGUMENT: return "LD_ARGUMENT";
+            case bytecode::LD_CAPTURED: return "LD_CAPTURED";
+            case bytecode::LDA_GLOBAL: return "LDA_GLOBAL";
+            case bytecode::LDA_LOCAL: return "LDA_LOCAL";
+            case bytecode::LDA_ARGUMENT: return "LDA_ARGUMENT";
+            case bytecode::LDA_CAPTURED: return "LDA_CAPTURED";
+            case bytecode::ST_GLOBAL: return "ST_GLOBAL";
+            case bytecode::ST_LOCAL: return "ST_LOCAL";
+            case bytecode::ST_ARGUMENT: return "ST_ARGUMENT";
+            case bytecode::ST_CAPTURED: return "ST_CAPTURED";
+            case bytecode::CJMPZ: return "CJMPZ";
+            case bytecode::CJMPNZ: return "CJMPNZ";
+            case bytecode::BEGIN: return "BEGIN";
+            case bytecode::CBEGIN: return "CBEGIN";
+            case bytecode::CLOSURE: return "CLOSURE";
+            case bytecode::CALLC: return "CALLC";
+            case bytecode::CALL: return "CALL";
+            case bytecode::TAG: return "TAG";
+            case bytecode::ARRAY: return "ARRAY";
+            case bytecode::FAIL: return "FAIL";
+            case bytecode::LINE: return "LINE";
+            case bytecode::PATT_STR: return "PATT_STR";
+            case bytecode::PATT_STRING: return "PATT_STRING";
+            case bytecode::PATT_ARRAY: return "PATT_ARRAY";
+            case bytecode::PATT_SEXP: return "PATT_SEXP";
+            case bytecode::PATT_REF: return "PATT_REF";
+            case bytecode::PATT_VAL: return "PATT_VAL";
+            case bytecode::PATT_FUN: return "PATT_FUN";
+            case bytecode::CALL_LREAD: return "CALL_LREAD";
+            case bytecode::CALL_LWRITE: return "CALL_LWRITE";
+            case bytecode::CALL_LLENGTH: return "CALL_LLENGTH";
+            case bytecode::CALL_LSTRING: return "CALL_LSTRING";
+            case bytecode::CALL_BARRAY: return "CALL_BARRAY";
+            case bytecode::STOP: return "STOP";
+            default: return {};
+        }
+    }
+
     void analyze_idioms(const bytefile& file) {
         idiom_printer printer(file);
         idiom_processor processor(file);
@@ -202,4 +431,18 @@ namespace assignment_03 {
         }
     }
 
+    void generate_superinstructions(const std::vector<std::string>& paths, size_t count) {
+        superinstruction_generator generator;
+        constexpr static std::string_view PROFILE_OPTION = "--profile=";
+        for (const std::string& path : paths) {
+            if (path.starts_with(PROFILE_OPTION)) {
+                generator.add_profile(path.substr(PROFILE_OPTION.size()));
+                continue;
+            }
+            bytefile file = read_file(path);
+            generator.add_bytefile(file);
+        }
+        generator.print(std::cout, count);
+    }
+
 }
@@ -2,8 +2,12 @@
 #define IDIOM_ANALYZER_H
 
 #include <cstdint>
+#include <map>
+#include <ostream>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -80,10 +84,12 @@ namespace assignment_03 {
 
         void find_reachable_instructions();
 
-        void find_idioms();
+        void find_idioms(uint32_t max_size = 2);
 
         std::vector<std::pair<size_t, idiom>> sort_idioms();
 
+        [[nodiscard]] const std::vector<idiom>& get_idioms() const noexcept;
+
     private:
         std::vector<bool> reachable_;
         std::vector<bool> jump_targets_;
@@ -103,8 +109,33 @@ namespace assignment_03 {
         static void validate(bool condition, const std::string& message, uint32_t bytecode_offset);
     };
 
+    class superinstruction_generator {
+    public:
+        constexpr static uint32_t MAX_SUPERINSTRUCTION_SIZE = 3;
+
+        superinstruction_generator() = default;
+
+        // Every occurrence of a sequence counts once, or as many times as its first instruction was executed when the
+        // counts by offset are given.
+        void add_bytefile(const bytefile& file, std::span<const uint64_t> executed = {});
+
+        // Reads a profile written by Assignment04 --profile-opcodes together with the bytefile it names.
+        void add_profile(const std::string& path);
+
+        void print(std::ostream& os, size_t count) const;
+
+    private:
+        std::map<std::vector<bytecode>, size_t> frequencies_;
+
+        static bool is_fusable(const std::vector<bytecode>& ops) noexcept;
+
+        static std::string_view get_op_name(bytecode op) noexcept;
+    };
+
     void analyze_idioms(const bytefile& file);
 
+    void generate_superinstructions(const std::vector<std::string>& paths, size_t count);
+
     inline uint32_t idiom::get_pos() const noexcept {
         return pos_;
     }
@@ -113,6 +144,10 @@ namespace assignment_03 {
         return size_;
     }
 
+    inline const std::vector<idiom>& idiom_processor::get_idioms() const noexcept {
+        return idioms_;
+    }
+
     inline bool idiom_processor::is_jump(bytecode op) noexcept {
         return op == bytecode::JMP || op == bytecode::CJMPZ || op == bytecode::CJMPNZ;
     }
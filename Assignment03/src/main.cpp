@@ -1,13 +1,34 @@
+#include <charconv>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "bytefile.h"
 #include "file_reader.h"
 #include "idiom_analyzer.h"
 
 int main(int argc, char** argv) {
+    constexpr static std::string_view SUPERINSTRUCTIONS_OPTION = "--superinstructions=";
+    if (argc > 2 && std::string_view(argv[1]).starts_with(SUPERINSTRUCTIONS_OPTION)) {
+        std::string_view count_arg = std::string_view(argv[1]).substr(SUPERINSTRUCTIONS_OPTION.size());
+        size_t count = 0;
+        auto [ptr, ec] = std::from_chars(count_arg.data(), count_arg.data() + count_arg.size(), count);
+        if (ec != std::errc{} || ptr != count_arg.data() + count_arg.size()) {
+            std::cerr << "Invalid superinstruction count: " << count_arg << std::endl;
+            return -1;
+        }
+        try {
+            assignment_03::generate_superinstructions(std::vector<std::string>(argv + 2, argv + argc), count);
+        } catch (const std::exception& exc) {
+            std::cerr << exc.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
     if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--superinstructions=<count> (<filename> | --profile=<profile>)...] <filename>" << std::endl;
         return -1;
     }
     try {
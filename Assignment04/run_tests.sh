@@ -2,9 +2,15 @@
 
 LAMAC=lamac
 ASSIGNMENT04="$(pwd)/build/assignment04"
+ASSIGNMENT04_AOT_COMPILER="$(pwd)/build/Assignment04-aot"
+ASSIGNMENT04_AOT="${ASSIGNMENT04_AOT:-}"
+CXX="${CXX:-c++}"
+SOURCE_DIR="$(pwd)/src"
+read -r -a ASSIGNMENT04_OPTIONS <<< "${ASSIGNMENT04_OPTIONS:-}"
 DIFF=diff
 TIME="/usr/bin/time"
 RUNTIME_DIR="$(pwd)/../runtime"
+BYTECODE_TESTS_DIR="$(pwd)/tests/bytecode"
 REGRESSION_TESTS_DIR="$(pwd)/../tests/regression"
 PERFORMANCE_TESTS_DIR="$(pwd)/../tests/performance"
 DISABLED_TESTS=("test034.lama" "test036.lama" "test050.lama" "test077.lama")
@@ -30,13 +36,37 @@ print_time () {
   local recursive_source_level_time=$2
   local recursive_bytecode_time=$3
   local iterative_bytecode_time=$4
+  local threaded_bytecode_time=$5
+  local register_bytecode_time=$6
+  local aot_time=$7
   echo "$test_name:"
   echo -e "Recursive source-level interpreter\t$recursive_source_level_time"
   echo -e "Recursive bytecode interpreter\t$recursive_bytecode_time"
   echo -e "Iterative bytecode interpreter\t$iterative_bytecode_time"
+  echo -e "Iterative bytecode interpreter (threaded dispatch)\t$threaded_bytecode_time"
+  echo -e "Iterative bytecode interpreter (register bytecode)\t$register_bytecode_time"
+  echo -e "Ahead-of-time compiled bytecode\t$aot_time"
   echo
 }
 
+aot_compile () {
+  local test_bytecode="$1"
+  local test_binary="$2"
+  "$ASSIGNMENT04_AOT_COMPILER" "$test_bytecode" > "$test_binary.cpp" && \
+  "$CXX" -std=c++20 -O2 -I "$SOURCE_DIR" -I "$RUNTIME_DIR" "$test_binary.cpp" "$RUNTIME_DIR/runtime.a" -o "$test_binary" -lpthread \
+    -Wl,--defsym=__start_custom_data=0 -Wl,--defsym=__stop_custom_data=0
+}
+
+run_bytecode () {
+  local test_bytecode="$1"
+  local test_binary="$2"
+  if [ -n "$ASSIGNMENT04_AOT" ]; then
+    aot_compile "$test_bytecode" "$test_binary" && "./$test_binary"
+  else
+    "$ASSIGNMENT04" "${ASSIGNMENT04_OPTIONS[@]}" "$test_bytecode"
+  fi
+}
+
 regression_test () {
   local test_name="$1"
   local test_bytecode="${test_name%.*}.bc"
@@ -49,15 +79,40 @@ regression_test () {
     echo
     return $?
   fi
+  local test_binary="${test_name%.*}.aot"
   "$LAMAC" -I "$RUNTIME_DIR" -i "$test_name" < "$test_input" > "$expected_output" 2>&1 && \
-  "$ASSIGNMENT04" "$test_bytecode" < "$test_input" > "$actual_output" 2>&1 && \
+  run_bytecode "$test_bytecode" "$test_binary" < "$test_input" > "$actual_output" 2>&1 && \
   "$DIFF" -q "$expected_output" "$actual_output" > /dev/null 2>&1
   local result=$?
   print_status_and_record "$test_name" "$expected_output" "$actual_output" $result
-  rm -f "$test_bytecode" "$expected_output" "$actual_output"
+  rm -f "$test_bytecode" "$test_binary" "$test_binary.cpp" "$expected_output" "$actual_output"
   return $result
 }
 
+# Hand-assembled bytefiles for what the Lama compiler cannot produce on purpose, run on every engine. Failing programs
+# are expected, so only the output is compared.
+bytecode_test () {
+  local test_bytecode="$1"
+  local test_name="${test_bytecode%.*}"
+  local test_input="$test_name.input"
+  local expected_output="$test_name.expected.output"
+  local actual_output="$test_name.actual.output"
+  local test_binary="$test_name.aot"
+  local engines=("--dispatch=switch" "--dispatch=threaded" "--dispatch=register" "--jit" "--jit=tiered" "aot")
+  local engine
+  [ -f "$test_input" ] || test_input=/dev/null
+  for engine in "${engines[@]}"; do
+    if [ "$engine" = "aot" ]; then
+      aot_compile "$test_bytecode" "$test_binary" > /dev/null 2>&1 && "./$test_binary" < "$test_input" > "$actual_output" 2>&1
+    else
+      "$ASSIGNMENT04" "$engine" "$test_bytecode" < "$test_input" > "$actual_output" 2>&1
+    fi
+    "$DIFF" -q "$expected_output" "$actual_output" > /dev/null 2>&1
+    print_status_and_record "$test_name ($engine)" "$expected_output" "$actual_output" $?
+  done
+  rm -f "$test_binary" "$test_binary.cpp" "$actual_output"
+}
+
 performance_test () {
   local test_name="$1"
   local test_bytecode="${test_name%.*}.bc"
@@ -69,11 +124,24 @@ performance_test () {
   fi
   local recursive_source_level_time=$("$TIME" -f %U "$LAMAC" -I "$RUNTIME_DIR" -i "$test_name" < /dev/null 2>&1 > /dev/null)
   local recursive_bytecode_time=$("$TIME" -f %U "$LAMAC" -I "$RUNTIME_DIR" -s "$test_name" < /dev/null 2>&1 > /dev/null)
-  local iterative_bytecode_time=$("$TIME" -f %U "$ASSIGNMENT04" "$test_bytecode" < /dev/null 2>&1 > /dev/null)
-  print_time "$test_name" $recursive_source_level_time $recursive_bytecode_time $iterative_bytecode_time
-  rm -f "$test_bytecode"
+  local iterative_bytecode_time=$("$TIME" -f %U "$ASSIGNMENT04" --dispatch=switch "$test_bytecode" < /dev/null 2>&1 > /dev/null)
+  local threaded_bytecode_time=$("$TIME" -f %U "$ASSIGNMENT04" --dispatch=threaded "$test_bytecode" < /dev/null 2>&1 > /dev/null)
+  local register_bytecode_time=$("$TIME" -f %U "$ASSIGNMENT04" --dispatch=register "$test_bytecode" < /dev/null 2>&1 > /dev/null)
+  local test_binary="${test_name%.*}.aot"
+  local aot_time="-"
+  if aot_compile "$test_bytecode" "$test_binary" > /dev/null 2>&1; then
+    aot_time=$("$TIME" -f %U "./$test_binary" < /dev/null 2>&1 > /dev/null)
+  fi
+  print_time "$test_name" $recursive_source_level_time $recursive_bytecode_time $iterative_bytecode_time $threaded_bytecode_time $register_bytecode_time $aot_time
+  rm -f "$test_bytecode" "$test_binary" "$test_binary.cpp"
 }
 
+echo "Running bytecode tests"
+cd "$BYTECODE_TESTS_DIR"
+for f in *.bc; do
+  bytecode_test "$f"
+done
+
 echo "Running regression tests"
 cd "$REGRESSION_TESTS_DIR"
 for f in *.lama; do
@@ -0,0 +1,370 @@
+#include "aot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+namespace assignment_04 {
+
+    static std::string_view get_binop_name(bytecode op) noexcept {
+        switch (op) {
+            case bytecode::LOW_ADD: return "LOW_ADD";
+            case bytecode::LOW_SUB: return "LOW_SUB";
+            case bytecode::LOW_MUL: return "LOW_MUL";
+            case bytecode::LOW_DIV: return "LOW_DIV";
+            case bytecode::LOW_MOD: return "LOW_MOD";
+            case bytecode::LOW_LT: return "LOW_LT";
+            case bytecode::LOW_LE: return "LOW_LE";
+            case bytecode::LOW_GT: return "LOW_GT";
+            case bytecode::LOW_GE: return "LOW_GE";
+            case bytecode::LOW_EQ: return "LOW_EQ";
+            case bytecode::LOW_NE: return "LOW_NE";
+            case bytecode::LOW_AND: return "LOW_AND";
+            case bytecode::LOW_OR: return "LOW_OR";
+            default: return {};
+        }
+    }
+
+    static std::string get_hex(uint32_t val, const char* format = "%#X") {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), format, val);
+        return buf;
+    }
+
+    aot_compiler::aot_compiler(const program& code)
+        : program_(code)
+        , function_ends_(code.get_size(), program::NO_INDEX)
+        , jump_targets_(code.get_size()) {
+        if (program_.get_size() == 0 || program_.get_instruction(0).get_op() != bytecode::BEGIN) {
+            throw std::runtime_error("The program must start with BEGIN");
+        }
+        uint32_t begin = 0;
+        for (uint32_t i = 1; i <= program_.get_size(); ++i) {
+            if (i < program_.get_size()) {
+                bytecode op = program_.get_instruction(i).get_op();
+                if (op != bytecode::BEGIN && op != bytecode::CBEGIN) {
+                    continue;
+                }
+            }
+            function_ends_[begin] = i;
+            begin = i;
+        }
+        begin = 0;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (function_ends_[i] != program::NO_INDEX) {
+                begin = i;
+            }
+            const instruction& insn = program_.get_instruction(i);
+            switch (insn.get_op()) {
+                case bytecode::JMP:
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ:
+                    if (insn.get_target() <= begin || insn.get_target() >= function_ends_[begin]) {
+                        throw std::runtime_error("Jump out of the function at offset " + get_hex(insn.get_offset()));
+                    }
+                    jump_targets_[insn.get_target()] = true;
+                    break;
+                case bytecode::SEXP:
+                case bytecode::TAG:
+                    if (std::find(tags_.begin(), tags_.end(), get_tag(insn)) == tags_.end()) {
+                        tags_.push_back(get_tag(insn));
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void aot_compiler::print(std::ostream& os) const {
+        os << "// Generated by Assignment04-aot from " << program_.get_bytefile().get_name() << ", do not edit.\n\n";
+        os << "#include \"aot_runtime.h\"\n\n";
+        os << "namespace {\n\n";
+        os << "    using namespace assignment_04;\n";
+        os << "    using namespace assignment_04::aot;\n\n";
+        os << "    [[maybe_unused]] aint tag_hashes[" << std::max<size_t>(tags_.size(), 1) << "];\n\n";
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (function_ends_[i] != program::NO_INDEX) {
+                os << "    void " << get_function_name(i) << "(bool is_closure);\n";
+            }
+        }
+        os << "\n    [[maybe_unused]] function resolve(uint32_t code_offset) {\n";
+        os << "        switch (code_offset) {\n";
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (function_ends_[i] != program::NO_INDEX) {
+                os << "            case " << get_hex(program_.get_offset(i)) << ":\n";
+                os << "                return &" << get_function_name(i) << ";\n";
+            }
+        }
+        os << "            default:\n";
+        os << "                return nullptr;\n";
+        os << "        }\n";
+        os << "    }\n\n";
+        os << "    void init() {\n";
+        for (size_t i = 0; i < tags_.size(); ++i) {
+            os << "        tag_hashes[" << i << "] = LtagHash(const_cast<char*>(" << get_literal(tags_[i]) << "));\n";
+        }
+        os << "    }\n";
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (function_ends_[i] != program::NO_INDEX) {
+                print_function(os, i, function_ends_[i]);
+            }
+        }
+        os << "\n}\n\n";
+        os << "int main() {\n";
+        os << "    return assignment_04::aot::run(" << program_.get_bytefile().get_global_area_size() << ", &" << get_function_name(0) << ", &init);\n";
+        os << "}\n";
+    }
+
+    // BEGIN and CBEGIN only open the frame, a closure frame is recognised by the caller passing is_closure.
+    void aot_compiler::print_function(std::ostream& os, uint32_t begin, uint32_t end) const {
+        const instruction& insn = program_.get_instruction(begin);
+        os << "\n    void " << get_function_name(begin) << "([[maybe_unused]] bool is_closure) {\n";
+        os << "        auint* const locals = enter(" << insn.get_second_arg() << ", " << get_hex(program_.get_offset(begin + 1)) << ");\n";
+        os << "        [[maybe_unused]] auint* const args = locals - " << insn.get_first_arg() << ";\n";
+        os << "        auint* sp = locals + " << (insn.get_second_arg() & 0xFFFF) << ";\n";
+        for (uint32_t i = begin + 1; i < end; ++i) {
+            if (jump_targets_[i]) {
+                os << "    " << get_label(i) << ":\n";
+            }
+            print_instruction(os, i);
+        }
+        os << "    }\n";
+    }
+
+    // Errors report the offset right after the instruction, where the interpreter's ip is while it runs.
+    void aot_compiler::print_instruction(std::ostream& os, uint32_t index) const {
+        const instruction& insn = program_.get_instruction(index);
+        std::string offset = get_hex(program_.get_offset(index + 1));
+        switch (insn.get_op()) {
+            case bytecode::LOW_ADD:
+            case bytecode::LOW_SUB:
+            case bytecode::LOW_MUL:
+            case bytecode::LOW_DIV:
+            case bytecode::LOW_MOD:
+            case bytecode::LOW_LT:
+            case bytecode::LOW_LE:
+            case bytecode::LOW_GT:
+            case bytecode::LOW_GE:
+            case bytecode::LOW_EQ:
+            case bytecode::LOW_NE:
+            case bytecode::LOW_AND:
+            case bytecode::LOW_OR:
+                os << "        sp = binop<bytecode::" << get_binop_name(insn.get_op()) << ">(sp, " << offset << ");\n";
+                break;
+            case bytecode::CONST:
+                os << "        *sp++ = BOX(" << insn.get_first_arg() << ");\n";
+                break;
+            case bytecode::STRING:
+                os << "        sp = make_string(sp, " << get_literal(insn.get_string()) << ", " << insn.get_string().size() << ");\n";
+                break;
+            case bytecode::SEXP:
+                os << "        sp = make_sexp(sp, tag_hashes[" << get_tag_id(get_tag(insn)) << "], " << insn.get_second_arg() << ");\n";
+                break;
+            case bytecode::STI:
+                os << "        sp = sti(sp, " << offset << ");\n";
+                break;
+            case bytecode::STA:
+                os << "        sp = sta(sp, " << offset << ");\n";
+                break;
+            case bytecode::JMP:
+                os << "        goto " << get_label(insn.get_target()) << ";\n";
+                break;
+            case bytecode::END:
+            case bytecode::RET:
+                os << "        leave(args - is_closure, sp[-1]);\n";
+                os << "        return;\n";
+                break;
+            case bytecode::DROP:
+                os << "        --sp;\n";
+                break;
+            case bytecode::DUP:
+                os << "        *sp = sp[-1];\n";
+                os << "        ++sp;\n";
+                break;
+            case bytecode::SWAP:
+                // The interpreter pushes the popped values back in the same order, so SWAP leaves the stack as it is.
+                break;
+            case bytecode::ELEM:
+                os << "        sp = elem(sp, " << offset << ");\n";
+                break;
+            case bytecode::LD_GLOBAL:
+                os << "        *sp++ = stack_buf[" << insn.get_first_arg() << "];\n";
+                break;
+            case bytecode::LD_LOCAL:
+                os << "        *sp++ = locals[" << insn.get_first_arg() << "];\n";
+                break;
+            case bytecode::LD_ARGUMENT:
+                os << "        *sp++ = args[" << insn.get_first_arg() << "];\n";
+                break;
+            case bytecode::LD_CAPTURED:
+                os << "        *sp++ = *captured(args, " << insn.get_first_arg() << ", \"LD: captured index out of bounds. Bytecode offset: %#X\\n\", " << offset << ");\n";
+                break;
+            case bytecode::LDA_GLOBAL:
+                os << "        *sp++ = reinterpret_cast<auint>(&stack_buf[" << insn.get_first_arg() << "]);\n";
+                break;
+            case bytecode::LDA_LOCAL:
+                os << "        *sp++ = reinterpret_cast<auint>(&locals[" << insn.get_first_arg() << "]);\n";
+                break;
+            case bytecode::LDA_ARGUMENT:
+                os << "        *sp++ = reinterpret_cast<auint>(&args[" << insn.get_first_arg() << "]);\n";
+                break;
+            case bytecode::LDA_CAPTURED:
+                os << "        *sp++ = reinterpret_cast<auint>(captured(args, " << insn.get_first_arg() << ", \"LDA: captured index out of bounds. Bytecode offset: %#X\\n\", " << offset << "));\n";
+                break;
+            case bytecode::ST_GLOBAL:
+                os << "        stack_buf[" << insn.get_first_arg() << "] = sp[-1];\n";
+                break;
+            case bytecode::ST_LOCAL:
+                os << "        locals[" << insn.get_first_arg() << "] = sp[-1];\n";
+                break;
+            case bytecode::ST_ARGUMENT:
+                os << "        args[" << insn.get_first_arg() << "] = sp[-1];\n";
+                break;
+            case bytecode::ST_CAPTURED:
+                os << "        *captured(args, " << insn.get_first_arg() << ", \"ST: captured index out of bounds. Bytecode offset: %#X\\n\", " << offset << ") = sp[-1];\n";
+                break;
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+                os << "        if (condition(*--sp, " << offset << ") == " << (insn.get_op() == bytecode::CJMPNZ ? 1 : 0) << ") {\n";
+                os << "            goto " << get_label(insn.get_target()) << ";\n";
+                os << "        }\n";
+                break;
+            case bytecode::CLOSURE:
+                os << "        *sp++ = BOX(" << insn.get_first_arg() << ");\n";
+                for (const capture& spec : insn.get_captures()) {
+                    print_capture(os, spec, program_.get_offset(index + 1));
+                }
+                os << "        sp = make_closure(sp, " << insn.get_second_arg() << ");\n";
+                break;
+            case bytecode::CALLC:
+                if (insn.is_tail_call()) {
+                    os << "        tail_call_closure(sp, args - is_closure, " << insn.get_first_arg() << ", &resolve, " << offset << ");\n";
+                    os << "        return;\n";
+                    break;
+                }
+                os << "        sp = call_closure(sp, " << insn.get_first_arg() << ", &resolve, " << offset << ");\n";
+                break;
+            case bytecode::CALL:
+                if (insn.is_tail_call()) {
+                    os << "        tail_call(sp, args - is_closure, " << insn.get_second_arg() << ", &" << get_function_name(insn.get_target()) << ");\n";
+                    os << "        return;\n";
+                    break;
+                }
+                os << "        sp = call(sp, &" << get_function_name(insn.get_target()) << ");\n";
+                break;
+            case bytecode::TAG:
+                os << "        sp[-1] = match_tag(sp[-1], tag_hashes[" << get_tag_id(get_tag(insn)) << "], " << insn.get_second_arg() << ");\n";
+                break;
+            case bytecode::ARRAY:
+                os << "        sp[-1] = match_array(sp[-1], " << insn.get_first_arg() << ");\n";
+                break;
+            case bytecode::FAIL:
+                os << "        fail(sp, " << get_literal(program_.get_bytefile().get_name()) << ", " << insn.get_first_arg() << ", " << insn.get_second_arg() << ");\n";
+                break;
+            case bytecode::LINE:
+                break;
+            case bytecode::PATT_STR:
+                os << "        sp = pattern_string(sp);\n";
+                break;
+            case bytecode::PATT_STRING:
+                os << "        pattern<Bstring_tag_patt>(sp);\n";
+                break;
+            case bytecode::PATT_ARRAY:
+                os << "        pattern<Barray_tag_patt>(sp);\n";
+                break;
+            case bytecode::PATT_SEXP:
+                os << "        pattern<Bsexp_tag_patt>(sp);\n";
+                break;
+            case bytecode::PATT_REF:
+                os << "        pattern<Bboxed_patt>(sp);\n";
+                break;
+            case bytecode::PATT_VAL:
+                os << "        pattern<Bunboxed_patt>(sp);\n";
+                break;
+            case bytecode::PATT_FUN:
+                os << "        pattern<Bclosure_tag_patt>(sp);\n";
+                break;
+            case bytecode::CALL_LREAD:
+                os << "        sp = read(sp);\n";
+                break;
+            case bytecode::CALL_LWRITE:
+                os << "        write(sp, " << offset << ");\n";
+                break;
+            case bytecode::CALL_LLENGTH:
+                os << "        length(sp, " << offset << ");\n";
+                break;
+            case bytecode::CALL_LSTRING:
+                os << "        to_string(sp);\n";
+                break;
+            case bytecode::CALL_BARRAY:
+                os << "        sp = make_array(sp, " << insn.get_first_arg() << ");\n";
+                break;
+            case bytecode::STOP:
+                os << "        stop();\n";
+                break;
+            default:
+                throw std::runtime_error("Unknown bytecode at offset " + get_hex(insn.get_offset()));
+        }
+    }
+
+    void aot_compiler::print_capture(std::ostream& os, const capture& spec, uint32_t offset) const {
+        switch (spec.get_type()) {
+            case varspec::GLOBAL:
+                os << "        *sp++ = stack_buf[" << spec.get_addr() << "];\n";
+                break;
+            case varspec::LOCAL:
+                os << "        *sp++ = locals[" << spec.get_addr() << "];\n";
+                break;
+            case varspec::ARGUMENT:
+                os << "        *sp++ = args[" << spec.get_addr() << "];\n";
+                break;
+            case varspec::CAPTURED:
+                os << "        *sp++ = *captured(args, " << spec.get_addr() << ", \"CLOSURE: captured index out of bounds. Bytecode offset: %#X\\n\", " << get_hex(offset) << ");\n";
+                break;
+            default:
+                throw std::runtime_error("CLOSURE: invalid varspec at offset " + get_hex(offset));
+        }
+    }
+
+    // The decoded SEXP and TAG only keep the hash of their tag.
+    std::string_view aot_compiler::get_tag(const instruction& insn) const {
+        return program_.get_bytefile().get_string(static_cast<uint32_t>(insn.get_first_arg()));
+    }
+
+    size_t aot_compiler::get_tag_id(std::string_view tag) const {
+        return std::find(tags_.begin(), tags_.end(), tag) - tags_.begin();
+    }
+
+    std::string aot_compiler::get_function_name(uint32_t index) const {
+        return "function_" + get_hex(program_.get_offset(index), "%X");
+    }
+
+    std::string aot_compiler::get_label(uint32_t index) const {
+        return "label_" + get_hex(program_.get_offset(index), "%X");
+    }
+
+    std::string aot_compiler::get_literal(std::string_view string) {
+        std::string literal = "\"";
+        for (char c : string) {
+            if (c == '"' || c == '\\') {
+                literal += '\\';
+                literal += c;
+            } else if (c >= ' ' && c <= '~') {
+                literal += c;
+            } else {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\%03o", static_cast<unsigned char>(c));
+                literal += buf;
+            }
+        }
+        return literal + "\"";
+    }
+
+    void compile_to_cpp(const bytefile& file, std::ostream& os) {
+        program code = decode(file, false);
+        aot_compiler compiler(code);
+        compiler.print(os);
+    }
+
+}
@@ -0,0 +1,50 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "decoder.h"
+
+namespace assignment_04 {
+
+    // Translates a verified program to a C++ translation unit with one function per Lama function. Jumps become gotos
+    // between labels, calls become direct C++ calls and builtins call the runtime directly, through the helpers in
+    // aot_runtime.h. The output is built with the host compiler and linked against the Lama runtime.
+    class aot_compiler {
+    public:
+        explicit aot_compiler(const program& code);
+
+        void print(std::ostream& os) const;
+
+    private:
+        const program& program_;
+        std::vector<uint32_t> function_ends_;
+        std::vector<bool> jump_targets_;
+        std::vector<std::string_view> tags_;
+
+        void print_function(std::ostream& os, uint32_t begin, uint32_t end) const;
+
+        void print_instruction(std::ostream& os, uint32_t index) const;
+
+        void print_capture(std::ostream& os, const capture& spec, uint32_t offset) const;
+
+        [[nodiscard]] std::string_view get_tag(const instruction& insn) const;
+
+        [[nodiscard]] size_t get_tag_id(std::string_view tag) const;
+
+        [[nodiscard]] std::string get_function_name(uint32_t index) const;
+
+        [[nodiscard]] std::string get_label(uint32_t index) const;
+
+        [[nodiscard]] static std::string get_literal(std::string_view string);
+    };
+
+    void compile_to_cpp(const bytefile& file, std::ostream& os);
+
+}
+
+#endif
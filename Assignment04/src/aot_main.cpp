@@ -0,0 +1,26 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "aot.h"
+#include "bytefile.h"
+#include "file_reader.h"
+#include "verifier.h"
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <bytecode_file>" << std::endl;
+        return -1;
+    }
+    try {
+        assignment_04::mapped_file mapping(argv[1]);
+        assignment_04::bytefile file = assignment_04::read_file(mapping);
+        static_cast<void>(assignment_04::verify(file, std::max(1U, std::thread::hardware_concurrency())));
+        assignment_04::compile_to_cpp(file, std::cout);
+    } catch (const std::exception& exc) {
+        std::cerr << exc.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
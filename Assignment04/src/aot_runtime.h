@@ -0,0 +1,318 @@
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <pthread.h>
+
+#include "bytefile.h"
+#include "heap.h"
+#include "runtime_interface.h"
+#include "stack.h"
+
+// Support code for the C++ translation units produced by the ahead-of-time compiler. Generated functions keep their
+// operand stack in a local pointer and use the same stack, frame and value layout as the interpreter; the pointer is
+// written back to the runtime before anything that may allocate or call, so the garbage collector sees every value.
+namespace assignment_04::aot {
+
+    using function = void (*)(bool is_closure);
+
+    using resolver = function (*)(uint32_t code_offset);
+
+    // Lama calls are C++ calls, so the program runs on a thread with a large machine stack. Every function checks on
+    // entry that the stack still has room for the runtime calls it may make, so nesting is bounded by the machine stack
+    // rather than by a frame count.
+    constexpr inline size_t MACHINE_STACK_SIZE = size_t{1} << 30;
+
+    constexpr inline size_t MACHINE_STACK_RESERVE = size_t{16} << 20;
+
+    inline const std::byte* machine_stack_limit = nullptr;
+
+    inline void check(bool condition, const char* message, uint32_t offset) {
+        if (!condition) [[unlikely]] {
+            failure(const_cast<char*>(message), offset);
+        }
+    }
+
+    inline auint* get_top() noexcept {
+        return reinterpret_cast<auint*>(__gc_stack_bottom);
+    }
+
+    inline void sync(auint* sp) noexcept {
+        __gc_stack_bottom = reinterpret_cast<size_t>(sp);
+    }
+
+    inline bool is_integer(auint val) noexcept {
+        return (val & 1) != 0;
+    }
+
+    inline bool has_type(auint val, int type) noexcept {
+        return !is_integer(val) && get_type_header_ptr(get_obj_header_ptr(reinterpret_cast<void*>(val))) == type;
+    }
+
+    inline bool is_aggregate(auint val) noexcept {
+        return has_type(val, STRING) || has_type(val, ARRAY) || has_type(val, SEXP);
+    }
+
+    inline auint* enter(int32_t locals_size, uint32_t offset) {
+        int32_t frame_stack_size = (locals_size >> 16) & 0xFFFF;
+        locals_size &= 0xFFFF;
+        auint* locals = get_top();
+        check(static_cast<const std::byte*>(__builtin_frame_address(0)) > machine_stack_limit, "Frames stack overflow. Bytecode offset: %#X\n", offset);
+        check(static_cast<size_t>(locals - stack_buf.data()) + frame_stack_size <= MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n", offset);
+        std::fill_n(locals, locals_size, auint{0});
+        sync(locals + locals_size);
+        return locals;
+    }
+
+    inline void leave(auint* frame_bottom, auint ret) noexcept {
+        *frame_bottom = ret;
+        sync(frame_bottom + 1);
+    }
+
+    inline auint* call(auint* sp, function callee) {
+        sync(sp);
+        callee(false);
+        return get_top();
+    }
+
+    inline auint* call_closure(auint* sp, int32_t args_size, resolver resolve, uint32_t offset) {
+        auint target = sp[-args_size - 1];
+        check(has_type(target, CLOSURE), "CALLC: argument must be closure. Bytecode offset: %#X\n", offset);
+        function callee = resolve(UNBOX(reinterpret_cast<auint*>(TO_DATA(reinterpret_cast<void*>(target))->contents)[0]));
+        check(callee != nullptr, "CALLC: incorrect destination. Bytecode offset: %#X\n", offset);
+        sync(sp);
+        callee(true);
+        return get_top();
+    }
+
+    // The callee's arguments, and its closure for CALLC, replace the caller's frame, so the callee leaves its result
+    // where the caller would have. Only the nesting of the C++ calls remains, and the compiler usually turns them
+    // into jumps.
+    inline void reuse_frame(auint* sp, auint* frame_bottom, int32_t values_size) noexcept {
+        std::copy(sp - values_size, sp, frame_bottom);
+        sync(frame_bottom + values_size);
+    }
+
+    inline void tail_call(auint* sp, auint* frame_bottom, int32_t args_size, function callee) {
+        reuse_frame(sp, frame_bottom, args_size);
+        callee(false);
+    }
+
+    inline void tail_call_closure(auint* sp, auint* frame_bottom, int32_t args_size, resolver resolve, uint32_t offset) {
+        auint target = sp[-args_size - 1];
+        check(has_type(target, CLOSURE), "CALLC: argument must be closure. Bytecode offset: %#X\n", offset);
+        function callee = resolve(UNBOX(reinterpret_cast<auint*>(TO_DATA(reinterpret_cast<void*>(target))->contents)[0]));
+        check(callee != nullptr, "CALLC: incorrect destination. Bytecode offset: %#X\n", offset);
+        reuse_frame(sp, frame_bottom, args_size + 1);
+        callee(true);
+    }
+
+    template <bytecode Op>
+    inline auint* binop(auint* sp, uint32_t offset) {
+        auint rhs = sp[-1];
+        auint lhs = sp[-2];
+        int32_t res = 0;
+        if constexpr (Op == bytecode::LOW_EQ) {
+            check(is_integer(lhs) || is_integer(rhs), "EQ: one of the operands must be integer. Bytecode offset: %#X\n", offset);
+            res = is_integer(lhs) && is_integer(rhs) && UNBOX(lhs) == UNBOX(rhs);
+        } else {
+            check(is_integer(lhs), "BINOP: operand must be integer. Bytecode offset: %#X\n", offset);
+            check(is_integer(rhs), "BINOP: operand must be integer. Bytecode offset: %#X\n", offset);
+            int64_t lhs_int = static_cast<int32_t>(UNBOX(lhs));
+            int64_t rhs_int = static_cast<int32_t>(UNBOX(rhs));
+            if constexpr (Op == bytecode::LOW_ADD) {
+                res = static_cast<int32_t>(lhs_int + rhs_int);
+            } else if constexpr (Op == bytecode::LOW_SUB) {
+                res = static_cast<int32_t>(lhs_int - rhs_int);
+            } else if constexpr (Op == bytecode::LOW_MUL) {
+                res = static_cast<int32_t>(lhs_int * rhs_int);
+            } else if constexpr (Op == bytecode::LOW_DIV) {
+                check(rhs_int != 0, "DIV: division by zero. Bytecode offset: %#X\n", offset);
+                res = static_cast<int32_t>(lhs_int / rhs_int);
+            } else if constexpr (Op == bytecode::LOW_MOD) {
+                check(rhs_int != 0, "MOD: division by zero. Bytecode offset: %#X\n", offset);
+                res = static_cast<int32_t>(lhs_int % rhs_int);
+            } else if constexpr (Op == bytecode::LOW_LT) {
+                res = lhs_int < rhs_int;
+            } else if constexpr (Op == bytecode::LOW_LE) {
+                res = lhs_int <= rhs_int;
+            } else if constexpr (Op == bytecode::LOW_GT) {
+                res = lhs_int > rhs_int;
+            } else if constexpr (Op == bytecode::LOW_GE) {
+                res = lhs_int >= rhs_int;
+            } else if constexpr (Op == bytecode::LOW_NE) {
+                res = lhs_int != rhs_int;
+            } else if constexpr (Op == bytecode::LOW_AND) {
+                res = lhs_int && rhs_int;
+            } else if constexpr (Op == bytecode::LOW_OR) {
+                res = lhs_int || rhs_int;
+            } else {
+                static_assert(Op != Op, "BINOP: unknown bytecode");
+            }
+        }
+        sp[-2] = BOX(res);
+        return sp - 1;
+    }
+
+    inline int32_t condition(auint val, uint32_t offset) {
+        check(is_integer(val), "CJMPZ/CJMPNZ: argument must be integer. Bytecode offset: %#X\n", offset);
+        return UNBOX(val);
+    }
+
+    inline auint* make_string(auint* sp, const char* literal, size_t size) {
+        sync(sp);
+        *sp = new_string(std::string_view{literal, size});
+        return sp + 1;
+    }
+
+    inline auint* make_sexp(auint* sp, aint tag_hash, int32_t elements_size) {
+        sync(sp);
+        auint* elements = sp - elements_size;
+        *elements = new_s_expr(tag_hash, std::span<const auint>(elements, elements_size));
+        return elements + 1;
+    }
+
+    inline auint* sti(auint* sp, uint32_t offset) {
+        auint addr = sp[-1];
+        check(!is_integer(addr), "STI: argument must be reference. Bytecode offset: %#X\n", offset);
+        *reinterpret_cast<auint*>(addr) = sp[-2];
+        return sp - 1;
+    }
+
+    inline auint* sta(auint* sp, uint32_t offset) {
+        auint val = sp[-1];
+        auint selector = sp[-2];
+        if (!is_integer(selector)) {
+            *reinterpret_cast<auint*>(selector) = val;
+            sp[-2] = val;
+            return sp - 1;
+        }
+        int32_t idx = UNBOX(selector);
+        auint agg = sp[-3];
+        check(is_aggregate(agg), "STA: argument must be aggregate. Bytecode offset: %#X\n", offset);
+        check(idx >= 0 && idx < UNBOX(Llength(reinterpret_cast<void*>(agg))), "STA: index out of bounds. Bytecode offset: %#X\n", offset);
+        Bsta(reinterpret_cast<void*>(agg), BOX(idx), reinterpret_cast<void*>(val));
+        sp[-3] = val;
+        return sp - 2;
+    }
+
+    inline auint* elem(auint* sp, uint32_t offset) {
+        auint idx = sp[-1];
+        check(is_integer(idx), "ELEM: index must be integer. Bytecode offset: %#X\n", offset);
+        int32_t idx_int = UNBOX(idx);
+        auint agg = sp[-2];
+        check(is_aggregate(agg), "ELEM: argument must be aggregate. Bytecode offset: %#X\n", offset);
+        check(idx_int >= 0 && idx_int < UNBOX(Llength(reinterpret_cast<void*>(agg))), "ELEM: index out of bounds. Bytecode offset: %#X\n", offset);
+        sp[-2] = reinterpret_cast<auint>(Belem(reinterpret_cast<void*>(agg), BOX(idx_int)));
+        return sp - 1;
+    }
+
+    // The closure of a closure frame sits right below its arguments.
+    inline auint* captured(auint* args, int32_t addr, const char* message, uint32_t offset) {
+        auint* contents = reinterpret_cast<auint*>(TO_DATA(reinterpret_cast<void*>(args[-1]))->contents);
+        check(addr >= 0 && addr < UNBOX(Llength(reinterpret_cast<void*>(args[-1]))) - 1, message, offset);
+        return &contents[addr + 1];
+    }
+
+    inline auint* make_closure(auint* sp, int32_t captured_size) {
+        sync(sp);
+        auint* captures = sp - captured_size - 1;
+        *captures = new_closure(std::span<const auint>(captures, captured_size + 1));
+        return captures + 1;
+    }
+
+    inline auint match_tag(auint val, aint tag_hash, int32_t elements_size) {
+        if (!has_type(val, SEXP)) {
+            return BOX(0);
+        }
+        return static_cast<auint>(Btag(reinterpret_cast<void*>(val), tag_hash, BOX(elements_size)));
+    }
+
+    inline auint match_array(auint val, int32_t elements_size) {
+        return static_cast<auint>(Barray_patt(reinterpret_cast<void*>(val), BOX(elements_size)));
+    }
+
+    [[noreturn]] inline void fail(auint* sp, const char* file_name, int32_t line_number, int32_t column_number) {
+        sync(sp);
+        Bmatch_failure(reinterpret_cast<void*>(sp[-1]), const_cast<char*>(file_name), line_number, column_number);
+        std::abort();
+    }
+
+    template <aint (*Pattern)(void*)>
+    inline void pattern(auint* sp) {
+        sp[-1] = static_cast<auint>(Pattern(reinterpret_cast<void*>(sp[-1])));
+    }
+
+    inline auint* pattern_string(auint* sp) {
+        sp[-2] = static_cast<auint>(Bstring_patt(reinterpret_cast<void*>(sp[-2]), reinterpret_cast<void*>(sp[-1])));
+        return sp - 1;
+    }
+
+    inline auint* read(auint* sp) {
+        sync(sp);
+        *sp = static_cast<auint>(Lread());
+        return sp + 1;
+    }
+
+    inline void write(auint* sp, uint32_t offset) {
+        check(is_integer(sp[-1]), "CALL_LWRITE: invalid output. Bytecode offset: %#X\n", offset);
+        Lwrite(static_cast<aint>(sp[-1]));
+        sp[-1] = 0;
+    }
+
+    inline void length(auint* sp, uint32_t offset) {
+        check(is_aggregate(sp[-1]), "CALL_LLENGTH: argument must be aggregate. Bytecode offset: %#X\n", offset);
+        sp[-1] = BOX(UNBOX(Llength(reinterpret_cast<void*>(sp[-1]))));
+    }
+
+    inline void to_string(auint* sp) {
+        sync(sp);
+        aint args[1] = {static_cast<aint>(sp[-1])};
+        sp[-1] = reinterpret_cast<auint>(Lstring(args));
+    }
+
+    inline auint* make_array(auint* sp, int32_t elements_size) {
+        sync(sp);
+        auint* elements = sp - elements_size;
+        *elements = new_array(std::span<const auint>(elements, elements_size));
+        return elements + 1;
+    }
+
+    [[noreturn]] inline void stop() {
+        std::fflush(stdout);
+        std::_Exit(0);
+    }
+
+    inline void* run_entry(void* entry) {
+        machine_stack_limit = static_cast<const std::byte*>(__builtin_frame_address(0)) - MACHINE_STACK_SIZE + MACHINE_STACK_RESERVE;
+        reinterpret_cast<function>(entry)(false);
+        return nullptr;
+    }
+
+    // The globals and the two arguments of the main function make up the bottom of the stack, as in the interpreter.
+    inline int run(uint32_t globals_size, function entry, void (*init)()) {
+        __gc_stack_top = reinterpret_cast<size_t>(stack_buf.data());
+        sync(stack_buf.data() + globals_size + 2);
+        __init();
+        init();
+        pthread_attr_t attr;
+        pthread_t thread;
+        if (pthread_attr_init(&attr) != 0 || pthread_attr_setstacksize(&attr, MACHINE_STACK_SIZE) != 0
+            || pthread_create(&thread, &attr, &run_entry, reinterpret_cast<void*>(entry)) != 0) {
+            std::fprintf(stderr, "Can not start the program thread\n");
+            return -1;
+        }
+        pthread_join(thread, nullptr);
+        pthread_attr_destroy(&attr);
+        __shutdown();
+        return 0;
+    }
+
+}
+
+#endif
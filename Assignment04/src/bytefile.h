@@ -3,10 +3,8 @@
 
 #include <cstdint>
 #include <span>
+#include <string>
 #include <string_view>
-#include <vector>
-
-#include "byterun_interface.h"
 
 namespace assignment_04 {
 
@@ -98,46 +96,39 @@ namespace assignment_04 {
         uint32_t address_;
     };
 
+    // A view of a bytefile laid out as on disk: the header, the public symbols, the string table and the code. The
+    // memory belongs to whoever loaded the file; only the code may be patched in place.
     class bytefile {
     public:
-        bytefile(std::string_view name, uint32_t string_tab_size, uint32_t public_symbols_size, uint32_t code_size);
+        constexpr static uint32_t HEADER_SIZE = 3 * sizeof(int32_t);
 
-        ~bytefile();
+        constexpr static uint32_t PUBLIC_SYMBOL_SIZE = 2 * sizeof(int32_t);
 
-        [[nodiscard]] ::bytefile* get_base() const noexcept;
+        // The sizes are read from the header, and the caller has checked that the sections they describe fit in the data.
+        bytefile(std::string_view name, std::span<char> data) noexcept;
 
         [[nodiscard]] std::string_view get_name() const noexcept;
 
         [[nodiscard]] uint32_t get_global_area_size() const noexcept;
 
-        void set_global_area_size(uint32_t global_area_size) noexcept;
-
         [[nodiscard]] uint32_t get_public_symbols_size() const noexcept;
 
         public_symbol get_public_symbol(uint32_t pos) const;
 
-        void add_public_symbol(public_symbol symbol);
-
         [[nodiscard]] uint32_t get_string_tab_size() const noexcept;
 
         std::string_view get_string(uint32_t pos) const;
 
-        void add_string(const std::vector<char>& string);
-
         std::string_view get_public_symbol_name(uint32_t pos) const;
 
         [[nodiscard]] uint32_t get_code_pos() const noexcept;
 
-        void set_code_pos(uint32_t code_pos) noexcept;
-
         [[nodiscard]] uint32_t get_code_size() const noexcept;
 
         bytecode get_code(uint32_t pos) const;
 
         void set_code(uint32_t pos, bytecode code);
 
-        void add_code(const std::vector<bytecode>& code);
-
         varspec get_varspec(uint32_t pos) const;
 
         void set_varspec(uint32_t pos, varspec spec);
@@ -149,13 +140,20 @@ namespace assignment_04 {
         std::span<const bytecode> get_bytes(uint32_t pos, uint32_t count) const;
 
     private:
-        ::bytefile* base_;
         std::string_view name_;
-        std::vector<size_t> offsets_;
+        uint32_t string_tab_size_;
+        uint32_t global_area_size_;
+        uint32_t public_symbols_size_;
+        const char* public_ptr_;
+        const char* string_ptr_;
+        char* code_ptr_;
         uint32_t code_pos_;
         uint32_t code_size_;
     };
 
+    // The public symbol of the function whose BEGIN is at the offset, or `fun_` and the offset for a function without one.
+    [[nodiscard]] std::string get_function_name(const bytefile& file, uint32_t offset);
+
     inline size_t public_symbol::get_offset() const noexcept {
         return offset_;
     }
@@ -168,42 +166,42 @@ namespace assignment_04 {
         return address_;
     }
 
-    inline ::bytefile* bytefile::get_base() const noexcept {
-        return base_;
-    }
-
     inline std::string_view bytefile::get_name() const noexcept {
         return name_;
     }
 
     inline uint32_t bytefile::get_global_area_size() const noexcept {
-        return base_->global_area_size;
-    }
-
-    inline void bytefile::set_global_area_size(uint32_t global_area_size) noexcept {
-        base_->global_area_size = static_cast<int>(global_area_size);
+        return global_area_size_;
     }
 
     inline uint32_t bytefile::get_public_symbols_size() const noexcept {
-        return base_->public_symbols_number;
+        return public_symbols_size_;
     }
 
     inline uint32_t bytefile::get_string_tab_size() const noexcept {
-        return base_->stringtab_size;
+        return string_tab_size_;
     }
 
     inline uint32_t bytefile::get_code_pos() const noexcept {
         return code_pos_;
     }
 
-    inline void bytefile::set_code_pos(uint32_t code_pos) noexcept {
-        code_pos_ = code_pos;
-    }
-
     inline uint32_t bytefile::get_code_size() const noexcept {
         return code_size_;
     }
 
+    inline bytecode bytefile::get_code(uint32_t pos) const {
+        return static_cast<bytecode>(code_ptr_[pos]);
+    }
+
+    inline varspec bytefile::get_varspec(uint32_t pos) const {
+        return static_cast<varspec>(code_ptr_[pos]);
+    }
+
+    inline int32_t bytefile::get_int32(uint32_t pos) const {
+        return *static_cast<const int32_t*>(static_cast<const void*>(&code_ptr_[pos]));
+    }
+
 }
 
 #endif
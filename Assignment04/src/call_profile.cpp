@@ -0,0 +1,120 @@
+#include "call_profile.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace assignment_04 {
+
+    call_profile::call_profile(const bytefile& file, state& interpreter_state)
+        : bytefile_(file)
+        , state_(interpreter_state)
+        , function_indices_(file.get_code_size(), NO_FUNCTION)
+        , heap_mark_(__gc_heap->current)
+        , allocated_(0)
+        , executed_(0)
+        , start_cycles_(read_cycles())
+        , cycles_(0) {
+    }
+
+    // The caller is the innermost function before a tail call leaves it.
+    void call_profile::enter(uint32_t offset) {
+        uint64_t now = read_cycles();
+        uint32_t& callee = function_indices_[offset];
+        if (callee == NO_FUNCTION) {
+            callee = static_cast<uint32_t>(functions_.size());
+            functions_.push_back(function_record{offset, 0, 0, 0, 0, 0, 0});
+        }
+        const auint* locals = state_.get_locals();
+        if (!activations_.empty()) {
+            ++edges_[static_cast<uint64_t>(activations_.back().function) << 32 | callee];
+            if (activations_.back().caller_locals == locals) {
+                leave(now);
+            }
+        }
+        function_record& function = functions_[callee];
+        ++function.calls;
+        ++function.active;
+        activations_.push_back(activation{callee, locals, now, 0, allocated_, 0});
+    }
+
+    void call_profile::leave(uint64_t now) {
+        activation callee = activations_.back();
+        activations_.pop_back();
+        uint64_t cycles = now - callee.entry_cycles;
+        uint64_t bytes = allocated_ - callee.entry_bytes;
+        function_record& function = functions_[callee.function];
+        function.exclusive_cycles += cycles - std::min(cycles, callee.callee_cycles);
+        function.exclusive_bytes += bytes - std::min(bytes, callee.callee_bytes);
+        if (--function.active == 0) {
+            function.inclusive_cycles += cycles;
+            function.inclusive_bytes += bytes;
+        }
+        if (!activations_.empty()) {
+            activations_.back().callee_cycles += cycles;
+            activations_.back().callee_bytes += bytes;
+        }
+    }
+
+    void call_profile::finish() {
+        uint64_t now = read_cycles();
+        while (!activations_.empty()) {
+            leave(now);
+        }
+        cycles_ = now - start_cycles_;
+    }
+
+    static void write_string(std::ostream& os, std::string_view str) {
+        os << '"';
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                os << '\\';
+            }
+            os << c;
+        }
+        os << '"';
+    }
+
+    void call_profile::write(std::ostream& os) const {
+        std::vector<uint32_t> functions(functions_.size());
+        for (uint32_t i = 0; i < functions.size(); ++i) {
+            functions[i] = i;
+        }
+        std::sort(functions.begin(), functions.end(), [this](uint32_t lhs, uint32_t rhs) {
+            const function_record& l = functions_[lhs];
+            const function_record& r = functions_[rhs];
+            return l.inclusive_cycles != r.inclusive_cycles ? l.inclusive_cycles > r.inclusive_cycles : l.offset < r.offset;
+        });
+        std::vector<std::pair<uint64_t, uint64_t>> edges(edges_.begin(), edges_.end());
+        std::sort(edges.begin(), edges.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+        });
+        std::vector<std::string> names;
+        names.reserve(functions_.size());
+        for (const function_record& function : functions_) {
+            names.push_back(get_function_name(bytefile_, function.offset));
+        }
+        os << "{\n  \"file\": ";
+        write_string(os, bytefile_.get_name());
+        os << ",\n  \"executed\": " << executed_ << ",\n  \"cycles\": " << cycles_ << ",\n  \"allocated_bytes\": " << allocated_ << ",\n  \"functions\": [";
+        for (size_t i = 0; i < functions.size(); ++i) {
+            const function_record& function = functions_[functions[i]];
+            os << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+            write_string(os, names[functions[i]]);
+            os << ", \"offset\": " << function.offset << ", \"calls\": " << function.calls << ", \"inclusive_cycles\": " << function.inclusive_cycles
+               << ", \"exclusive_cycles\": " << function.exclusive_cycles << ", \"inclusive_bytes\": " << function.inclusive_bytes
+               << ", \"exclusive_bytes\": " << function.exclusive_bytes << "}";
+        }
+        os << "\n  ],\n  \"edges\": [";
+        for (size_t i = 0; i < edges.size(); ++i) {
+            os << (i == 0 ? "\n" : ",\n") << "    {\"caller\": ";
+            write_string(os, names[edges[i].first >> 32]);
+            os << ", \"callee\": ";
+            write_string(os, names[edges[i].first & 0xFFFFFFFF]);
+            os << ", \"calls\": " << edges[i].second << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+}
@@ -0,0 +1,118 @@
+#ifndef CALL_PROFILE_H
+#define CALL_PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "bytefile.h"
+#include "interpreter.h"
+#include "runtime_interface.h"
+
+namespace assignment_04 {
+
+    // An instrumentation policy of the switch dispatch that follows the calls of Lama functions. Every BEGIN enters a
+    // function and every END or RET leaves it; a BEGIN reached while the frame below the innermost function is current
+    // follows a tail call, which has left that function already. Time is counted in TSC cycles, and allocation by how
+    // far each instruction moved the heap pointer, so the object an instruction allocates after a collection is missed.
+    // A recursive function counts inclusive totals only for its outermost activation.
+    class call_profile {
+    public:
+        call_profile(const bytefile& file, state& interpreter_state);
+
+        void record(uint32_t offset, bytecode op);
+
+        [[nodiscard]] uint64_t get_executed() const noexcept;
+
+        // Leaves the functions still running when the program stops.
+        void finish();
+
+        // A JSON object with the totals, the functions by inclusive time, and the caller to callee edges by calls.
+        void write(std::ostream& os) const;
+
+    private:
+        constexpr static uint32_t NO_FUNCTION = static_cast<uint32_t>(-1);
+
+        struct function_record {
+            uint32_t offset;
+            uint32_t active;
+            uint64_t calls;
+            uint64_t inclusive_cycles;
+            uint64_t exclusive_cycles;
+            uint64_t inclusive_bytes;
+            uint64_t exclusive_bytes;
+        };
+
+        struct activation {
+            uint32_t function;
+            const auint* caller_locals;
+            uint64_t entry_cycles;
+            uint64_t callee_cycles;
+            uint64_t entry_bytes;
+            uint64_t callee_bytes;
+        };
+
+        const bytefile& bytefile_;
+        state& state_;
+        std::vector<uint32_t> function_indices_;
+        std::vector<function_record> functions_;
+        std::unordered_map<uint64_t, uint64_t> edges_;
+        std::vector<activation> activations_;
+        const size_t* heap_mark_;
+        uint64_t allocated_;
+        uint64_t executed_;
+        uint64_t start_cycles_;
+        uint64_t cycles_;
+
+        void enter(uint32_t offset);
+
+        void leave(uint64_t now);
+
+        [[nodiscard]] static uint64_t read_cycles() noexcept;
+    };
+
+    inline void call_profile::record(uint32_t offset, bytecode op) {
+        const size_t* current = __gc_heap->current;
+        if (current > heap_mark_) {
+            allocated_ += static_cast<uint64_t>(current - heap_mark_) * sizeof(size_t);
+        }
+        heap_mark_ = current;
+        ++executed_;
+        switch (op) {
+            case bytecode::BEGIN:
+            case bytecode::CBEGIN:
+                enter(offset);
+                break;
+            case bytecode::END:
+            case bytecode::RET:
+                if (!activations_.empty()) {
+                    leave(read_cycles());
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    inline uint64_t call_profile::get_executed() const noexcept {
+        return executed_;
+    }
+
+    inline uint64_t call_profile::read_cycles() noexcept {
+#if defined(__x86_64__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+}
+
+#endif
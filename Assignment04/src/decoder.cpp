@@ -0,0 +1,453 @@
+#include "decoder.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#include "runtime_interface.h"
+#include "superinstructions.h"
+
+namespace assignment_04 {
+
+    capture::capture(varspec type, int32_t addr) noexcept
+        : type_(type)
+        , addr_(addr) {
+    }
+
+    match_table::match_table(std::span<const match_case> cases, uint32_t default_target)
+        : slots_(std::bit_ceil(2 * cases.size()), match_case{0, 0, NO_TARGET})
+        , shift_(64 - std::countr_zero(slots_.size()))
+        , default_target_(default_target) {
+        for (const match_case& entry : cases) {
+            size_t slot = get_slot(entry.tag, entry.arity);
+            while (slots_[slot].target != NO_TARGET) {
+                slot = (slot + 1) & (slots_.size() - 1);
+            }
+            slots_[slot] = entry;
+        }
+    }
+
+    call_cache::call_cache() noexcept
+        : callees_{}
+        , size_(0)
+        , hits_(0)
+        , misses_(0) {
+    }
+
+    instruction::instruction(bytecode op, uint32_t offset) noexcept
+        : handler_(nullptr)
+        , offset_(offset)
+        , first_arg_(0)
+        , second_arg_(0)
+        , op_(op)
+        , superinstruction_(program::NO_SUPERINSTRUCTION)
+        , is_tail_call_(false)
+        , pointer_(nullptr) {
+    }
+
+    program::program(const bytefile& file)
+        : indices_(file.get_code_size(), NO_INDEX)
+        , bytefile_(file) {
+    }
+
+    void program::add_instruction(instruction insn) {
+        if (insn.get_offset() < indices_.size()) {
+            indices_[insn.get_offset()] = instructions_.size();
+        }
+        instructions_.push_back(insn);
+    }
+
+    const capture* program::get_captures(uint32_t pos) const noexcept {
+        return captures_.data() + pos;
+    }
+
+    void program::add_capture(capture spec) {
+        captures_.push_back(spec);
+    }
+
+    const std::string_view* program::get_strings(uint32_t pos) const noexcept {
+        return strings_.data() + pos;
+    }
+
+    void program::add_string(std::string_view string) {
+        strings_.push_back(string);
+    }
+
+    const match_table* program::get_match_tables(uint32_t pos) const noexcept {
+        return match_tables_.data() + pos;
+    }
+
+    void program::add_match_table(match_table table) {
+        match_tables_.push_back(std::move(table));
+    }
+
+    std::span<const call_cache> program::get_call_caches() const noexcept {
+        return call_caches_;
+    }
+
+    uint32_t program::add_call_cache() {
+        call_caches_.emplace_back();
+        return static_cast<uint32_t>(call_caches_.size() - 1);
+    }
+
+    void program::bind(std::span<const void* const> handlers, std::span<const void* const> superinstruction_handlers, const void* match_handler) noexcept {
+        for (instruction& insn : instructions_) {
+            if (match_handler != nullptr && insn.get_op() == bytecode::DUP && insn.get_match_table() != nullptr) {
+                insn.set_handler(match_handler);
+            } else if (insn.get_superinstruction() != NO_SUPERINSTRUCTION && insn.get_superinstruction() <= superinstruction_handlers.size()) {
+                insn.set_handler(superinstruction_handlers[insn.get_superinstruction() - 1]);
+            } else {
+                insn.set_handler(handlers[static_cast<size_t>(insn.get_op())]);
+            }
+        }
+    }
+
+    decoder::decoder(const bytefile& file)
+        : addr_(0)
+        , program_(file)
+        , bytefile_(file) {
+    }
+
+    void decoder::decode_bytecode() {
+        while (addr_ < bytefile_.get_code_size()) {
+            uint32_t offset = addr_;
+            bytecode op = pop_next_op();
+            instruction insn(op, offset);
+            decode_op(insn);
+            program_.add_instruction(insn);
+        }
+        program_.add_instruction(instruction{bytecode::STOP, bytefile_.get_code_size()});
+    }
+
+    void decoder::resolve_targets() {
+        uint32_t captures_pos = 0;
+        uint32_t strings_pos = 0;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            instruction& insn = program_.get_instruction(i);
+            switch (insn.get_op()) {
+                case bytecode::JMP:
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ: {
+                    uint32_t target = program_.get_index(insn.get_first_arg());
+                    validate(target != program::NO_INDEX, "JMP/CJMPZ/CJMPNZ: incorrect destination. Bytecode offset: %#X\n", insn.get_offset());
+                    insn.set_first_arg(static_cast<int32_t>(target));
+                    break;
+                }
+                case bytecode::CALL: {
+                    uint32_t target = program_.get_index(insn.get_first_arg());
+                    validate(target != program::NO_INDEX, "CALL: incorrect destination. Bytecode offset: %#X\n", insn.get_offset());
+                    validate(program_.get_instruction(target).get_op() == bytecode::BEGIN, "CALL: destination instruction must be BEGIN. Bytecode offset: %#X\n", insn.get_offset());
+                    insn.set_first_arg(static_cast<int32_t>(target));
+                    break;
+                }
+                case bytecode::CLOSURE:
+                    insn.set_captures(program_.get_captures(captures_pos));
+                    captures_pos += insn.get_second_arg();
+                    break;
+                case bytecode::STRING:
+                    insn.set_string(program_.get_strings(strings_pos++));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // A call that is followed by END, possibly through jumps, returns the callee's result unchanged, so the callee may
+    // take over the caller's frame. Functions that load the address of one of their locals or arguments keep their
+    // frames, as the reference may still be on the way to the callee.
+    void decoder::mark_tail_calls() {
+        uint32_t begin = 0;
+        while (begin < program_.get_size()) {
+            uint32_t end = begin + 1;
+            bool has_frame_references = false;
+            for (; end < program_.get_size(); ++end) {
+                bytecode op = program_.get_instruction(end).get_op();
+                if (op == bytecode::BEGIN || op == bytecode::CBEGIN) {
+                    break;
+                }
+                has_frame_references |= op == bytecode::LDA_LOCAL || op == bytecode::LDA_ARGUMENT;
+            }
+            for (uint32_t i = begin; i + 1 < end && !has_frame_references; ++i) {
+                instruction& insn = program_.get_instruction(i);
+                if ((insn.get_op() == bytecode::CALL || insn.get_op() == bytecode::CALLC) && is_return(i + 1)) {
+                    insn.is_tail_call(true);
+                }
+            }
+            begin = end;
+        }
+    }
+
+    bool decoder::is_return(uint32_t index) const noexcept {
+        for (uint32_t steps = 0; index < program_.get_size() && steps < program_.get_size(); ++steps) {
+            const instruction& insn = program_.get_instruction(index);
+            switch (insn.get_op()) {
+                case bytecode::END:
+                case bytecode::RET:
+                    return true;
+                case bytecode::LINE:
+                    ++index;
+                    break;
+                case bytecode::JMP:
+                    index = insn.get_target();
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    void decoder::fuse_superinstructions(bool back_edges_fusable) {
+#define SUPERINSTRUCTION_PATTERN(name, ...) {__VA_ARGS__},
+        static const std::vector<std::vector<bytecode>> patterns = {ASSIGNMENT04_SUPERINSTRUCTIONS(SUPERINSTRUCTION_PATTERN)};
+#undef SUPERINSTRUCTION_PATTERN
+        std::vector<bool> entry_points = find_entry_points();
+        uint32_t i = 0;
+        while (i < program_.get_size()) {
+            size_t best_pattern = patterns.size();
+            for (size_t j = 0; j < patterns.size(); ++j) {
+                const std::vector<bytecode>& pattern = patterns[j];
+                if (i + pattern.size() > program_.get_size() || (best_pattern < patterns.size() && pattern.size() <= patterns[best_pattern].size())) {
+                    continue;
+                }
+                bool matches = true;
+                for (uint32_t k = 0; k < pattern.size() && matches; ++k) {
+                    const instruction& insn = program_.get_instruction(i + k);
+                    bytecode op = insn.get_op();
+                    matches = op == pattern[k] && is_fusable(op, k + 1 == pattern.size()) && (k == 0 || !entry_points[i + k]) && (back_edges_fusable || !is_back_edge(insn, i + k));
+                }
+                if (matches) {
+                    best_pattern = j;
+                }
+            }
+            if (best_pattern == patterns.size()) {
+                ++i;
+                continue;
+            }
+            program_.get_instruction(i).set_superinstruction(static_cast<uint8_t>(best_pattern + 1));
+            i += patterns[best_pattern].size();
+        }
+    }
+
+    // A chain is dispatched from its first test only. Tests reached by a jump from elsewhere, as when a nested pattern
+    // fails, still run one by one.
+    void decoder::build_match_tables() {
+        constexpr static size_t MIN_MATCH_TESTS = 2;
+        std::vector<bool> is_chained(program_.get_size());
+        std::vector<uint32_t> heads;
+        std::vector<match_table::match_case> cases;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (is_chained[i] || !is_match_test(i)) {
+                continue;
+            }
+            cases.clear();
+            size_t tests_size = 0;
+            uint32_t next = i;
+            for (; is_match_test(next); ++tests_size) {
+                is_chained[next] = true;
+                const instruction& test = program_.get_instruction(next + 1);
+                auint tag = test.get_op() == bytecode::TAG ? static_cast<auint>(UNBOX(test.get_tag_hash())) : match_table::ARRAY_TAG_KEY;
+                uint32_t arity = static_cast<uint32_t>(test.get_op() == bytecode::TAG ? test.get_second_arg() : test.get_first_arg());
+                if (std::none_of(cases.begin(), cases.end(), [tag, arity](const match_table::match_case& entry) { return entry.tag == tag && entry.arity == arity; })) {
+                    cases.push_back(match_table::match_case{tag, arity, next + 3});
+                }
+                next = program_.get_instruction(next + 2).get_target();
+            }
+            if (tests_size >= MIN_MATCH_TESTS) {
+                program_.add_match_table(match_table{cases, next});
+                heads.push_back(i);
+            }
+        }
+        for (uint32_t pos = 0; pos < heads.size(); ++pos) {
+            program_.get_instruction(heads[pos]).set_match_table(program_.get_match_tables(pos));
+        }
+    }
+
+    bool decoder::is_match_test(uint32_t index) const noexcept {
+        if (index + 2 >= program_.get_size()) {
+            return false;
+        }
+        const instruction& test = program_.get_instruction(index + 1);
+        const instruction& jump = program_.get_instruction(index + 2);
+        return program_.get_instruction(index).get_op() == bytecode::DUP && program_.get_instruction(index).get_superinstruction() == program::NO_SUPERINSTRUCTION
+               && (test.get_op() == bytecode::TAG || test.get_op() == bytecode::ARRAY) && jump.get_op() == bytecode::CJMPZ && jump.get_target() > index + 2;
+    }
+
+    bool decoder::has_bytes(uint32_t count) const noexcept {
+        return bytefile_.get_code_size() - addr_ >= count;
+    }
+
+    bytecode decoder::pop_next_op() {
+        ++addr_;
+        return bytefile_.get_code(addr_ - sizeof(bytecode));
+    }
+
+    varspec decoder::pop_next_varspec() {
+        ++addr_;
+        return bytefile_.get_varspec(addr_ - sizeof(varspec));
+    }
+
+    int32_t decoder::pop_next_int32() {
+        addr_ += sizeof(int32_t);
+        return bytefile_.get_int32(addr_ - sizeof(int32_t));
+    }
+
+    void decoder::decode_op(instruction& insn) {
+        switch (insn.get_op()) {
+            case bytecode::CONST:
+            case bytecode::JMP:
+            case bytecode::LD_GLOBAL:
+            case bytecode::LD_LOCAL:
+            case bytecode::LD_ARGUMENT:
+            case bytecode::LD_CAPTURED:
+            case bytecode::LDA_GLOBAL:
+            case bytecode::LDA_LOCAL:
+            case bytecode::LDA_ARGUMENT:
+            case bytecode::LDA_CAPTURED:
+            case bytecode::ST_GLOBAL:
+            case bytecode::ST_LOCAL:
+            case bytecode::ST_ARGUMENT:
+            case bytecode::ST_CAPTURED:
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+            case bytecode::CALLC:
+            case bytecode::ARRAY:
+            case bytecode::LINE:
+            case bytecode::CALL_BARRAY:
+                validate(has_bytes(sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_first_arg(pop_next_int32());
+                break;
+            case bytecode::BEGIN:
+            case bytecode::CBEGIN:
+            case bytecode::CALL:
+            case bytecode::FAIL:
+                validate(has_bytes(2 * sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_first_arg(pop_next_int32());
+                insn.set_second_arg(pop_next_int32());
+                break;
+            case bytecode::STRING: {
+                validate(has_bytes(sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                int32_t string_pos = pop_next_int32();
+                validate(string_pos >= 0 && string_pos < bytefile_.get_string_tab_size(), "STRING: index out of bounds. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_first_arg(string_pos);
+                program_.add_string(bytefile_.get_string(string_pos));
+                break;
+            }
+            case bytecode::SEXP:
+            case bytecode::TAG: {
+                validate(has_bytes(2 * sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                int32_t tag_pos = pop_next_int32();
+                validate(tag_pos >= 0 && tag_pos < bytefile_.get_string_tab_size(), "SEXP/TAG: index out of bounds. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_first_arg(tag_pos);
+                insn.set_second_arg(pop_next_int32());
+                insn.set_tag_hash(static_cast<auint>(LtagHash(const_cast<char*>(bytefile_.get_string(tag_pos).data()))));
+                break;
+            }
+            case bytecode::CLOSURE: {
+                validate(has_bytes(2 * sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_first_arg(pop_next_int32());
+                int32_t captured_size = pop_next_int32();
+                validate(captured_size >= 0, "CLOSURE: captured size must be non-negative. Bytecode offset: %#X\n", insn.get_offset());
+                insn.set_second_arg(captured_size);
+                for (int32_t i = 0; i < captured_size; ++i) {
+                    validate(has_bytes(sizeof(varspec) + sizeof(int32_t)), "Unexpected end of code. Bytecode offset: %#X\n", insn.get_offset());
+                    varspec capture_type = pop_next_varspec();
+                    int32_t capture_addr = pop_next_int32();
+                    program_.add_capture(capture{capture_type, capture_addr});
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    std::vector<bool> decoder::find_entry_points() const {
+        std::vector<bool> entry_points(program_.get_size());
+        for (uint32_t i = 0; i < bytefile_.get_public_symbols_size(); ++i) {
+            uint32_t index = program_.get_index(bytefile_.get_public_symbol(i).get_address());
+            if (index != program::NO_INDEX) {
+                entry_points[index] = true;
+            }
+        }
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            const instruction& insn = program_.get_instruction(i);
+            switch (insn.get_op()) {
+                case bytecode::JMP:
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ:
+                    entry_points[insn.get_target()] = true;
+                    break;
+                case bytecode::CALL:
+                    entry_points[insn.get_target()] = true;
+                    [[fallthrough]];
+                case bytecode::CALLC:
+                    if (i + 1 < program_.get_size()) {
+                        entry_points[i + 1] = true;
+                    }
+                    break;
+                case bytecode::CLOSURE: {
+                    uint32_t index = program_.get_index(insn.get_first_arg());
+                    if (index != program::NO_INDEX) {
+                        entry_points[index] = true;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        return entry_points;
+    }
+
+    bool decoder::is_fusable(bytecode op, bool is_last) noexcept {
+        switch (op) {
+            case bytecode::END:
+            case bytecode::RET:
+            case bytecode::FAIL:
+            case bytecode::STOP:
+                return false;
+            case bytecode::JMP:
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+            case bytecode::CALLC:
+            case bytecode::CALL:
+                return is_last;
+            default:
+                return true;
+        }
+    }
+
+    void decoder::validate(bool condition, std::string_view message, uint32_t offset) const noexcept {
+        if (!condition) {
+            failure(const_cast<char*>(message.data()), offset);
+        }
+    }
+
+    bool is_back_edge(const instruction& insn, uint32_t index) noexcept {
+        switch (insn.get_op()) {
+            case bytecode::JMP:
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+                return insn.get_target() <= index;
+            default:
+                return false;
+        }
+    }
+
+    program decode(const bytefile& file, bool superinstructions_enabled, bool back_edges_fusable, bool match_tables_enabled) {
+        decoder bytecode_decoder(file);
+        bytecode_decoder.decode_bytecode();
+        bytecode_decoder.resolve_targets();
+        bytecode_decoder.mark_tail_calls();
+        if (superinstructions_enabled) {
+            bytecode_decoder.fuse_superinstructions(back_edges_fusable);
+        }
+        if (match_tables_enabled) {
+            bytecode_decoder.build_match_tables();
+        }
+        return std::move(bytecode_decoder.get_program());
+    }
+
+}
@@ -0,0 +1,450 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "bytefile.h"
+#include "runtime_interface.h"
+
+namespace assignment_04 {
+
+    class capture {
+    public:
+        capture(varspec type, int32_t addr) noexcept;
+
+        [[nodiscard]] varspec get_type() const noexcept;
+
+        [[nodiscard]] int32_t get_addr() const noexcept;
+
+    private:
+        varspec type_;
+        int32_t addr_;
+    };
+
+    // The tests of a `case` on one value: a chain of `DUP; TAG t n; CJMPZ next` and `DUP; ARRAY n; CJMPZ next`, where
+    // each test fails over to the next one. The table maps the tag and arity of the value to the instruction after the
+    // first test that accepts it, and everything else to where the last test fails over to.
+    class match_table {
+    public:
+        // Arrays are looked up with a tag no tag hash has.
+        constexpr static auint ARRAY_TAG_KEY = ~auint{0};
+
+        struct match_case {
+            auint tag;
+            uint32_t arity;
+            uint32_t target;
+        };
+
+        match_table(std::span<const match_case> cases, uint32_t default_target);
+
+        [[nodiscard]] uint32_t find(auint tag, uint32_t arity) const noexcept;
+
+        [[nodiscard]] uint32_t get_default_target() const noexcept;
+
+    private:
+        constexpr static uint32_t NO_TARGET = static_cast<uint32_t>(-1);
+
+        std::vector<match_case> slots_;
+        uint32_t shift_;
+        uint32_t default_target_;
+
+        [[nodiscard]] size_t get_slot(auint tag, uint32_t arity) const noexcept;
+    };
+
+    // The callees a CALLC site has called, with the frame sizes of their BEGIN, so that a closure whose code the site has
+    // called before is entered right after its BEGIN without finding and checking the destination again. Closures with
+    // other code go the usual way, and are added while there is room.
+    class call_cache {
+    public:
+        constexpr static size_t MAX_CALLEES = 4;
+
+        struct callee {
+            uint32_t code_offset;
+            uint32_t body;
+            int32_t args_size;
+            int32_t locals_size;
+        };
+
+        call_cache() noexcept;
+
+        [[nodiscard]] const callee* find(uint32_t code_offset) const noexcept;
+
+        void add(callee entry) noexcept;
+
+        [[nodiscard]] size_t get_size() const noexcept;
+
+        [[nodiscard]] uint64_t get_hits() const noexcept;
+
+        void count_hit() noexcept;
+
+        [[nodiscard]] uint64_t get_misses() const noexcept;
+
+        void count_miss() noexcept;
+
+    private:
+        std::array<callee, MAX_CALLEES> callees_;
+        uint32_t size_;
+        uint64_t hits_;
+        uint64_t misses_;
+    };
+
+    class instruction {
+    public:
+        instruction(bytecode op, uint32_t offset) noexcept;
+
+        [[nodiscard]] const void* get_handler() const noexcept;
+
+        void set_handler(const void* handler) noexcept;
+
+        [[nodiscard]] bytecode get_op() const noexcept;
+
+        [[nodiscard]] uint8_t get_superinstruction() const noexcept;
+
+        void set_superinstruction(uint8_t superinstruction) noexcept;
+
+        // A tail call replaces the caller's frame with the callee's instead of returning to it.
+        [[nodiscard]] bool is_tail_call() const noexcept;
+
+        void is_tail_call(bool is_insn_tail_call) noexcept;
+
+        [[nodiscard]] uint32_t get_offset() const noexcept;
+
+        [[nodiscard]] int32_t get_first_arg() const noexcept;
+
+        void set_first_arg(int32_t arg) noexcept;
+
+        [[nodiscard]] int32_t get_second_arg() const noexcept;
+
+        void set_second_arg(int32_t arg) noexcept;
+
+        [[nodiscard]] uint32_t get_target() const noexcept;
+
+        // Literals are resolved by the loader: STRING refers to its string with the length measured, SEXP and TAG keep
+        // the hash of their tag, so no handler measures or hashes a string at run time.
+        [[nodiscard]] std::string_view get_string() const noexcept;
+
+        void set_string(const std::string_view* string) noexcept;
+
+        [[nodiscard]] auint get_tag_hash() const noexcept;
+
+        void set_tag_hash(auint tag_hash) noexcept;
+
+        [[nodiscard]] std::span<const capture> get_captures() const noexcept;
+
+        // Set on the first DUP of a chain of tests that is dispatched through a table.
+        [[nodiscard]] const match_table* get_match_table() const noexcept;
+
+        void set_match_table(const match_table* table) noexcept;
+
+        void set_captures(const capture* captures) noexcept;
+
+        [[nodiscard]] uint64_t get_cache() const noexcept;
+
+        void set_cache(uint64_t cache) noexcept;
+
+    private:
+        const void* handler_;
+        uint32_t offset_;
+        int32_t first_arg_;
+        int32_t second_arg_;
+        bytecode op_;
+        uint8_t superinstruction_;
+        bool is_tail_call_;
+        union {
+            const void* pointer_;
+            uint64_t cache_;
+        };
+    };
+
+    class program {
+    public:
+        constexpr static uint32_t NO_INDEX = static_cast<uint32_t>(-1);
+        constexpr static uint8_t NO_SUPERINSTRUCTION = 0;
+
+        explicit program(const bytefile& file);
+
+        [[nodiscard]] const bytefile& get_bytefile() const noexcept;
+
+        [[nodiscard]] uint32_t get_size() const noexcept;
+
+        [[nodiscard]] const instruction& get_instruction(uint32_t index) const noexcept;
+
+        [[nodiscard]] instruction& get_instruction(uint32_t index) noexcept;
+
+        void add_instruction(instruction insn);
+
+        [[nodiscard]] uint32_t get_index(uint32_t offset) const noexcept;
+
+        [[nodiscard]] uint32_t get_offset(uint32_t index) const noexcept;
+
+        [[nodiscard]] const capture* get_captures(uint32_t pos) const noexcept;
+
+        void add_capture(capture spec);
+
+        [[nodiscard]] const std::string_view* get_strings(uint32_t pos) const noexcept;
+
+        void add_string(std::string_view string);
+
+        [[nodiscard]] const match_table* get_match_tables(uint32_t pos) const noexcept;
+
+        void add_match_table(match_table table);
+
+        [[nodiscard]] call_cache& get_call_cache(uint32_t pos) noexcept;
+
+        [[nodiscard]] std::span<const call_cache> get_call_caches() const noexcept;
+
+        uint32_t add_call_cache();
+
+        void bind(std::span<const void* const> handlers, std::span<const void* const> superinstruction_handlers = {}, const void* match_handler = nullptr) noexcept;
+
+    private:
+        std::vector<instruction> instructions_;
+        std::vector<uint32_t> indices_;
+        std::vector<capture> captures_;
+        std::vector<std::string_view> strings_;
+        std::vector<match_table> match_tables_;
+        std::vector<call_cache> call_caches_;
+        const bytefile& bytefile_;
+    };
+
+    class decoder {
+    public:
+        explicit decoder(const bytefile& file);
+
+        void decode_bytecode();
+
+        void resolve_targets();
+
+        void mark_tail_calls();
+
+        void fuse_superinstructions(bool back_edges_fusable = true);
+
+        void build_match_tables();
+
+        program& get_program() noexcept;
+
+    private:
+        uint32_t addr_;
+        program program_;
+        const bytefile& bytefile_;
+
+        [[nodiscard]] bool has_bytes(uint32_t count) const noexcept;
+
+        [[nodiscard]] bytecode pop_next_op();
+
+        [[nodiscard]] varspec pop_next_varspec();
+
+        [[nodiscard]] int32_t pop_next_int32();
+
+        void decode_op(instruction& insn);
+
+        [[nodiscard]] std::vector<bool> find_entry_points() const;
+
+        [[nodiscard]] bool is_return(uint32_t index) const noexcept;
+
+        [[nodiscard]] bool is_match_test(uint32_t index) const noexcept;
+
+        [[nodiscard]] static bool is_fusable(bytecode op, bool is_last) noexcept;
+
+        void validate(bool condition, std::string_view message, uint32_t offset) const noexcept;
+    };
+
+    [[nodiscard]] bool is_back_edge(const instruction& insn, uint32_t index) noexcept;
+
+    // Back edges are kept out of superinstructions when they have to be counted on their own.
+    program decode(const bytefile& file, bool superinstructions_enabled = true, bool back_edges_fusable = true, bool match_tables_enabled = false);
+
+    inline varspec capture::get_type() const noexcept {
+        return type_;
+    }
+
+    inline int32_t capture::get_addr() const noexcept {
+        return addr_;
+    }
+
+    inline uint32_t match_table::find(auint tag, uint32_t arity) const noexcept {
+        for (size_t slot = get_slot(tag, arity);; slot = (slot + 1) & (slots_.size() - 1)) {
+            const match_case& entry = slots_[slot];
+            if (entry.target == NO_TARGET) {
+                return default_target_;
+            }
+            if (entry.tag == tag && entry.arity == arity) {
+                return entry.target;
+            }
+        }
+    }
+
+    inline uint32_t match_table::get_default_target() const noexcept {
+        return default_target_;
+    }
+
+    inline size_t match_table::get_slot(auint tag, uint32_t arity) const noexcept {
+        return static_cast<size_t>(((tag ^ (static_cast<uint64_t>(arity) << 48)) * 0x9E3779B97F4A7C15ULL) >> shift_);
+    }
+
+    inline const call_cache::callee* call_cache::find(uint32_t code_offset) const noexcept {
+        for (uint32_t i = 0; i < size_; ++i) {
+            if (callees_[i].code_offset == code_offset) {
+                return &callees_[i];
+            }
+        }
+        return nullptr;
+    }
+
+    inline void call_cache::add(callee entry) noexcept {
+        if (size_ < MAX_CALLEES) {
+            callees_[size_++] = entry;
+        }
+    }
+
+    inline size_t call_cache::get_size() const noexcept {
+        return size_;
+    }
+
+    inline uint64_t call_cache::get_hits() const noexcept {
+        return hits_;
+    }
+
+    inline void call_cache::count_hit() noexcept {
+        ++hits_;
+    }
+
+    inline uint64_t call_cache::get_misses() const noexcept {
+        return misses_;
+    }
+
+    inline void call_cache::count_miss() noexcept {
+        ++misses_;
+    }
+
+    inline const void* instruction::get_handler() const noexcept {
+        return handler_;
+    }
+
+    inline void instruction::set_handler(const void* handler) noexcept {
+        handler_ = handler;
+    }
+
+    inline bytecode instruction::get_op() const noexcept {
+        return op_;
+    }
+
+    inline uint8_t instruction::get_superinstruction() const noexcept {
+        return superinstruction_;
+    }
+
+    inline void instruction::set_superinstruction(uint8_t superinstruction) noexcept {
+        superinstruction_ = superinstruction;
+    }
+
+    inline bool instruction::is_tail_call() const noexcept {
+        return is_tail_call_;
+    }
+
+    inline void instruction::is_tail_call(bool is_insn_tail_call) noexcept {
+        is_tail_call_ = is_insn_tail_call;
+    }
+
+    inline uint32_t instruction::get_offset() const noexcept {
+        return offset_;
+    }
+
+    inline int32_t instruction::get_first_arg() const noexcept {
+        return first_arg_;
+    }
+
+    inline void instruction::set_first_arg(int32_t arg) noexcept {
+        first_arg_ = arg;
+    }
+
+    inline int32_t instruction::get_second_arg() const noexcept {
+        return second_arg_;
+    }
+
+    inline void instruction::set_second_arg(int32_t arg) noexcept {
+        second_arg_ = arg;
+    }
+
+    inline uint32_t instruction::get_target() const noexcept {
+        return static_cast<uint32_t>(first_arg_);
+    }
+
+    inline std::string_view instruction::get_string() const noexcept {
+        return *static_cast<const std::string_view*>(pointer_);
+    }
+
+    inline void instruction::set_string(const std::string_view* string) noexcept {
+        pointer_ = string;
+    }
+
+    inline auint instruction::get_tag_hash() const noexcept {
+        return static_cast<auint>(cache_);
+    }
+
+    inline void instruction::set_tag_hash(auint tag_hash) noexcept {
+        cache_ = tag_hash;
+    }
+
+    inline std::span<const capture> instruction::get_captures() const noexcept {
+        return std::span<const capture>{static_cast<const capture*>(pointer_), static_cast<size_t>(second_arg_)};
+    }
+
+    inline void instruction::set_captures(const capture* captures) noexcept {
+        pointer_ = captures;
+    }
+
+    inline const match_table* instruction::get_match_table() const noexcept {
+        return static_cast<const match_table*>(pointer_);
+    }
+
+    inline void instruction::set_match_table(const match_table* table) noexcept {
+        pointer_ = table;
+    }
+
+    inline uint64_t instruction::get_cache() const noexcept {
+        return cache_;
+    }
+
+    inline void instruction::set_cache(uint64_t cache) noexcept {
+        cache_ = cache;
+    }
+
+    inline const bytefile& program::get_bytefile() const noexcept {
+        return bytefile_;
+    }
+
+    inline uint32_t program::get_size() const noexcept {
+        return instructions_.size();
+    }
+
+    inline const instruction& program::get_instruction(uint32_t index) const noexcept {
+        return instructions_[index];
+    }
+
+    inline instruction& program::get_instruction(uint32_t index) noexcept {
+        return instructions_[index];
+    }
+
+    inline uint32_t program::get_index(uint32_t offset) const noexcept {
+        return offset < indices_.size() ? indices_[offset] : NO_INDEX;
+    }
+
+    inline uint32_t program::get_offset(uint32_t index) const noexcept {
+        return index < instructions_.size() ? instructions_[index].get_offset() : bytefile_.get_code_size();
+    }
+
+    inline call_cache& program::get_call_cache(uint32_t pos) noexcept {
+        return call_caches_[pos];
+    }
+
+    inline program& decoder::get_program() noexcept {
+        return program_;
+    }
+
+}
+
+#endif
@@ -1,13 +1,46 @@
 #ifndef FILE_READER_H
 #define FILE_READER_H
 
+#include <cstddef>
+#include <span>
 #include <string_view>
 
 #include "bytefile.h"
 
 namespace assignment_04 {
 
-    bytefile read_file(std::string_view path);
+    // A private mapping of a whole file. Pages are read in as they are touched, and a page that is written to is
+    // copied, so the file itself never changes.
+    class mapped_file {
+    public:
+        explicit mapped_file(std::string_view path);
+
+        mapped_file(const mapped_file&) = delete;
+
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file();
+
+        [[nodiscard]] std::string_view get_path() const noexcept;
+
+        [[nodiscard]] std::span<char> get_data() const noexcept;
+
+    private:
+        std::string_view path_;
+        char* data_;
+        size_t size_;
+    };
+
+    // Checks that the sections the header describes fit in the file. The bytefile is a view of the mapping.
+    bytefile read_file(const mapped_file& file);
+
+    inline std::string_view mapped_file::get_path() const noexcept {
+        return path_;
+    }
+
+    inline std::span<char> mapped_file::get_data() const noexcept {
+        return std::span<char>{data_, size_};
+    }
 
 }
 
@@ -0,0 +1,69 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#include "runtime_interface.h"
+
+// The objects the bytecode builds are bump-allocated on the runtime's heap and written in place, laid out exactly as
+// the runtime's constructors lay them out. Only an object that does not fit goes through `alloc`, which collects
+// garbage first, so the values stored into a new object are read only after allocating it: they are on the operand
+// stack, where the collector finds and updates them.
+namespace assignment_04 {
+
+    inline data* allocate(size_t size) {
+        size_t words = BYTES_TO_WORDS(size);
+        size_t* obj = __gc_heap->current;
+        if (static_cast<size_t>(__gc_heap->end - obj) >= words) [[likely]] {
+            __gc_heap->current = obj + words;
+            return reinterpret_cast<data*>(obj);
+        }
+        return static_cast<data*>(alloc(size));
+    }
+
+    inline void init_header(data* obj, int tag, size_t len) noexcept {
+        obj->data_header = tag | (len << 3);
+        obj->forward_address = 0;
+    }
+
+    inline auint new_array(std::span<const auint> elements) {
+        data* obj = allocate(DATA_HEADER_SZ + elements.size() * sizeof(auint));
+        init_header(obj, ARRAY_TAG, elements.size());
+        std::copy(elements.begin(), elements.end(), reinterpret_cast<auint*>(obj->contents));
+        return reinterpret_cast<auint>(obj->contents);
+    }
+
+    // The tag is the boxed hash `LtagHash` returns; the object keeps it unboxed.
+    inline auint new_s_expr(auint tag_hash, std::span<const auint> fields) {
+        data* obj = allocate(DATA_HEADER_SZ + (fields.size() + 1) * sizeof(auint));
+        init_header(obj, SEXP_TAG, fields.size());
+        sexp* s_expression = reinterpret_cast<sexp*>(obj);
+        s_expression->tag = UNBOX(tag_hash);
+        std::copy(fields.begin(), fields.end(), reinterpret_cast<auint*>(s_expression->contents));
+        return reinterpret_cast<auint>(obj->contents);
+    }
+
+    // The first word is the code offset, followed by the captured values.
+    inline auint new_closure(std::span<const auint> contents) {
+        data* obj = allocate(DATA_HEADER_SZ + contents.size() * sizeof(auint));
+        init_header(obj, CLOSURE_TAG, contents.size());
+        std::copy(contents.begin(), contents.end(), reinterpret_cast<auint*>(obj->contents));
+        return reinterpret_cast<auint>(obj->contents);
+    }
+
+    inline auint new_string(std::string_view val) {
+        size_t size = DATA_HEADER_SZ + val.size() + 1;
+        data* obj = allocate(size);
+        init_header(obj, STRING_TAG, val.size());
+        reinterpret_cast<auint*>(obj)[BYTES_TO_WORDS(size) - 1] = 0;
+        std::memcpy(obj->contents, val.data(), val.size());
+        return reinterpret_cast<auint>(obj->contents);
+    }
+
+}
+
+#endif
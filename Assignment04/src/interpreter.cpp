@@ -1,11 +1,30 @@
 #include "interpreter.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "call_profile.h"
+#include "heap.h"
+#include "jit.h"
+#include "opcode_profile.h"
+#include "register_vm.h"
+#include "sampling_profiler.h"
+#include "sigsegv_handler.h"
+#include "superinstructions.h"
+#include "tiering.h"
 
 namespace assignment_04 {
 
-    constexpr static size_t MAX_FRAMES_SIZE = 0xFFFF;
-    static std::array<frame, MAX_FRAMES_SIZE> frames_buf;
+    static_assert(sizeof(auint) == sizeof(uint64_t), "The frame record packs the return address and the number of arguments into a word");
 
     aggregate::aggregate(from_repr, auint repr) noexcept
         : repr_(repr) {
@@ -32,20 +51,19 @@ namespace assignment_04 {
     }
 
     auint array::to_array(std::span<auint> elements) {
-        return reinterpret_cast<auint>(Barray(static_cast<aint*>(static_cast<void*>(elements.data())), BOX(elements.size())));
+        return new_array(elements);
     }
 
     s_expr::s_expr(from_repr, auint repr) noexcept
         : aggregate(from_repr_t, repr) {
     }
 
-    s_expr::s_expr(std::string_view tag, std::span<auint> elements)
-        : aggregate(from_repr_t, to_s_expr(tag, elements)) {
+    s_expr::s_expr(auint tag_hash, std::span<auint> elements)
+        : aggregate(from_repr_t, to_s_expr(tag_hash, elements)) {
     }
 
-    auint s_expr::to_s_expr(std::string_view tag, std::span<auint> elements) {
-        elements[elements.size() - 1] = LtagHash(const_cast<char*>(tag.data()));
-        return reinterpret_cast<auint>(Bsexp(static_cast<aint*>(static_cast<void*>(elements.data())), BOX(elements.size())));
+    auint s_expr::to_s_expr(auint tag_hash, std::span<auint> elements) {
+        return new_s_expr(tag_hash, elements);
     }
 
     closure::closure(from_repr, auint repr) noexcept
@@ -73,7 +91,7 @@ namespace assignment_04 {
     }
 
     auint closure::to_closure(std::span<auint> captured) {
-        return reinterpret_cast<auint>(Bclosure(static_cast<aint*>(static_cast<void*>(captured.data())), BOX(captured.size())));
+        return new_closure(captured);
     }
 
     value::value() noexcept
@@ -138,141 +156,233 @@ namespace assignment_04 {
     }
 
     auint value::to_string(std::string_view val) {
-        std::array<aint, 1> values{{reinterpret_cast<aint>(const_cast<char*>(val.data()))}};
-        return reinterpret_cast<auint>(Bstring(values.data()));
+        return new_string(val);
     }
 
-    frame::frame() noexcept
-        : base_(static_cast<uint32_t>(-1))
-        , locals_size_(static_cast<uint32_t>(-1))
-        , args_size_(static_cast<uint32_t>(-1))
-        , is_frame_closure_(false)
-        , return_address_(static_cast<uint32_t>(-1)) {
-    }
-
-    frame::frame(stack<auint> stack, uint32_t base, uint32_t locals_size, uint32_t args_size, bool is_frame_closure) noexcept
-        : stack_(stack)
-        , base_(base)
-        , locals_size_(locals_size)
-        , args_size_(args_size)
-        , is_frame_closure_(is_frame_closure)
-        , return_address_(static_cast<uint32_t>(-1)) {
+    frame::frame(auint* locals, auint* prev_locals, uint32_t args_size, bool is_frame_closure) noexcept
+        : locals_(locals) {
+        get_call_word() = (static_cast<auint>(args_size) << 1) | 1;
+        get_link_word() = reinterpret_cast<auint>(prev_locals) | (is_frame_closure ? 2 : 0) | 1;
     }
 
     value frame::get_local(uint32_t pos) const {
-        return value{from_repr_t, stack_[base_ + pos]};
+        return value{from_repr_t, locals_[pos]};
     }
 
     value frame::get_local_reference(uint32_t pos) const {
-        return value{&stack_[base_ + pos]};
+        return value{locals_ + pos};
     }
 
     void frame::set_local(uint32_t pos, value local) {
-        stack_[base_ + pos] = local.get_repr();
+        locals_[pos] = local.get_repr();
     }
 
     value frame::get_arg(uint32_t pos) const {
-        return value{from_repr_t, stack_[base_ - args_size_ + pos]};
+        return value{from_repr_t, get_args()[pos]};
     }
 
     value frame::get_arg_reference(uint32_t pos) const {
-        return value{&stack_[base_ - args_size_ + pos]};
+        return value{get_args() + pos};
     }
 
     void frame::set_arg(uint32_t pos, value arg) {
-        stack_[base_ - args_size_ + pos] = arg.get_repr();
+        get_args()[pos] = arg.get_repr();
     }
 
     uint32_t frame::get_captured_vars_size() const noexcept {
-        closure frame_closure(from_repr_t, stack_[base_ - args_size_ - 1]);
+        closure frame_closure(from_repr_t, get_args()[-1]);
         return frame_closure.get_captured_size();
     }
 
     value frame::get_captured_var(uint32_t pos) const {
-        closure frame_closure(from_repr_t, stack_[base_ - args_size_ - 1]);
+        closure frame_closure(from_repr_t, get_args()[-1]);
         return frame_closure.get_capture(pos);
     }
 
     value frame::get_captured_var_reference(uint32_t pos) const {
-        closure frame_closure(from_repr_t, stack_[base_ - args_size_ - 1]);
+        closure frame_closure(from_repr_t, get_args()[-1]);
         return frame_closure.get_capture_reference(pos);
     }
 
     void frame::set_captured_var(uint32_t pos, value captured_var) {
-        closure frame_closure(from_repr_t, stack_[base_ - args_size_ - 1]);
+        closure frame_closure(from_repr_t, get_args()[-1]);
         frame_closure.set_capture(pos, captured_var);
     }
 
+    static void scan_slot(auint* slot, slot_kind kind) {
+        switch (kind) {
+            case slot_kind::DEAD:
+                *slot = BOX(0);
+                break;
+            case slot_kind::VALUE:
+                break;
+            case slot_kind::ROOT:
+                gc_test_and_mark_root(reinterpret_cast<size_t**>(slot));
+                break;
+        }
+    }
+
+    void frame::scan_roots(const stack_map* map, auint* limit) const {
+        if (is_closure()) {
+            scan_slot(get_args() - 1, slot_kind::ROOT);
+        }
+        uint32_t args_size = get_args_size();
+        for (uint32_t i = 0; i < args_size; ++i) {
+            scan_slot(get_args() + i, map != nullptr && i < map->get_args_size() ? map->get_arg(i) : slot_kind::ROOT);
+        }
+        uint32_t locals_size = map != nullptr ? map->get_locals_size() : 0;
+        for (uint32_t i = 0; i < locals_size; ++i) {
+            scan_slot(locals_ + i, map->get_local(i));
+        }
+        auint* operands = locals_ + locals_size;
+        for (auint* slot = operands; slot < limit; ++slot) {
+            uint32_t pos = static_cast<uint32_t>(slot - operands);
+            // Values the running instruction has pushed itself are not in the map.
+            scan_slot(slot, map != nullptr && pos < map->get_operands_size() ? map->get_operand(pos) : slot_kind::ROOT);
+        }
+    }
+
+    static state* scanned_state = nullptr;
+
+    static void scan_state_roots() {
+        scanned_state->scan_roots();
+    }
+
+    // Overflowing the stack runs into its guard, which is checked once by the fault instead of on every call. The
+    // handler goes in after the runtime's initialization, which installs its own one, and passes other faults on to it.
+    static void register_stack_guards() {
+        static bool are_guards_registered = false;
+        if (!are_guards_registered) {
+            register_guard(stack_buf.get_guard_first(), stack_buf.get_guard_last(), "Stack overflow.");
+            are_guards_registered = true;
+        }
+        register_sigsegv_handler();
+    }
+
     state::state(const bytefile& file) noexcept
         : ip_(0)
-        , frames_(frames_buf.begin(), 0)
+        , frame_locals_(nullptr)
         , stack_(stack_buf.data(), file.get_global_area_size() + 2)
         , is_tmp_closure_(false)
-        , bytefile_(file) {
+        , bytefile_(file)
+        , program_(nullptr)
+        , verification_(nullptr) {
         validate(stack_.size() < MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n");
         __init();
+        register_stack_guards();
+    }
+
+    state::state(const program& code) noexcept
+        : state(code.get_bytefile()) {
+        program_ = &code;
     }
 
     state::~state() {
+        if (scanned_state == this) {
+            __gc_root_scanner = nullptr;
+            scanned_state = nullptr;
+        }
         __shutdown();
     }
 
     void state::execute_binop_high() {
-        int32_t res = 0;
-        value rhs = pop();
-        value lhs = pop();
-        validate(lhs.is_integer(), "BINOP: operand must be integer. Bytecode offset: %#X\n");
-        int32_t lhs_int = lhs.as_integer();
-        validate(rhs.is_integer(), "BINOP: operand must be integer. Bytecode offset: %#X\n");
-        int32_t rhs_int = rhs.as_integer();
-        switch (peek_current_op()) {
+        execute_binop_high(peek_current_op());
+    }
+
+    void state::execute_binop_high(bytecode op) {
+        stack_cache<false> cache;
+        switch (op) {
             case bytecode::LOW_ADD:
-                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) + static_cast<int64_t>(rhs_int));
+                execute_binop<bytecode::LOW_ADD>(cache);
                 break;
             case bytecode::LOW_SUB:
-                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) - static_cast<int64_t>(rhs_int));
+                execute_binop<bytecode::LOW_SUB>(cache);
                 break;
             case bytecode::LOW_MUL:
-                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) * static_cast<int64_t>(rhs_int));
+                execute_binop<bytecode::LOW_MUL>(cache);
                 break;
             case bytecode::LOW_DIV:
-                validate(rhs_int != 0, "DIV: division by zero. Bytecode offset: %#X\n");
-                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) / static_cast<int64_t>(rhs_int));
+                execute_binop<bytecode::LOW_DIV>(cache);
                 break;
             case bytecode::LOW_MOD:
-                validate(rhs_int != 0, "MOD: division by zero. Bytecode offset: %#X\n");
-                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) % static_cast<int64_t>(rhs_int));
+                execute_binop<bytecode::LOW_MOD>(cache);
                 break;
             case bytecode::LOW_LT:
-                res = (lhs_int < rhs_int);
+                execute_binop<bytecode::LOW_LT>(cache);
                 break;
             case bytecode::LOW_LE:
-                res = (lhs_int <= rhs_int);
+                execute_binop<bytecode::LOW_LE>(cache);
                 break;
             case bytecode::LOW_GT:
-                res = (lhs_int > rhs_int);
+                execute_binop<bytecode::LOW_GT>(cache);
                 break;
             case bytecode::LOW_GE:
-                res = (lhs_int >= rhs_int);
+                execute_binop<bytecode::LOW_GE>(cache);
                 break;
             case bytecode::LOW_NE:
-                res = (lhs_int != rhs_int);
+                execute_binop<bytecode::LOW_NE>(cache);
                 break;
             case bytecode::LOW_AND:
-                res = (lhs_int && rhs_int);
+                execute_binop<bytecode::LOW_AND>(cache);
                 break;
             case bytecode::LOW_OR:
-                res = (lhs_int || rhs_int);
+                execute_binop<bytecode::LOW_OR>(cache);
                 break;
             default:
                 validate(false, "BINOP: unknown bytecode. Bytecode offset: %#X\n");
         }
-        push(res);
+    }
+
+    template <bytecode Op, bool Enabled>
+    void state::execute_binop(stack_cache<Enabled>& cache) {
+        int32_t res = 0;
+        value rhs = pop(cache);
+        value lhs = pop();
+        validate(lhs.is_integer(), "BINOP: operand must be integer. Bytecode offset: %#X\n");
+        int32_t lhs_int = lhs.as_integer();
+        validate(rhs.is_integer(), "BINOP: operand must be integer. Bytecode offset: %#X\n");
+        int32_t rhs_int = rhs.as_integer();
+        if constexpr (Op == bytecode::LOW_ADD) {
+            res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) + static_cast<int64_t>(rhs_int));
+        } else if constexpr (Op == bytecode::LOW_SUB) {
+            res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) - static_cast<int64_t>(rhs_int));
+        } else if constexpr (Op == bytecode::LOW_MUL) {
+            res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) * static_cast<int64_t>(rhs_int));
+        } else if constexpr (Op == bytecode::LOW_DIV) {
+            validate(rhs_int != 0, "DIV: division by zero. Bytecode offset: %#X\n");
+            res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) / static_cast<int64_t>(rhs_int));
+        } else if constexpr (Op == bytecode::LOW_MOD) {
+            validate(rhs_int != 0, "MOD: division by zero. Bytecode offset: %#X\n");
+            res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) % static_cast<int64_t>(rhs_int));
+        } else if constexpr (Op == bytecode::LOW_LT) {
+            res = (lhs_int < rhs_int);
+        } else if constexpr (Op == bytecode::LOW_LE) {
+            res = (lhs_int <= rhs_int);
+        } else if constexpr (Op == bytecode::LOW_GT) {
+            res = (lhs_int > rhs_int);
+        } else if constexpr (Op == bytecode::LOW_GE) {
+            res = (lhs_int >= rhs_int);
+        } else if constexpr (Op == bytecode::LOW_NE) {
+            res = (lhs_int != rhs_int);
+        } else if constexpr (Op == bytecode::LOW_AND) {
+            res = (lhs_int && rhs_int);
+        } else if constexpr (Op == bytecode::LOW_OR) {
+            res = (lhs_int || rhs_int);
+        } else {
+            static_assert(Op != Op, "BINOP: unknown bytecode");
+        }
+        push(cache, res);
     }
 
     void state::execute_low_eq() {
+        stack_cache<false> cache;
+        execute_low_eq(cache);
+    }
+
+    template <bool Enabled>
+    void state::execute_low_eq(stack_cache<Enabled>& cache) {
         int32_t res = 0;
-        value rhs = pop();
+        value rhs = pop(cache);
         value lhs = pop();
         validate(lhs.is_integer() || rhs.is_integer(), "EQ: one of the operands must be integer. Bytecode offset: %#X\n");
         if (lhs.is_integer() && rhs.is_integer()) {
@@ -280,26 +390,41 @@ namespace assignment_04 {
             int32_t rhs_int = rhs.as_integer();
             res = (lhs_int == rhs_int);
         }
-        push(res);
+        push(cache, res);
     }
 
     void state::execute_const() {
-        int32_t constant = pop_next_int32();
-        push(constant);
+        execute_const(pop_next_int32());
+    }
+
+    void state::execute_const(int32_t constant) {
+        stack_cache<false> cache;
+        execute_const(cache, constant);
     }
 
-    void state::execute_string() {
-        int32_t string_pos = pop_next_int32();
-        std::string_view string = bytefile_.get_string(string_pos);
+    template <bool Enabled>
+    void state::execute_const(stack_cache<Enabled>& cache, int32_t constant) {
+        push(cache, constant);
+    }
+
+    void state::execute_string(const instruction& decoded) {
+        static_cast<void>(pop_next_int32());
+        execute_string(decoded.get_string());
+    }
+
+    void state::execute_string(std::string_view string) {
         push(string);
     }
 
-    void state::execute_sexp() {
-        int32_t tag_pos = pop_next_int32();
+    void state::execute_sexp(const instruction& decoded) {
+        static_cast<void>(pop_next_int32());
         int32_t elements_size = pop_next_int32();
-        std::string_view tag = bytefile_.get_string(tag_pos);
-        std::span<auint> elements(stack_buf.begin() + stack_.size() - elements_size, elements_size + 1);
-        s_expr s_expression(tag, elements);
+        execute_sexp(decoded.get_tag_hash(), elements_size);
+    }
+
+    void state::execute_sexp(auint tag_hash, int32_t elements_size) {
+        std::span<auint> elements(stack_.end() - elements_size, elements_size);
+        s_expr s_expression(tag_hash, elements);
         pop(elements_size);
         push(s_expression);
     }
@@ -333,32 +458,45 @@ namespace assignment_04 {
     }
 
     void     state::execute_jmp() {
-        uint32_t addr = pop_next_int32();
+        execute_jmp(pop_next_int32());
+    }
+
+    void state::execute_jmp(uint32_t addr) {
         ip_ = addr;
     }
 
     bool state::execute_ret() {
         value ret = pop();
         frame current_frame = pop_frame();
-        stack_ = stack{stack_buf.data(), current_frame.get_base() - current_frame.get_args_size()};
-        if (current_frame.is_closure()) {
-            stack_ = stack{stack_buf.data(), stack_.size() - 1};
-        }
+        stack_ = stack{stack_buf.data(), static_cast<uint32_t>(current_frame.get_bottom() - stack_buf.data())};
         if (!has_frame()) {
             return true;
         }
+        std::atomic_signal_fence(std::memory_order_release);
         ip_ = peek_frame().get_return_address();
         push(ret);
         return false;
     }
 
     void state::execute_drop() {
-        pop();
+        stack_cache<false> cache;
+        execute_drop(cache);
+    }
+
+    template <bool Enabled>
+    void state::execute_drop(stack_cache<Enabled>& cache) {
+        pop(cache);
     }
 
     void state::execute_dup() {
-        value val = peek();
-        push(val);
+        stack_cache<false> cache;
+        execute_dup(cache);
+    }
+
+    template <bool Enabled>
+    void state::execute_dup(stack_cache<Enabled>& cache) {
+        value val = cache.is_cached() ? cache.get() : peek();
+        push(cache, val);
     }
 
     void state::execute_swap() {
@@ -369,7 +507,13 @@ namespace assignment_04 {
     }
 
     void state::execute_elem() {
-        value idx = pop();
+        stack_cache<false> cache;
+        execute_elem(cache);
+    }
+
+    template <bool Enabled>
+    void state::execute_elem(stack_cache<Enabled>& cache) {
+        value idx = pop(cache);
         validate(idx.is_integer(), "ELEM: index must be integer. Bytecode offset: %#X\n");
         int32_t idx_int = idx.as_integer();
         value agg = pop();
@@ -377,100 +521,181 @@ namespace assignment_04 {
         aggregate agg_val = agg.as_aggregate();
         validate(idx_int >= 0 && idx_int < agg_val.get_elements_size(), "ELEM: index out of bounds. Bytecode offset: %#X\n");
         value val = agg_val.get_element(idx_int);
-        push(val);
+        push(cache, val);
     }
 
     void state::execute_ld_global() {
-        int32_t addr = pop_next_int32();
+        execute_ld_global(pop_next_int32());
+    }
+
+    void state::execute_ld_global(int32_t addr) {
+        stack_cache<false> cache;
+        execute_ld_global(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_ld_global(stack_cache<Enabled>& cache, int32_t addr) {
         value target = get_global(addr);
-        push(target);
+        push(cache, target);
     }
 
     void state::execute_ld_local() {
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_ld_local(pop_next_int32());
+    }
+
+    void state::execute_ld_local(int32_t addr) {
+        stack_cache<false> cache;
+        execute_ld_local(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_ld_local(stack_cache<Enabled>& cache, int32_t addr) {
+        frame current_frame = peek_frame();
         value target = current_frame.get_local(addr);
-        push(target);
+        push(cache, target);
     }
 
     void state::execute_ld_argument() {
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_ld_argument(pop_next_int32());
+    }
+
+    void state::execute_ld_argument(int32_t addr) {
+        stack_cache<false> cache;
+        execute_ld_argument(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_ld_argument(stack_cache<Enabled>& cache, int32_t addr) {
+        frame current_frame = peek_frame();
         value target = current_frame.get_arg(addr);
-        push(target);
+        push(cache, target);
     }
 
     void state::execute_ld_captured() {
-        int32_t addr = pop_next_int32<true>();
-        frame& current_frame = peek_frame();
+        execute_ld_captured(pop_next_int32<true>());
+    }
+
+    void state::execute_ld_captured(int32_t addr) {
+        frame current_frame = peek_frame();
         validate(addr >= 0 && addr < current_frame.get_captured_vars_size(), "LD: captured index out of bounds. Bytecode offset: %#X\n");
         value target = current_frame.get_captured_var(addr);
         push(target);
     }
 
     void state::execute_lda_global() {
-        int32_t addr = pop_next_int32();
+        execute_lda_global(pop_next_int32());
+    }
+
+    void state::execute_lda_global(int32_t addr) {
         value target(get_global_reference(addr));
         push(target);
     }
 
     void state::execute_lda_local() {
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_lda_local(pop_next_int32());
+    }
+
+    void state::execute_lda_local(int32_t addr) {
+        frame current_frame = peek_frame();
         value target(current_frame.get_local_reference(addr));
         push(target);
     }
 
     void state::execute_lda_argument() {
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_lda_argument(pop_next_int32());
+    }
+
+    void state::execute_lda_argument(int32_t addr) {
+        frame current_frame = peek_frame();
         value target(current_frame.get_arg_reference(addr));
         push(target);
     }
 
     void state::execute_lda_captured() {
-        int32_t addr = pop_next_int32<true>();
-        frame& current_frame = peek_frame();
+        execute_lda_captured(pop_next_int32<true>());
+    }
+
+    void state::execute_lda_captured(int32_t addr) {
+        frame current_frame = peek_frame();
         validate(addr >= 0 && addr < current_frame.get_captured_vars_size(), "LDA: captured index out of bounds. Bytecode offset: %#X\n");
         value target(current_frame.get_captured_var_reference(addr));
         push(target);
     }
 
     void state::execute_st_global() {
-        value val = pop();
-        int32_t addr = pop_next_int32();
+        execute_st_global(pop_next_int32());
+    }
+
+    void state::execute_st_global(int32_t addr) {
+        stack_cache<false> cache;
+        execute_st_global(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_st_global(stack_cache<Enabled>& cache, int32_t addr) {
+        value val = pop(cache);
         set_global(addr, val);
-        push(val);
+        push(cache, val);
     }
 
     void state::execute_st_local() {
-        value val = pop();
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_st_local(pop_next_int32());
+    }
+
+    void state::execute_st_local(int32_t addr) {
+        stack_cache<false> cache;
+        execute_st_local(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_st_local(stack_cache<Enabled>& cache, int32_t addr) {
+        value val = pop(cache);
+        frame current_frame = peek_frame();
         current_frame.set_local(addr, val);
-        push(val);
+        push(cache, val);
     }
 
     void state::execute_st_argument() {
-        value val = pop();
-        int32_t addr = pop_next_int32();
-        frame& current_frame = peek_frame();
+        execute_st_argument(pop_next_int32());
+    }
+
+    void state::execute_st_argument(int32_t addr) {
+        stack_cache<false> cache;
+        execute_st_argument(cache, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_st_argument(stack_cache<Enabled>& cache, int32_t addr) {
+        value val = pop(cache);
+        frame current_frame = peek_frame();
         current_frame.set_arg(addr, val);
-        push(val);
+        push(cache, val);
     }
 
     void state::execute_st_captured() {
+        execute_st_captured(pop_next_int32<true>());
+    }
+
+    void state::execute_st_captured(int32_t addr) {
         value val = pop();
-        int32_t addr = pop_next_int32<true>();
-        frame& current_frame = peek_frame();
+        frame current_frame = peek_frame();
         validate(addr >= 0 && addr < current_frame.get_captured_vars_size(), "ST: captured index out of bounds. Bytecode offset: %#X\n");
         current_frame.set_captured_var(addr, val);
         push(val);
     }
 
     void state::execute_cjmp(bool nz) {
-        uint32_t addr = pop_next_int32();
-        value cond = pop();
+        execute_cjmp(nz, pop_next_int32());
+    }
+
+    void state::execute_cjmp(bool nz, uint32_t addr) {
+        stack_cache<false> cache;
+        execute_cjmp(cache, nz, addr);
+    }
+
+    template <bool Enabled>
+    void state::execute_cjmp(stack_cache<Enabled>& cache, bool nz, uint32_t addr) {
+        value cond = pop(cache);
         validate(cond.is_integer(), "CJMPZ/CJMPNZ: argument must be integer. Bytecode offset: %#X\n");
         int32_t cond_int = cond.as_integer();
         if (cond_int == nz) {
@@ -481,64 +706,51 @@ namespace assignment_04 {
     void state::execute_begin() {
         int32_t args_size = pop_next_int32();
         int32_t locals_size = pop_next_int32();
-        int32_t frame_stack_size = (locals_size >> 16) & 0xFFFF;
-        locals_size &= 0xFFFF;
-        frame new_frame(stack_, stack_.size(), locals_size, args_size, is_tmp_closure_);
+        execute_begin(args_size, locals_size);
+    }
+
+    void state::execute_begin(int32_t args_size, int32_t locals_size) {
+        push_frame(locals_size & 0xFFFF, args_size, is_tmp_closure_);
         is_tmp_closure_ = false;
-        validate(stack_.size() + frame_stack_size <= MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n");
-        stack_ = stack{stack_buf.data(), stack_.size() + locals_size};
-        push_frame(new_frame);
     }
 
     void state::execute_cbegin() {
         int32_t args_size = pop_next_int32();
         int32_t locals_size = pop_next_int32();
-        int32_t frame_stack_size = (locals_size >> 16) & 0xFFFF;
-        locals_size &= 0xFFFF;
-        frame new_frame(stack_, stack_.size(), locals_size, args_size, true);
-        validate(stack_.size() + frame_stack_size <= MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n");
-        stack_ = stack{stack_buf.data(), stack_.size() + locals_size};
-        push_frame(new_frame);
+        execute_cbegin(args_size, locals_size);
+    }
+
+    void state::execute_cbegin(int32_t args_size, int32_t locals_size) {
+        push_frame(locals_size & 0xFFFF, args_size, true);
     }
 
     void state::execute_closure() {
         int32_t addr = pop_next_int32();
         int32_t captured_size = pop_next_int32();
         push(addr);
-        const frame& current_frame = peek_frame();
+        const frame current_frame = peek_frame();
         for (int32_t i = 0; i < captured_size; ++i) {
             varspec capture_type = pop_next_varspec();
             int32_t capture_addr = pop_next_int32();
-            value capture;
-            switch (capture_type) {
-                case varspec::GLOBAL:
-                    capture = get_global(capture_addr);
-                    break;
-                case varspec::LOCAL:
-                    capture = current_frame.get_local(capture_addr);
-                    break;
-                case varspec::ARGUMENT:
-                    capture = current_frame.get_arg(capture_addr);
-                    break;
-                case varspec::CAPTURED:
-                    validate(capture_addr >= 0 && capture_addr < current_frame.get_captured_vars_size(), "CLOSURE: captured index out of bounds. Bytecode offset: %#X\n");
-                    capture = current_frame.get_captured_var(capture_addr);
-                    break;
-                default:
-                    validate(false, "CLOSURE: invalid varspec. Bytecode offset: %#X\n");
-            }
-            push(capture);
+            push(get_capture(capture_type, capture_addr, current_frame));
         }
-        std::span<auint> captured(stack_.end() - captured_size - 1, captured_size + 1);
-        closure tmp_closure(captured);
-        pop(captured_size + 1);
-        push(tmp_closure);
+        make_closure(captured_size);
+    }
+
+    void state::execute_closure(int32_t addr, std::span<const capture> captures) {
+        push(addr);
+        const frame current_frame = peek_frame();
+        for (const capture& spec : captures) {
+            push(get_capture(spec.get_type(), spec.get_addr(), current_frame));
+        }
+        make_closure(static_cast<int32_t>(captures.size()));
     }
 
     void state::execute_callc() {
         int32_t args_size = pop_next_int32();
-        frame& current_frame = peek_frame();
+        frame current_frame = peek_frame();
         current_frame.set_return_address(ip_);
+        std::atomic_signal_fence(std::memory_order_release);
         value target = peek(args_size);
         validate(target.is_closure(), "CALLC: argument must be closure. Bytecode offset: %#X\n");
         closure target_closure = target.as_closure();
@@ -548,31 +760,111 @@ namespace assignment_04 {
         validate(peek_next_op() == bytecode::BEGIN || peek_next_op() == bytecode::CBEGIN, "CALLC: destination instruction must be BEGIN or CBEGIN. Bytecode offset: %#X\n");
     }
 
+    void state::execute_callc(int32_t args_size) {
+        frame current_frame = peek_frame();
+        current_frame.set_return_address(ip_);
+        std::atomic_signal_fence(std::memory_order_release);
+        value target = peek(args_size);
+        validate(target.is_closure(), "CALLC: argument must be closure. Bytecode offset: %#X\n");
+        closure target_closure = target.as_closure();
+        uint32_t target_index = program_->get_index(target_closure.get_code_offset());
+        validate(target_index != program::NO_INDEX, "CALLC: incorrect destination. Bytecode offset: %#X\n");
+        bytecode target_op = program_->get_instruction(target_index).get_op();
+        validate(target_op == bytecode::BEGIN || target_op == bytecode::CBEGIN, "CALLC: destination instruction must be BEGIN or CBEGIN. Bytecode offset: %#X\n");
+        ip_ = target_index;
+        is_tmp_closure_ = true;
+    }
+
+    // A hit does what the call and the callee's BEGIN would do, the closure having been checked when its code was added.
+    void state::execute_callc(call_cache& callees, int32_t args_size, bool is_tail) {
+        value target = peek(args_size);
+        if (target.is_closure()) [[likely]] {
+            const call_cache::callee* callee = callees.find(target.as_closure().get_code_offset());
+            if (callee != nullptr) [[likely]] {
+                callees.count_hit();
+                frame current_frame = peek_frame();
+                current_frame.set_return_address(ip_);
+                std::atomic_signal_fence(std::memory_order_release);
+                ip_ = callee->body;
+                if (is_tail) {
+                    reuse_frame(args_size + 1);
+                }
+                push_frame(callee->locals_size, callee->args_size, true);
+                return;
+            }
+        }
+        callees.count_miss();
+        if (is_tail) {
+            execute_tail_callc(args_size);
+        } else {
+            execute_callc(args_size);
+        }
+        const instruction& begin = program_->get_instruction(ip_);
+        if (begin.get_superinstruction() == program::NO_SUPERINSTRUCTION) {
+            callees.add(call_cache::callee{target.as_closure().get_code_offset(), ip_ + 1, begin.get_first_arg(), begin.get_second_arg() & 0xFFFF});
+        }
+    }
+
     void state::execute_call() {
         int32_t addr = pop_next_int32();
         int32_t args_size = pop_next_int32();
         static_cast<void>(args_size);
-        frame& current_frame = peek_frame();
+        execute_call(addr);
+        validate(peek_next_op() == bytecode::BEGIN, "CALL: destination instruction must be BEGIN. Bytecode offset: %#X\n");
+    }
+
+    void state::execute_call(uint32_t addr) {
+        frame current_frame = peek_frame();
         current_frame.set_return_address(ip_);
+        std::atomic_signal_fence(std::memory_order_release);
         ip_ = addr;
         is_tmp_closure_ = false;
-        validate(peek_next_op() == bytecode::BEGIN, "CALL: destination instruction must be BEGIN. Bytecode offset: %#X\n");
     }
 
-    void state::execute_tag() {
-        int32_t tag_pos = pop_next_int32();
+    // The call is made as usual, then the callee's arguments, and its closure for CALLC, are moved down over the caller's
+    // frame, which the callee's BEGIN replaces. The callee returns straight to the caller's caller.
+    void state::execute_tail_callc() {
+        int32_t args_size = bytefile_.get_int32(ip_);
+        execute_callc();
+        reuse_frame(args_size + 1);
+    }
+
+    void state::execute_tail_callc(int32_t args_size) {
+        execute_callc(args_size);
+        reuse_frame(args_size + 1);
+    }
+
+    void state::execute_tail_call() {
+        int32_t args_size = bytefile_.get_int32(ip_ + sizeof(int32_t));
+        execute_call();
+        reuse_frame(args_size);
+    }
+
+    void state::execute_tail_call(uint32_t addr, int32_t args_size) {
+        execute_call(addr);
+        reuse_frame(args_size);
+    }
+
+    void state::execute_tag(const instruction& decoded) {
+        static_cast<void>(pop_next_int32());
         int32_t elements_size = pop_next_int32();
+        execute_tag(decoded.get_tag_hash(), elements_size);
+    }
+
+    void state::execute_tag(auint tag_hash, int32_t elements_size) {
         value res(0);
         value val = pop();
         if (val.is_s_expr()) {
-            std::string_view tag = bytefile_.get_string(tag_pos);
-            res = value{from_repr_t, static_cast<auint>(Btag(static_cast<void*>(val.as_reference()), LtagHash(const_cast<char*>(tag.data())), BOX(elements_size)))};
+            res = value{from_repr_t, static_cast<auint>(Btag(static_cast<void*>(val.as_reference()), tag_hash, BOX(elements_size)))};
         }
         push(res);
     }
 
     void state::execute_array() {
-        int32_t elements_size = pop_next_int32();
+        execute_array(pop_next_int32());
+    }
+
+    void state::execute_array(int32_t elements_size) {
         value val = pop();
         value res(from_repr_t, static_cast<auint>(Barray_patt(static_cast<void*>(val.as_reference()), BOX(elements_size))));
         push(res);
@@ -581,6 +873,10 @@ namespace assignment_04 {
     void state::execute_fail() {
         uint32_t line_number = pop_next_int32();
         uint32_t column_number = pop_next_int32();
+        execute_fail(line_number, column_number);
+    }
+
+    void state::execute_fail(uint32_t line_number, uint32_t column_number) {
         value val = pop();
         Bmatch_failure(static_cast<void*>(val.as_reference()), const_cast<char*>(bytefile_.get_name().data()), static_cast<aint>(line_number), static_cast<aint>(column_number));
     }
@@ -602,6 +898,18 @@ namespace assignment_04 {
         push(res);
     }
 
+    void state::execute_match(const match_table& table) {
+        value val = peek();
+        uint32_t target = table.get_default_target();
+        if (val.is_s_expr()) {
+            const sexp* obj = TO_SEXP(val.as_reference());
+            target = table.find(obj->tag, LEN(obj->data_header));
+        } else if (val.is_array()) {
+            target = table.find(match_table::ARRAY_TAG_KEY, LEN(TO_DATA(val.as_reference())->data_header));
+        }
+        execute_jmp(target);
+    }
+
     void state::execute_patt_array() {
         value val = pop();
         value res(from_repr_t, static_cast<auint>(Barray_tag_patt(static_cast<void*>(val.as_reference()))));
@@ -658,7 +966,10 @@ namespace assignment_04 {
     }
 
     void state::execute_call_barray() {
-        int32_t elements_size = pop_next_int32();
+        execute_call_barray(pop_next_int32());
+    }
+
+    void state::execute_call_barray(int32_t elements_size) {
         std::span<auint> elements(stack_.end() - elements_size, elements_size);
         array arr(elements);
         pop(elements_size);
@@ -667,7 +978,15 @@ namespace assignment_04 {
 
     void state::validate(bool condition, std::string_view message) const noexcept {
         if (!condition) {
-            failure(const_cast<char*>(message.data()), ip_);
+            failure(const_cast<char*>(message.data()), program_ == nullptr ? ip_ : program_->get_offset(ip_));
+        }
+    }
+
+    template <bool Enabled>
+    void state::flush(stack_cache<Enabled>& cache) {
+        if (cache.is_cached()) {
+            push(cache.get());
+            cache.reset();
         }
     }
 
@@ -679,27 +998,110 @@ namespace assignment_04 {
         return bytefile_.get_code(ip_);
     }
 
-    const frame& state::peek_frame() const {
-        return frames_.back();
+    void state::set_stack_maps(const verification_result& verification) noexcept {
+        verification_ = &verification;
+        scanned_state = this;
+        __gc_root_scanner = &scan_state_roots;
+    }
+
+    // Every frame is scanned with the map of the point it is stopped at: the running instruction for the top one and
+    // the call it made for the others. Each frame ends where the one above it starts. The globals and the arguments of
+    // the outermost frame are below all frames and are scanned as a whole. The collector leaves the first word of the
+    // stack out of both marking and fixing, so the scan does too.
+    void state::scan_roots() {
+        auint* limit = stack_buf.data() + stack_.size();
+        uint32_t resume_offset = get_resume_offset(ip_);
+        for (auint* locals = frame_locals_; locals != nullptr;) {
+            frame current_frame(locals);
+            current_frame.scan_roots(verification_->get_stack_map(resume_offset), limit);
+            limit = current_frame.get_bottom();
+            locals = current_frame.get_prev_locals();
+            if (locals != nullptr) {
+                resume_offset = get_resume_offset(frame{locals}.get_return_address());
+            }
+        }
+        for (auint* slot = stack_buf.data() + 1; slot < limit; ++slot) {
+            scan_slot(slot, slot_kind::ROOT);
+        }
     }
 
-    frame& state::peek_frame() {
-        return frames_.back();
+    // The handler may have stopped a frame being pushed or popped halfway, so the walk ends at a link that does not lead
+    // further down the stack instead of following it. Between a call and the callee's BEGIN the current frame is still
+    // the caller's, which then has its return address set, while a frame BEGIN has just pushed has none yet. BEGIN may
+    // also lie right behind: the switch dispatch reads its operands before pushing the frame, and a quick call moves
+    // past it before running it.
+    size_t state::sample_stack(std::span<uint32_t> offsets) const noexcept {
+        size_t depth = 0;
+        if (offsets.empty()) {
+            return depth;
+        }
+        std::atomic_signal_fence(std::memory_order_acquire);
+        uint32_t offset = get_resume_offset(ip_);
+        offsets[depth++] = offset;
+        auto is_function_entry = [this](uint32_t at) {
+            bytecode op = bytefile_.get_code(at);
+            return op == bytecode::BEGIN || op == bytecode::CBEGIN;
+        };
+        bool is_entry = offset < bytefile_.get_code_size() && is_function_entry(offset);
+        if (program_ == nullptr) {
+            for (uint32_t behind : {sizeof(bytecode), sizeof(bytecode) + sizeof(int32_t), sizeof(bytecode) + 2 * sizeof(int32_t)}) {
+                is_entry = is_entry || (offset >= behind && offset - behind < bytefile_.get_code_size() && is_function_entry(offset - behind));
+            }
+        } else if (ip_ > 0 && ip_ <= program_->get_size()) {
+            is_entry = is_entry || is_function_entry(program_->get_offset(ip_ - 1));
+        }
+        if (frame_locals_ != nullptr && depth < offsets.size()) {
+            uint32_t return_address = frame{frame_locals_}.get_return_address();
+            if (is_entry && return_address != 0) {
+                offsets[depth++] = get_resume_offset(return_address);
+            }
+        }
+        for (auint* locals = frame_locals_; locals != nullptr && depth < offsets.size();) {
+            auint* prev_locals = frame{locals}.get_prev_locals();
+            if (prev_locals == nullptr || prev_locals >= locals || prev_locals < stack_buf.data() + frame::RECORD_SIZE) {
+                break;
+            }
+            offsets[depth++] = get_resume_offset(frame{prev_locals}.get_return_address());
+            locals = prev_locals;
+        }
+        return depth;
+    }
+
+    uint32_t state::get_resume_offset(uint32_t ip) const noexcept {
+        return program_ == nullptr ? ip : program_->get_offset(ip);
     }
 
-    void state::push_frame(const frame& frame) {
-        validate(frames_.size() + 1 <= MAX_FRAMES_SIZE, "Frames stack overflow. Bytecode offset: %#X\n");
-        frames_ = std::span{frames_buf.begin(), frames_.size() + 1};
-        frames_[frames_.size() - 1] = frame;
+    frame state::peek_frame() const {
+        return frame{frame_locals_};
     }
 
+    // The record goes right above the arguments and the locals above it.
+    void state::push_frame(uint32_t locals_size, uint32_t args_size, bool is_frame_closure) {
+        uint32_t base = stack_.size() + frame::RECORD_SIZE;
+        frame new_frame(stack_buf.data() + base, frame_locals_, args_size, is_frame_closure);
+        // The sampling profiler reads ip_ and frame_locals_ from a signal handler on this thread, so neither may be
+        // stored before the frame record or the return address it leads to.
+        std::atomic_signal_fence(std::memory_order_release);
+        frame_locals_ = stack_buf.data() + base;
+        stack_ = stack{stack_buf.data(), base + locals_size};
+    }
+
+    // The record stays in place until the stack grows over it again.
     frame state::pop_frame() {
-        validate(!frames_.empty(), "Frames stack underflow. Bytecode offset: %#X\n");
-        frame current_frame = frames_.back();
-        frames_ = frames_.subspan(0, frames_.size() - 1);
+        validate(has_frame(), "Frames stack underflow. Bytecode offset: %#X\n");
+        frame current_frame = peek_frame();
+        std::atomic_signal_fence(std::memory_order_release);
+        frame_locals_ = current_frame.get_prev_locals();
         return current_frame;
     }
 
+    void state::reuse_frame(uint32_t values_size) {
+        auint* bottom = pop_frame().get_bottom();
+        auint* top = stack_buf.data() + stack_.size();
+        std::copy(top - values_size, top, bottom);
+        stack_ = stack{stack_buf.data(), static_cast<uint32_t>(bottom - stack_buf.data()) + values_size};
+    }
+
     value state::peek(uint32_t offset) const {
         return value{from_repr_t, stack_.top(offset)};
     }
@@ -716,6 +1118,27 @@ namespace assignment_04 {
         stack_.pop(count);
     }
 
+    template <bool Enabled>
+    void state::push(stack_cache<Enabled>& cache, value val) {
+        if (!Enabled) {
+            push(val);
+            return;
+        }
+        if (cache.is_cached()) {
+            push(cache.get());
+        }
+        cache.set(val);
+    }
+
+    template <bool Enabled>
+    value state::pop(stack_cache<Enabled>& cache) {
+        if (cache.is_cached()) {
+            cache.reset();
+            return cache.get();
+        }
+        return pop();
+    }
+
     value state::get_global(uint32_t pos) const {
         return value{from_repr_t, stack_[pos]};
     }
@@ -728,10 +1151,46 @@ namespace assignment_04 {
         stack_[pos] = global.get_repr();
     }
 
-    void interpret(const bytefile& file) {
-        state interpreter_state(file);
+    value state::get_capture(varspec capture_type, int32_t capture_addr, const frame& current_frame) const {
+        switch (capture_type) {
+            case varspec::GLOBAL:
+                return get_global(capture_addr);
+            case varspec::LOCAL:
+                return current_frame.get_local(capture_addr);
+            case varspec::ARGUMENT:
+                return current_frame.get_arg(capture_addr);
+            case varspec::CAPTURED:
+                validate(capture_addr >= 0 && capture_addr < current_frame.get_captured_vars_size(), "CLOSURE: captured index out of bounds. Bytecode offset: %#X\n");
+                return current_frame.get_captured_var(capture_addr);
+            default:
+                validate(false, "CLOSURE: invalid varspec. Bytecode offset: %#X\n");
+                return value{};
+        }
+    }
+
+    void state::make_closure(int32_t captured_size) {
+        std::span<auint> captured(stack_.end() - captured_size - 1, captured_size + 1);
+        closure tmp_closure(captured);
+        pop(captured_size + 1);
+        push(tmp_closure);
+    }
+
+    // The switch dispatch runs the bytefile itself and only looks up what the loader has computed for the instruction
+    // it is at: the decision for a call and the resolved literals.
+    static const instruction& get_current_instruction(const program& code, const state& interpreter_state) noexcept {
+        return code.get_instruction(code.get_index(interpreter_state.get_ip() - sizeof(bytecode)));
+    }
+
+    static bool is_tail_call(const program& code, const state& interpreter_state) noexcept {
+        return get_current_instruction(code, interpreter_state).is_tail_call();
+    }
+
+    template <typename Profile>
+    static void interpret_switch(state& interpreter_state, const program& code, Profile& profile) {
         while (true) {
-            switch (interpreter_state.pop_next_op()) {
+            bytecode op = interpreter_state.pop_next_op();
+            profile.record(interpreter_state.get_ip() - sizeof(bytecode), op);
+            switch (op) {
                 case bytecode::LOW_ADD:
                 case bytecode::LOW_SUB:
                 case bytecode::LOW_MUL:
@@ -753,10 +1212,10 @@ namespace assignment_04 {
                     interpreter_state.execute_const();
                     break;
                 case bytecode::STRING:
-                    interpreter_state.execute_string();
+                    interpreter_state.execute_string(get_current_instruction(code, interpreter_state));
                     break;
                 case bytecode::SEXP:
-                    interpreter_state.execute_sexp();
+                    interpreter_state.execute_sexp(get_current_instruction(code, interpreter_state));
                     break;
                 case bytecode::STI:
                     interpreter_state.execute_sti();
@@ -837,13 +1296,21 @@ namespace assignment_04 {
                     interpreter_state.execute_closure();
                     break;
                 case bytecode::CALLC:
-                    interpreter_state.execute_callc();
+                    if (is_tail_call(code, interpreter_state)) {
+                        interpreter_state.execute_tail_callc();
+                    } else {
+                        interpreter_state.execute_callc();
+                    }
                     break;
                 case bytecode::CALL:
-                    interpreter_state.execute_call();
+                    if (is_tail_call(code, interpreter_state)) {
+                        interpreter_state.execute_tail_call();
+                    } else {
+                        interpreter_state.execute_call();
+                    }
                     break;
                 case bytecode::TAG:
-                    interpreter_state.execute_tag();
+                    interpreter_state.execute_tag(get_current_instruction(code, interpreter_state));
                     break;
                 case bytecode::ARRAY:
                     interpreter_state.execute_array();
@@ -898,4 +1365,726 @@ namespace assignment_04 {
         }
     }
 
+    // Instructions that only move values between the operand stack and variables keep the top of the operand stack
+    // in the cache. Everything else may allocate, call a builtin or touch the frames, so the cache is flushed first.
+    constexpr static bool is_stack_cached(bytecode op) noexcept {
+        switch (op) {
+            case bytecode::LOW_ADD:
+            case bytecode::LOW_SUB:
+            case bytecode::LOW_MUL:
+            case bytecode::LOW_DIV:
+            case bytecode::LOW_MOD:
+            case bytecode::LOW_LT:
+            case bytecode::LOW_LE:
+            case bytecode::LOW_GT:
+            case bytecode::LOW_GE:
+            case bytecode::LOW_EQ:
+            case bytecode::LOW_NE:
+            case bytecode::LOW_AND:
+            case bytecode::LOW_OR:
+            case bytecode::CONST:
+            case bytecode::JMP:
+            case bytecode::DROP:
+            case bytecode::DUP:
+            case bytecode::ELEM:
+            case bytecode::LD_GLOBAL:
+            case bytecode::LD_LOCAL:
+            case bytecode::LD_ARGUMENT:
+            case bytecode::ST_GLOBAL:
+            case bytecode::ST_LOCAL:
+            case bytecode::ST_ARGUMENT:
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+            case bytecode::LINE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    template <bytecode Op, bool StackCaching>
+    [[gnu::always_inline]] inline static void execute_instruction(state& interpreter_state, const instruction& insn, stack_cache<StackCaching>& cache) {
+        if constexpr (!is_stack_cached(Op)) {
+            interpreter_state.flush(cache);
+        }
+        if constexpr (Op == bytecode::LOW_EQ) {
+            interpreter_state.execute_low_eq(cache);
+        } else if constexpr (Op >= bytecode::LOW_ADD && Op <= bytecode::LOW_OR) {
+            interpreter_state.execute_binop<Op>(cache);
+        } else if constexpr (Op == bytecode::CONST) {
+            interpreter_state.execute_const(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::STRING) {
+            interpreter_state.execute_string(insn.get_string());
+        } else if constexpr (Op == bytecode::SEXP) {
+            interpreter_state.execute_sexp(insn.get_tag_hash(), insn.get_second_arg());
+        } else if constexpr (Op == bytecode::STI) {
+            interpreter_state.execute_sti();
+        } else if constexpr (Op == bytecode::STA) {
+            interpreter_state.execute_sta();
+        } else if constexpr (Op == bytecode::JMP) {
+            interpreter_state.execute_jmp(insn.get_target());
+        } else if constexpr (Op == bytecode::DROP) {
+            interpreter_state.execute_drop(cache);
+        } else if constexpr (Op == bytecode::DUP) {
+            interpreter_state.execute_dup(cache);
+        } else if constexpr (Op == bytecode::SWAP) {
+            interpreter_state.execute_swap();
+        } else if constexpr (Op == bytecode::ELEM) {
+            interpreter_state.execute_elem(cache);
+        } else if constexpr (Op == bytecode::LD_GLOBAL) {
+            interpreter_state.execute_ld_global(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LD_LOCAL) {
+            interpreter_state.execute_ld_local(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LD_ARGUMENT) {
+            interpreter_state.execute_ld_argument(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LD_CAPTURED) {
+            interpreter_state.execute_ld_captured(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LDA_GLOBAL) {
+            interpreter_state.execute_lda_global(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LDA_LOCAL) {
+            interpreter_state.execute_lda_local(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LDA_ARGUMENT) {
+            interpreter_state.execute_lda_argument(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LDA_CAPTURED) {
+            interpreter_state.execute_lda_captured(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::ST_GLOBAL) {
+            interpreter_state.execute_st_global(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::ST_LOCAL) {
+            interpreter_state.execute_st_local(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::ST_ARGUMENT) {
+            interpreter_state.execute_st_argument(cache, insn.get_first_arg());
+        } else if constexpr (Op == bytecode::ST_CAPTURED) {
+            interpreter_state.execute_st_captured(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::CJMPZ) {
+            interpreter_state.execute_cjmp(cache, false, insn.get_target());
+        } else if constexpr (Op == bytecode::CJMPNZ) {
+            interpreter_state.execute_cjmp(cache, true, insn.get_target());
+        } else if constexpr (Op == bytecode::BEGIN) {
+            interpreter_state.execute_begin(insn.get_first_arg(), insn.get_second_arg());
+        } else if constexpr (Op == bytecode::CBEGIN) {
+            interpreter_state.execute_cbegin(insn.get_first_arg(), insn.get_second_arg());
+        } else if constexpr (Op == bytecode::CLOSURE) {
+            interpreter_state.execute_closure(insn.get_first_arg(), insn.get_captures());
+        } else if constexpr (Op == bytecode::CALLC) {
+            if (insn.is_tail_call()) {
+                interpreter_state.execute_tail_callc(insn.get_first_arg());
+            } else {
+                interpreter_state.execute_callc(insn.get_first_arg());
+            }
+        } else if constexpr (Op == bytecode::CALL) {
+            if (insn.is_tail_call()) {
+                interpreter_state.execute_tail_call(insn.get_target(), insn.get_second_arg());
+            } else {
+                interpreter_state.execute_call(insn.get_target());
+            }
+        } else if constexpr (Op == bytecode::TAG) {
+            interpreter_state.execute_tag(insn.get_tag_hash(), insn.get_second_arg());
+        } else if constexpr (Op == bytecode::ARRAY) {
+            interpreter_state.execute_array(insn.get_first_arg());
+        } else if constexpr (Op == bytecode::LINE) {
+        } else if constexpr (Op == bytecode::PATT_STR) {
+            interpreter_state.execute_patt_str();
+        } else if constexpr (Op == bytecode::PATT_STRING) {
+            interpreter_state.execute_patt_string();
+        } else if constexpr (Op == bytecode::PATT_ARRAY) {
+            interpreter_state.execute_patt_array();
+        } else if constexpr (Op == bytecode::PATT_SEXP) {
+            interpreter_state.execute_patt_sexp();
+        } else if constexpr (Op == bytecode::PATT_REF) {
+            interpreter_state.execute_patt_ref();
+        } else if constexpr (Op == bytecode::PATT_VAL) {
+            interpreter_state.execute_patt_val();
+        } else if constexpr (Op == bytecode::PATT_FUN) {
+            interpreter_state.execute_patt_fun();
+        } else if constexpr (Op == bytecode::CALL_LREAD) {
+            interpreter_state.execute_call_lread();
+        } else if constexpr (Op == bytecode::CALL_LWRITE) {
+            interpreter_state.execute_call_lwrite();
+        } else if constexpr (Op == bytecode::CALL_LLENGTH) {
+            interpreter_state.execute_call_llength();
+        } else if constexpr (Op == bytecode::CALL_LSTRING) {
+            interpreter_state.execute_call_lstring();
+        } else if constexpr (Op == bytecode::CALL_BARRAY) {
+            interpreter_state.execute_call_barray(insn.get_first_arg());
+        } else {
+            static_assert(Op != Op, "Bytecode can not be executed without leaving the dispatch loop");
+        }
+    }
+
+    void execute_instruction(state& interpreter_state, const instruction& insn) {
+        stack_cache<false> cache;
+        switch (insn.get_op()) {
+#define EXECUTE(op)                                                     \
+    case bytecode::op:                                                  \
+        execute_instruction<bytecode::op>(interpreter_state, insn, cache); \
+        break;
+            EXECUTE(LOW_ADD)
+            EXECUTE(LOW_SUB)
+            EXECUTE(LOW_MUL)
+            EXECUTE(LOW_DIV)
+            EXECUTE(LOW_MOD)
+            EXECUTE(LOW_LT)
+            EXECUTE(LOW_LE)
+            EXECUTE(LOW_GT)
+            EXECUTE(LOW_GE)
+            EXECUTE(LOW_EQ)
+            EXECUTE(LOW_NE)
+            EXECUTE(LOW_AND)
+            EXECUTE(LOW_OR)
+            EXECUTE(CONST)
+            EXECUTE(STRING)
+            EXECUTE(SEXP)
+            EXECUTE(STI)
+            EXECUTE(STA)
+            EXECUTE(JMP)
+            EXECUTE(DROP)
+            EXECUTE(DUP)
+            EXECUTE(SWAP)
+            EXECUTE(ELEM)
+            EXECUTE(LD_GLOBAL)
+            EXECUTE(LD_LOCAL)
+            EXECUTE(LD_ARGUMENT)
+            EXECUTE(LD_CAPTURED)
+            EXECUTE(LDA_GLOBAL)
+            EXECUTE(LDA_LOCAL)
+            EXECUTE(LDA_ARGUMENT)
+            EXECUTE(LDA_CAPTURED)
+            EXECUTE(ST_GLOBAL)
+            EXECUTE(ST_LOCAL)
+            EXECUTE(ST_ARGUMENT)
+            EXECUTE(ST_CAPTURED)
+            EXECUTE(CJMPZ)
+            EXECUTE(CJMPNZ)
+            EXECUTE(BEGIN)
+            EXECUTE(CBEGIN)
+            EXECUTE(CLOSURE)
+            EXECUTE(CALLC)
+            EXECUTE(CALL)
+            EXECUTE(TAG)
+            EXECUTE(ARRAY)
+            EXECUTE(LINE)
+            EXECUTE(PATT_STR)
+            EXECUTE(PATT_STRING)
+            EXECUTE(PATT_ARRAY)
+            EXECUTE(PATT_SEXP)
+            EXECUTE(PATT_REF)
+            EXECUTE(PATT_VAL)
+            EXECUTE(PATT_FUN)
+            EXECUTE(CALL_LREAD)
+            EXECUTE(CALL_LWRITE)
+            EXECUTE(CALL_LLENGTH)
+            EXECUTE(CALL_LSTRING)
+            EXECUTE(CALL_BARRAY)
+#undef EXECUTE
+            case bytecode::FAIL:
+                interpreter_state.execute_fail(insn.get_first_arg(), insn.get_second_arg());
+                break;
+            default:
+                interpreter_state.validate(false, "Unknown bytecode. Bytecode offset: %#X\n");
+        }
+    }
+
+    // Components after the first one are fetched as ordinary instructions, so ip_ always points past the instruction
+    // being executed and error offsets stay exact; only the indirect jumps between the components are saved.
+    template <bool StackCaching, bytecode First, bytecode... Rest>
+    [[gnu::always_inline]] inline static void execute_superinstruction(state& interpreter_state, const instruction& insn, stack_cache<StackCaching>& cache) {
+        execute_instruction<First>(interpreter_state, insn, cache);
+        if constexpr (sizeof...(Rest) > 0) {
+            execute_superinstruction<StackCaching, Rest...>(interpreter_state, interpreter_state.pop_next_instruction(), cache);
+        }
+    }
+
+    static instruction& get_instruction_site(program& code, const instruction* insn) noexcept {
+        return code.get_instruction(static_cast<uint32_t>(insn - &code.get_instruction(0)));
+    }
+
+    // Quickening rewrites the handler of an instruction on its first execution and keeps the cached data in the
+    // instruction itself, so only the decoded stream is changed and the bytefile stays intact.
+    template <bool StackCaching>
+    [[gnu::flatten]] static void interpret_threaded(state& interpreter_state, program& code, bool quickening_enabled, const jit_compiler* jit, tiering_manager* tiering) {
+        std::array<const void*, std::numeric_limits<std::underlying_type_t<bytecode>>::max() + 1> handlers{};
+        handlers.fill(&&do_unknown);
+        handlers[static_cast<size_t>(bytecode::LOW_ADD)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_SUB)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_MUL)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_DIV)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_MOD)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_LT)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_LE)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_GT)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_GE)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_NE)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_AND)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_OR)] = &&do_binop_high;
+        handlers[static_cast<size_t>(bytecode::LOW_EQ)] = &&do_low_eq;
+        handlers[static_cast<size_t>(bytecode::CONST)] = &&do_const;
+        handlers[static_cast<size_t>(bytecode::STRING)] = &&do_string;
+        handlers[static_cast<size_t>(bytecode::SEXP)] = &&do_sexp;
+        handlers[static_cast<size_t>(bytecode::STI)] = &&do_sti;
+        handlers[static_cast<size_t>(bytecode::STA)] = &&do_sta;
+        handlers[static_cast<size_t>(bytecode::JMP)] = &&do_jmp;
+        handlers[static_cast<size_t>(bytecode::END)] = &&do_ret;
+        handlers[static_cast<size_t>(bytecode::RET)] = &&do_ret;
+        handlers[static_cast<size_t>(bytecode::DROP)] = &&do_drop;
+        handlers[static_cast<size_t>(bytecode::DUP)] = &&do_dup;
+        handlers[static_cast<size_t>(bytecode::SWAP)] = &&do_swap;
+        handlers[static_cast<size_t>(bytecode::ELEM)] = &&do_elem;
+        handlers[static_cast<size_t>(bytecode::LD_GLOBAL)] = &&do_ld_global;
+        handlers[static_cast<size_t>(bytecode::LD_LOCAL)] = &&do_ld_local;
+        handlers[static_cast<size_t>(bytecode::LD_ARGUMENT)] = &&do_ld_argument;
+        handlers[static_cast<size_t>(bytecode::LD_CAPTURED)] = &&do_ld_captured;
+        handlers[static_cast<size_t>(bytecode::LDA_GLOBAL)] = &&do_lda_global;
+        handlers[static_cast<size_t>(bytecode::LDA_LOCAL)] = &&do_lda_local;
+        handlers[static_cast<size_t>(bytecode::LDA_ARGUMENT)] = &&do_lda_argument;
+        handlers[static_cast<size_t>(bytecode::LDA_CAPTURED)] = &&do_lda_captured;
+        handlers[static_cast<size_t>(bytecode::ST_GLOBAL)] = &&do_st_global;
+        handlers[static_cast<size_t>(bytecode::ST_LOCAL)] = &&do_st_local;
+        handlers[static_cast<size_t>(bytecode::ST_ARGUMENT)] = &&do_st_argument;
+        handlers[static_cast<size_t>(bytecode::ST_CAPTURED)] = &&do_st_captured;
+        handlers[static_cast<size_t>(bytecode::CJMPZ)] = &&do_cjmpz;
+        handlers[static_cast<size_t>(bytecode::CJMPNZ)] = &&do_cjmpnz;
+        handlers[static_cast<size_t>(bytecode::BEGIN)] = &&do_begin;
+        handlers[static_cast<size_t>(bytecode::CBEGIN)] = &&do_cbegin;
+        handlers[static_cast<size_t>(bytecode::CLOSURE)] = &&do_closure;
+        handlers[static_cast<size_t>(bytecode::CALLC)] = &&do_callc;
+        handlers[static_cast<size_t>(bytecode::CALL)] = &&do_call;
+        handlers[static_cast<size_t>(bytecode::TAG)] = &&do_tag;
+        handlers[static_cast<size_t>(bytecode::ARRAY)] = &&do_array;
+        handlers[static_cast<size_t>(bytecode::FAIL)] = &&do_fail;
+        handlers[static_cast<size_t>(bytecode::LINE)] = &&do_line;
+        handlers[static_cast<size_t>(bytecode::PATT_STR)] = &&do_patt_str;
+        handlers[static_cast<size_t>(bytecode::PATT_STRING)] = &&do_patt_string;
+        handlers[static_cast<size_t>(bytecode::PATT_ARRAY)] = &&do_patt_array;
+        handlers[static_cast<size_t>(bytecode::PATT_SEXP)] = &&do_patt_sexp;
+        handlers[static_cast<size_t>(bytecode::PATT_REF)] = &&do_patt_ref;
+        handlers[static_cast<size_t>(bytecode::PATT_VAL)] = &&do_patt_val;
+        handlers[static_cast<size_t>(bytecode::PATT_FUN)] = &&do_patt_fun;
+        handlers[static_cast<size_t>(bytecode::CALL_LREAD)] = &&do_call_lread;
+        handlers[static_cast<size_t>(bytecode::CALL_LWRITE)] = &&do_call_lwrite;
+        handlers[static_cast<size_t>(bytecode::CALL_LLENGTH)] = &&do_call_llength;
+        handlers[static_cast<size_t>(bytecode::CALL_LSTRING)] = &&do_call_lstring;
+        handlers[static_cast<size_t>(bytecode::CALL_BARRAY)] = &&do_call_barray;
+        handlers[static_cast<size_t>(bytecode::STOP)] = &&do_stop;
+#define SUPERINSTRUCTION_COUNT(name, ...) +1
+#define SUPERINSTRUCTION_HANDLER(name, ...) &&do_##name,
+        std::array<const void*, 0 ASSIGNMENT04_SUPERINSTRUCTIONS(SUPERINSTRUCTION_COUNT)> superinstruction_handlers{ASSIGNMENT04_SUPERINSTRUCTIONS(SUPERINSTRUCTION_HANDLER)};
+#undef SUPERINSTRUCTION_HANDLER
+#undef SUPERINSTRUCTION_COUNT
+        if (quickening_enabled) {
+            // The operator is known when the program is decoded, so every site is bound to its operator's handler up front.
+            handlers[static_cast<size_t>(bytecode::LOW_ADD)] = &&do_quick_add;
+            handlers[static_cast<size_t>(bytecode::LOW_SUB)] = &&do_quick_sub;
+            handlers[static_cast<size_t>(bytecode::LOW_MUL)] = &&do_quick_mul;
+            handlers[static_cast<size_t>(bytecode::LOW_DIV)] = &&do_quick_div;
+            handlers[static_cast<size_t>(bytecode::LOW_MOD)] = &&do_quick_mod;
+            handlers[static_cast<size_t>(bytecode::LOW_LT)] = &&do_quick_lt;
+            handlers[static_cast<size_t>(bytecode::LOW_LE)] = &&do_quick_le;
+            handlers[static_cast<size_t>(bytecode::LOW_GT)] = &&do_quick_gt;
+            handlers[static_cast<size_t>(bytecode::LOW_GE)] = &&do_quick_ge;
+            handlers[static_cast<size_t>(bytecode::LOW_NE)] = &&do_quick_ne;
+            handlers[static_cast<size_t>(bytecode::LOW_AND)] = &&do_quick_and;
+            handlers[static_cast<size_t>(bytecode::LOW_OR)] = &&do_quick_or;
+            // A quickened call skips the callee's BEGIN, which is where tiering counts calls and switches to native code.
+            if (tiering == nullptr) {
+                handlers[static_cast<size_t>(bytecode::CALL)] = &&do_quicken_call;
+                // Compiled functions are entered through their BEGIN, which the cache would skip.
+                if (jit == nullptr) {
+                    handlers[static_cast<size_t>(bytecode::CALLC)] = &&do_quicken_callc;
+                }
+            }
+        }
+        code.bind(handlers, superinstruction_handlers, &&do_match);
+        if (jit != nullptr) {
+            for (uint32_t index : jit->get_entry_indices()) {
+                code.get_instruction(index).set_handler(&&do_native);
+            }
+        }
+        if (tiering != nullptr) {
+            for (uint32_t i = 0; i < code.get_size(); ++i) {
+                instruction& insn = code.get_instruction(i);
+                if (insn.get_op() == bytecode::BEGIN || insn.get_op() == bytecode::CBEGIN) {
+                    tiering->set_handler(i, insn.get_handler());
+                    insn.set_handler(&&do_tiered_begin);
+                } else if (is_back_edge(insn, i)) {
+                    insn.set_handler(insn.get_op() == bytecode::JMP ? &&do_back_edge_jmp : insn.get_op() == bytecode::CJMPZ ? &&do_back_edge_cjmpz : &&do_back_edge_cjmpnz);
+                }
+            }
+        }
+        stack_cache<StackCaching> cache;
+        const instruction* insn = nullptr;
+#define DISPATCH()                                       \
+    do {                                                 \
+        insn = &interpreter_state.pop_next_instruction(); \
+        goto *insn->get_handler();                       \
+    } while (false)
+#define INSTALL_NATIVE_CODE()                                         \
+    if (tiering->has_ready()) {                                       \
+        for (uint32_t index : tiering->take_ready()) {                \
+            code.get_instruction(index).set_handler(&&do_native);     \
+        }                                                             \
+    }
+#define EXECUTE(op)                                                          \
+    execute_instruction<bytecode::op>(interpreter_state, *insn, cache); \
+    DISPATCH()
+        DISPATCH();
+    do_binop_high:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_binop_high(insn->get_op());
+        DISPATCH();
+    do_low_eq:
+        EXECUTE(LOW_EQ);
+    do_const:
+        EXECUTE(CONST);
+    do_string:
+        EXECUTE(STRING);
+    do_sexp:
+        EXECUTE(SEXP);
+    do_sti:
+        EXECUTE(STI);
+    do_sta:
+        EXECUTE(STA);
+    do_jmp:
+        EXECUTE(JMP);
+    do_ret:
+        interpreter_state.flush(cache);
+        if (interpreter_state.execute_ret()) {
+            return;
+        }
+        DISPATCH();
+    do_drop:
+        EXECUTE(DROP);
+    do_dup:
+        EXECUTE(DUP);
+    do_match:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_match(*insn->get_match_table());
+        DISPATCH();
+    do_swap:
+        EXECUTE(SWAP);
+    do_elem:
+        EXECUTE(ELEM);
+    do_ld_global:
+        EXECUTE(LD_GLOBAL);
+    do_ld_local:
+        EXECUTE(LD_LOCAL);
+    do_ld_argument:
+        EXECUTE(LD_ARGUMENT);
+    do_ld_captured:
+        EXECUTE(LD_CAPTURED);
+    do_lda_global:
+        EXECUTE(LDA_GLOBAL);
+    do_lda_local:
+        EXECUTE(LDA_LOCAL);
+    do_lda_argument:
+        EXECUTE(LDA_ARGUMENT);
+    do_lda_captured:
+        EXECUTE(LDA_CAPTURED);
+    do_st_global:
+        EXECUTE(ST_GLOBAL);
+    do_st_local:
+        EXECUTE(ST_LOCAL);
+    do_st_argument:
+        EXECUTE(ST_ARGUMENT);
+    do_st_captured:
+        EXECUTE(ST_CAPTURED);
+    do_cjmpz:
+        EXECUTE(CJMPZ);
+    do_cjmpnz:
+        EXECUTE(CJMPNZ);
+    do_begin:
+        EXECUTE(BEGIN);
+    do_cbegin:
+        EXECUTE(CBEGIN);
+    do_closure:
+        EXECUTE(CLOSURE);
+    do_callc:
+        EXECUTE(CALLC);
+    do_call:
+        EXECUTE(CALL);
+    do_tag:
+        EXECUTE(TAG);
+    do_array:
+        EXECUTE(ARRAY);
+    do_fail:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_fail(insn->get_first_arg(), insn->get_second_arg());
+        return;
+    do_line:
+        DISPATCH();
+    do_patt_str:
+        EXECUTE(PATT_STR);
+    do_patt_string:
+        EXECUTE(PATT_STRING);
+    do_patt_array:
+        EXECUTE(PATT_ARRAY);
+    do_patt_sexp:
+        EXECUTE(PATT_SEXP);
+    do_patt_ref:
+        EXECUTE(PATT_REF);
+    do_patt_val:
+        EXECUTE(PATT_VAL);
+    do_patt_fun:
+        EXECUTE(PATT_FUN);
+    do_call_lread:
+        EXECUTE(CALL_LREAD);
+    do_call_lwrite:
+        EXECUTE(CALL_LWRITE);
+    do_call_llength:
+        EXECUTE(CALL_LLENGTH);
+    do_call_lstring:
+        EXECUTE(CALL_LSTRING);
+    do_call_barray:
+        EXECUTE(CALL_BARRAY);
+    do_stop:
+        return;
+    do_unknown:
+        interpreter_state.validate(false, "Unknown bytecode. Bytecode offset: %#X\n");
+        return;
+    do_quick_add:
+        EXECUTE(LOW_ADD);
+    do_quick_sub:
+        EXECUTE(LOW_SUB);
+    do_quick_mul:
+        EXECUTE(LOW_MUL);
+    do_quick_div:
+        EXECUTE(LOW_DIV);
+    do_quick_mod:
+        EXECUTE(LOW_MOD);
+    do_quick_lt:
+        EXECUTE(LOW_LT);
+    do_quick_le:
+        EXECUTE(LOW_LE);
+    do_quick_gt:
+        EXECUTE(LOW_GT);
+    do_quick_ge:
+        EXECUTE(LOW_GE);
+    do_quick_ne:
+        EXECUTE(LOW_NE);
+    do_quick_and:
+        EXECUTE(LOW_AND);
+    do_quick_or:
+        EXECUTE(LOW_OR);
+    do_quicken_call: {
+        // The quick call runs the callee's BEGIN itself and continues right after it. This is not possible when BEGIN
+        // heads a superinstruction, as the rest of the superinstruction must not be dispatched on its own, or when the
+        // callee has been compiled to native code.
+        const instruction& callee = code.get_instruction(insn->get_target());
+        instruction& site = get_instruction_site(code, insn);
+        if (callee.get_superinstruction() != program::NO_SUPERINSTRUCTION || callee.get_handler() == &&do_native) {
+            site.set_handler(&&do_call);
+            goto do_call;
+        }
+        site.set_second_arg(callee.get_first_arg());
+        site.set_cache(static_cast<uint32_t>(callee.get_second_arg()));
+        if (insn->is_tail_call()) {
+            site.set_handler(&&do_quick_tail_call);
+            goto do_quick_tail_call;
+        }
+        site.set_handler(&&do_quick_call);
+        goto do_quick_call;
+    }
+    do_quick_call:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_call(insn->get_target() + 1);
+        interpreter_state.execute_begin(insn->get_second_arg(), static_cast<int32_t>(insn->get_cache()));
+        DISPATCH();
+    do_quick_tail_call:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_tail_call(insn->get_target() + 1, insn->get_second_arg());
+        interpreter_state.execute_begin(insn->get_second_arg(), static_cast<int32_t>(insn->get_cache()));
+        DISPATCH();
+    do_quicken_callc: {
+        instruction& site = get_instruction_site(code, insn);
+        site.set_second_arg(static_cast<int32_t>(code.add_call_cache()));
+        site.set_handler(&&do_cached_callc);
+        goto do_cached_callc;
+    }
+    do_cached_callc:
+        interpreter_state.flush(cache);
+        interpreter_state.execute_callc(code.get_call_cache(static_cast<uint32_t>(insn->get_second_arg())), insn->get_first_arg(), insn->is_tail_call());
+        DISPATCH();
+    do_tiered_begin:
+        INSTALL_NATIVE_CODE();
+        if (insn->get_handler() == &&do_native) {
+            goto do_native;
+        }
+        goto *tiering->record_call(static_cast<uint32_t>(insn - &code.get_instruction(0)));
+    // Loop headers of compiled functions are native entries, so a back edge taken after the installation replaces the
+    // running loop with its native code.
+    do_back_edge_jmp:
+        tiering->record_back_edge(static_cast<uint32_t>(insn - &code.get_instruction(0)));
+        INSTALL_NATIVE_CODE();
+        EXECUTE(JMP);
+    do_back_edge_cjmpz:
+        tiering->record_back_edge(static_cast<uint32_t>(insn - &code.get_instruction(0)));
+        INSTALL_NATIVE_CODE();
+        EXECUTE(CJMPZ);
+    do_back_edge_cjmpnz:
+        tiering->record_back_edge(static_cast<uint32_t>(insn - &code.get_instruction(0)));
+        INSTALL_NATIVE_CODE();
+        EXECUTE(CJMPNZ);
+    do_native:
+        interpreter_state.flush(cache);
+        if (jit->get_entry(static_cast<uint32_t>(insn - &code.get_instruction(0)))(&interpreter_state)) {
+            return;
+        }
+        DISPATCH();
+#define SUPERINSTRUCTION_LABEL(name, ...)                                                 \
+    do_##name:                                                                           \
+        execute_superinstruction<StackCaching, __VA_ARGS__>(interpreter_state, *insn, cache); \
+        DISPATCH();
+        ASSIGNMENT04_SUPERINSTRUCTIONS(SUPERINSTRUCTION_LABEL)
+#undef SUPERINSTRUCTION_LABEL
+#undef EXECUTE
+#undef INSTALL_NATIVE_CODE
+#undef DISPATCH
+    }
+
+    static void write_opcode_profile(const opcode_profile& profile, std::string_view path) {
+        constexpr static size_t REPORT_SIZE = 20;
+        profile.print(std::cerr, REPORT_SIZE);
+        std::ofstream os{std::string(path)};
+        profile.write(os);
+        if (!os) {
+            throw std::runtime_error("Failed to write opcode profile");
+        }
+    }
+
+    static void write_call_profile(call_profile& profile, std::string_view path) {
+        profile.finish();
+        std::ofstream os{std::string(path)};
+        profile.write(os);
+        if (!os) {
+            throw std::runtime_error("Failed to write call profile");
+        }
+    }
+
+    // A site that missed more often than it has callees has seen more callees than its cache holds.
+    static void log_call_caches(const program& code) {
+        size_t sites[3] = {};
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        for (const call_cache& callees : code.get_call_caches()) {
+            ++sites[callees.get_misses() > callees.get_size() ? 2 : callees.get_size() > 1 ? 1 : 0];
+            hits += callees.get_hits();
+            misses += callees.get_misses();
+        }
+        double hit_rate = hits + misses == 0 ? 0.0 : 100.0 * static_cast<double>(hits) / static_cast<double>(hits + misses);
+        std::fprintf(stderr, "Call caches: %zu monomorphic, %zu polymorphic, %zu megamorphic sites, %llu hits, %llu misses (%.2f%% hits)\n", sites[0], sites[1], sites[2],
+                     static_cast<unsigned long long>(hits), static_cast<unsigned long long>(misses), hit_rate);
+    }
+
+    // The profiler samples only while the program runs, so neither decoding nor writing this or the opcode and call
+    // profiles shows up in it.
+    template <typename Run>
+    static void run_sampled(const state& interpreter_state, const program& code, const options& opts, Run run) {
+        if (!opts.has_sample_profile()) {
+            run();
+            return;
+        }
+        sampling_profiler profiler(interpreter_state, code);
+        profiler.start(opts.get_sample_frequency());
+        run();
+        profiler.stop();
+        std::ofstream os{std::string(opts.get_sample_profile_path())};
+        profiler.write(os);
+        if (!os) {
+            throw std::runtime_error("Failed to write sample profile");
+        }
+        std::fprintf(stderr, "Samples: %llu, dropped: %llu\n", static_cast<unsigned long long>(profiler.get_samples()), static_cast<unsigned long long>(profiler.get_dropped()));
+    }
+
+    void interpret(const bytefile& file, const verification_result& verification, const options& opts) {
+        uint64_t executed = 0;
+        switch (opts.get_dispatch_mode()) {
+            case dispatch_mode::SWITCH: {
+                program code = decode(file, false);
+                state interpreter_state(file);
+                if (opts.has_precise_gc()) {
+                    interpreter_state.set_stack_maps(verification);
+                }
+                std::optional<opcode_profile> opcodes;
+                std::optional<call_profile> calls;
+                run_sampled(interpreter_state, code, opts, [&] {
+                    if (opts.has_opcode_profile()) {
+                        opcodes.emplace(file);
+                        interpret_switch(interpreter_state, code, *opcodes);
+                    } else if (opts.has_call_profile()) {
+                        calls.emplace(file, interpreter_state);
+                        interpret_switch(interpreter_state, code, *calls);
+                    } else if (opts.has_instruction_count()) {
+                        instruction_counter counter;
+                        interpret_switch(interpreter_state, code, counter);
+                        executed = counter.get_executed();
+                    } else {
+                        no_profile profile;
+                        interpret_switch(interpreter_state, code, profile);
+                    }
+                });
+                if (opcodes) {
+                    executed = opcodes->get_executed();
+                    write_opcode_profile(*opcodes, opts.get_opcode_profile_path());
+                } else if (calls) {
+                    executed = calls->get_executed();
+                    write_call_profile(*calls, opts.get_call_profile_path());
+                }
+                break;
+            }
+            case dispatch_mode::REGISTER: {
+                program code = decode(file, false);
+                register_program registers = translate_to_registers(code, verification);
+                state interpreter_state(code);
+                if (opts.has_precise_gc()) {
+                    interpreter_state.set_stack_maps(verification);
+                }
+                register_statistics statistics;
+                run_sampled(interpreter_state, code, opts, [&] {
+                    statistics = interpret_registers(interpreter_state, registers, opts.has_instruction_count());
+                });
+                executed = statistics.instructions;
+                if (opts.has_instruction_count()) {
+                    uint64_t checks = statistics.executed_checks + statistics.eliminated_checks;
+                    double eliminated = checks == 0 ? 0.0 : 100.0 * static_cast<double>(statistics.eliminated_checks) / static_cast<double>(checks);
+                    std::fprintf(stderr, "Type checks: %llu executed, %llu eliminated (%.1f%%)\n", static_cast<unsigned long long>(statistics.executed_checks),
+                                 static_cast<unsigned long long>(statistics.eliminated_checks), eliminated);
+                }
+                break;
+            }
+            case dispatch_mode::THREADED: {
+                bool is_tiered = opts.get_jit_mode() == jit_mode::TIERED && is_jit_supported();
+                program code = decode(file, opts.has_superinstructions(), !is_tiered, opts.has_match_tables());
+                state interpreter_state(code);
+                if (opts.has_precise_gc()) {
+                    interpreter_state.set_stack_maps(verification);
+                }
+                std::optional<jit_compiler> jit;
+                std::optional<tiering_manager> tiering;
+                const jit_compiler* compiled = nullptr;
+                if (is_tiered) {
+                    tiering.emplace(code, verification, opts);
+                    compiled = &tiering->get_compiler();
+                } else if (opts.get_jit_mode() == jit_mode::EAGER && is_jit_supported()) {
+                    jit.emplace(code, verification);
+                    jit->compile();
+                    compiled = &*jit;
+                }
+                tiering_manager* manager = tiering.has_value() ? &*tiering : nullptr;
+                run_sampled(interpreter_state, code, opts, [&] {
+                    if (opts.has_stack_caching()) {
+                        interpret_threaded<true>(interpreter_state, code, opts.has_quickening(), compiled, manager);
+                    } else {
+                        interpret_threaded<false>(interpreter_state, code, opts.has_quickening(), compiled, manager);
+                    }
+                });
+                if (opts.has_call_cache_log()) {
+                    log_call_caches(code);
+                }
+                break;
+            }
+        }
+        if (opts.has_instruction_count()) {
+            std::fprintf(stderr, "Executed instructions: %llu\n", static_cast<unsigned long long>(executed));
+        }
+    }
+
 }
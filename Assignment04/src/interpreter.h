@@ -1,13 +1,17 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
+#include <atomic>
 #include <cstdint>
 #include <span>
 #include <string_view>
 
 #include "bytefile.h"
+#include "decoder.h"
+#include "options.h"
 #include "runtime_interface.h"
 #include "stack.h"
+#include "verifier.h"
 
 namespace assignment_04 {
 
@@ -47,12 +51,12 @@ namespace assignment_04 {
     public:
         s_expr(from_repr, auint repr) noexcept;
 
-        s_expr(std::string_view tag, std::span<auint> elements);
+        s_expr(auint tag_hash, std::span<auint> elements);
 
         [[nodiscard]] std::string_view get_tag() const noexcept;
 
     private:
-        static auint to_s_expr(std::string_view tag, std::span<auint> elements);
+        static auint to_s_expr(auint tag_hash, std::span<auint> elements);
     };
 
     class closure {
@@ -139,15 +143,21 @@ namespace assignment_04 {
         static auint to_string(std::string_view val);
     };
 
+    // The record of a frame takes the two stack slots between its arguments and its locals, so a call only writes two
+    // words next to the values it already moves. Both words have the lowest bit set, which makes the garbage collector
+    // take them for integers. A frame is a view of its record and the values around it.
     class frame {
     public:
-        frame() noexcept;
+        constexpr static uint32_t RECORD_SIZE = 2;
 
-        frame(stack<auint> stack, uint32_t base, uint32_t locals_size, uint32_t args_size, bool is_frame_closure = false) noexcept;
+        explicit frame(auint* locals) noexcept;
+
+        frame(auint* locals, auint* prev_locals, uint32_t args_size, bool is_frame_closure) noexcept;
 
         [[nodiscard]] uint32_t get_base() const noexcept;
 
-        [[nodiscard]] uint32_t get_locals_size() const noexcept;
+        // Locals of the previous frame, null for the outermost one.
+        [[nodiscard]] auint* get_prev_locals() const noexcept;
 
         value get_local(uint32_t pos) const;
 
@@ -165,8 +175,6 @@ namespace assignment_04 {
 
         [[nodiscard]] bool is_closure() const noexcept;
 
-        void is_closure(bool is_frame_closure) noexcept;
-
         [[nodiscard]] uint32_t get_captured_vars_size() const noexcept;
 
         value get_captured_var(uint32_t pos) const;
@@ -179,33 +187,101 @@ namespace assignment_04 {
 
         void set_return_address(uint32_t return_address) noexcept;
 
+        // Lowest stack slot of the frame: its closure or its first argument.
+        [[nodiscard]] auint* get_bottom() const noexcept;
+
+        // Marks the roots among the frame's slots below the limit and clears its dead slots. Without a map every slot
+        // above the record is taken for a root.
+        void scan_roots(const stack_map* map, auint* limit) const;
+
     private:
-        stack<auint> stack_;
-        uint32_t base_;
-        uint32_t locals_size_;
-        uint32_t args_size_;
-        bool is_frame_closure_;
-        uint32_t return_address_;
+        auint* locals_;
+
+        // Return address and number of arguments.
+        [[nodiscard]] auint& get_call_word() const noexcept;
+
+        // Locals of the previous frame and the closure flag, which fits in the alignment bits of the pointer.
+        [[nodiscard]] auint& get_link_word() const noexcept;
+
+        [[nodiscard]] auint* get_args() const noexcept;
+    };
+
+    template <bool Enabled>
+    class stack_cache {
+    public:
+        stack_cache() noexcept;
+
+        [[nodiscard]] bool is_cached() const noexcept;
+
+        [[nodiscard]] value get() const noexcept;
+
+        void set(value val) noexcept;
+
+        void reset() noexcept;
+
+    private:
+        auint top_;
+        bool is_cached_;
     };
 
     class state {
     public:
         explicit state(const bytefile& file) noexcept;
 
+        explicit state(const program& code) noexcept;
+
         ~state();
 
         template <bool ValidationRequired = false>
         [[nodiscard]] bytecode pop_next_op();
 
+        [[nodiscard]] const instruction& pop_next_instruction() noexcept;
+
+        [[nodiscard]] uint32_t get_ip() const noexcept;
+
+        void set_ip(uint32_t ip) noexcept;
+
+        [[nodiscard]] const program& get_program() const noexcept;
+
+        [[nodiscard]] auint* get_locals() noexcept;
+
+        [[nodiscard]] bool has_frame() const noexcept;
+
+        // Makes the garbage collector find the roots on the stack with the verifier's stack maps.
+        void set_stack_maps(const verification_result& verification) noexcept;
+
+        void scan_roots();
+
+        // Writes the offset each frame will resume at, from the running one down, and returns how many it wrote. Safe to
+        // call from a signal handler that interrupted the interpreter.
+        size_t sample_stack(std::span<uint32_t> offsets) const noexcept;
+
         void execute_binop_high();
 
+        void execute_binop_high(bytecode op);
+
+        template <bytecode Op, bool Enabled>
+        void execute_binop(stack_cache<Enabled>& cache);
+
         void execute_low_eq();
 
+        template <bool Enabled>
+        void execute_low_eq(stack_cache<Enabled>& cache);
+
         void execute_const();
 
-        void execute_string();
+        void execute_const(int32_t constant);
+
+        template <bool Enabled>
+        void execute_const(stack_cache<Enabled>& cache, int32_t constant);
+
+        void execute_string(const instruction& decoded);
+
+        void execute_string(std::string_view string);
 
-        void execute_sexp();
+        void execute_sexp(const instruction& decoded);
+
+        void execute_sexp(auint tag_hash, int32_t elements_size);
 
         void execute_sti();
 
@@ -213,58 +289,144 @@ namespace assignment_04 {
 
         void execute_jmp();
 
+        void execute_jmp(uint32_t addr);
+
         bool execute_ret();
 
         void execute_drop();
 
+        template <bool Enabled>
+        void execute_drop(stack_cache<Enabled>& cache);
+
         void execute_dup();
 
+        template <bool Enabled>
+        void execute_dup(stack_cache<Enabled>& cache);
+
         void execute_swap();
 
         void execute_elem();
 
+        template <bool Enabled>
+        void execute_elem(stack_cache<Enabled>& cache);
+
         void execute_ld_global();
 
+        void execute_ld_global(int32_t addr);
+
+        template <bool Enabled>
+        void execute_ld_global(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_ld_local();
 
+        void execute_ld_local(int32_t addr);
+
+        template <bool Enabled>
+        void execute_ld_local(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_ld_argument();
 
+        void execute_ld_argument(int32_t addr);
+
+        template <bool Enabled>
+        void execute_ld_argument(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_ld_captured();
 
+        void execute_ld_captured(int32_t addr);
+
         void execute_lda_global();
 
+        void execute_lda_global(int32_t addr);
+
         void execute_lda_local();
 
+        void execute_lda_local(int32_t addr);
+
         void execute_lda_argument();
 
+        void execute_lda_argument(int32_t addr);
+
         void execute_lda_captured();
 
+        void execute_lda_captured(int32_t addr);
+
         void execute_st_global();
 
+        void execute_st_global(int32_t addr);
+
+        template <bool Enabled>
+        void execute_st_global(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_st_local();
 
+        void execute_st_local(int32_t addr);
+
+        template <bool Enabled>
+        void execute_st_local(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_st_argument();
 
+        void execute_st_argument(int32_t addr);
+
+        template <bool Enabled>
+        void execute_st_argument(stack_cache<Enabled>& cache, int32_t addr);
+
         void execute_st_captured();
 
+        void execute_st_captured(int32_t addr);
+
         void execute_cjmp(bool nz);
 
+        void execute_cjmp(bool nz, uint32_t addr);
+
+        template <bool Enabled>
+        void execute_cjmp(stack_cache<Enabled>& cache, bool nz, uint32_t addr);
+
         void execute_begin();
 
+        void execute_begin(int32_t args_size, int32_t locals_size);
+
         void execute_cbegin();
 
+        void execute_cbegin(int32_t args_size, int32_t locals_size);
+
         void execute_closure();
 
+        void execute_closure(int32_t addr, std::span<const capture> captures);
+
         void execute_callc();
 
+        void execute_callc(int32_t args_size);
+
+        void execute_callc(call_cache& callees, int32_t args_size, bool is_tail);
+
         void execute_call();
 
-        void execute_tag();
+        void execute_call(uint32_t addr);
+
+        void execute_tail_callc();
+
+        void execute_tail_callc(int32_t args_size);
+
+        void execute_tail_call();
+
+        void execute_tail_call(uint32_t addr, int32_t args_size);
+
+        void execute_tag(const instruction& decoded);
+
+        void execute_tag(auint tag_hash, int32_t elements_size);
 
         void execute_array();
 
+        void execute_array(int32_t elements_size);
+
+        void execute_match(const match_table& table);
+
         void execute_fail();
 
+        void execute_fail(uint32_t line_number, uint32_t column_number);
+
         void execute_line();
 
         void execute_patt_str();
@@ -291,17 +453,27 @@ namespace assignment_04 {
 
         void execute_call_barray();
 
+        void execute_call_barray(int32_t elements_size);
+
         void validate(bool condition, std::string_view message) const noexcept;
 
+        template <bool Enabled>
+        void flush(stack_cache<Enabled>& cache);
+
     private:
         uint32_t ip_;
-        std::span<frame> frames_;
+        auint* frame_locals_;
         stack<auint> stack_;
         bool is_tmp_closure_;
         const bytefile& bytefile_;
+        const program* program_;
+        const verification_result* verification_;
 
         [[nodiscard]] bytecode peek_current_op() const;
 
+        // Offset of the instruction after the one a frame is at, from the ip or a return address.
+        [[nodiscard]] uint32_t get_resume_offset(uint32_t ip) const noexcept;
+
         [[nodiscard]] bytecode peek_next_op() const;
 
         template <bool ValidationRequired = false>
@@ -310,16 +482,14 @@ namespace assignment_04 {
         template <bool ValidationRequired = false>
         [[nodiscard]] int32_t pop_next_int32();
 
-        [[nodiscard]] bool has_frame() const noexcept;
-
-        const frame& peek_frame() const;
+        [[nodiscard]] frame peek_frame() const;
 
-        frame& peek_frame();
-
-        void push_frame(const frame& frame);
+        void push_frame(uint32_t locals_size, uint32_t args_size, bool is_frame_closure);
 
         frame pop_frame();
 
+        void reuse_frame(uint32_t values_size);
+
         value peek(uint32_t offset = 0) const;
 
         void push(value val);
@@ -328,6 +498,12 @@ namespace assignment_04 {
 
         void pop(uint32_t count);
 
+        template <bool Enabled>
+        void push(stack_cache<Enabled>& cache, value val);
+
+        template <bool Enabled>
+        value pop(stack_cache<Enabled>& cache);
+
         [[nodiscard]] uint32_t get_globals_size() const noexcept;
 
         value get_global(uint32_t pos) const;
@@ -335,9 +511,42 @@ namespace assignment_04 {
         value get_global_reference(uint32_t pos) const;
 
         void set_global(uint32_t pos, value global);
+
+        value get_capture(varspec capture_type, int32_t capture_addr, const frame& current_frame) const;
+
+        void make_closure(int32_t captured_size);
     };
 
-    void interpret(const bytefile& file);
+    void execute_instruction(state& interpreter_state, const instruction& insn);
+
+    void interpret(const bytefile& file, const verification_result& verification, const options& opts = options{});
+
+    template <bool Enabled>
+    stack_cache<Enabled>::stack_cache() noexcept
+        : top_(0)
+        , is_cached_(false) {
+    }
+
+    template <bool Enabled>
+    inline bool stack_cache<Enabled>::is_cached() const noexcept {
+        return Enabled && is_cached_;
+    }
+
+    template <bool Enabled>
+    inline value stack_cache<Enabled>::get() const noexcept {
+        return value{from_repr_t, top_};
+    }
+
+    template <bool Enabled>
+    inline void stack_cache<Enabled>::set(value val) noexcept {
+        top_ = val.get_repr();
+        is_cached_ = true;
+    }
+
+    template <bool Enabled>
+    inline void stack_cache<Enabled>::reset() noexcept {
+        is_cached_ = false;
+    }
 
     inline auint aggregate::get_repr() const noexcept {
         return repr_;
@@ -399,32 +608,49 @@ namespace assignment_04 {
         return closure{from_repr_t, repr_};
     }
 
+    inline frame::frame(auint* locals) noexcept
+        : locals_(locals) {
+    }
+
     inline uint32_t frame::get_base() const noexcept {
-        return base_;
+        return static_cast<uint32_t>(locals_ - stack_buf.data());
     }
 
-    inline uint32_t frame::get_locals_size() const noexcept {
-        return locals_size_;
+    inline auint* frame::get_prev_locals() const noexcept {
+        return reinterpret_cast<auint*>(get_link_word() & ~static_cast<auint>(3));
     }
 
     inline uint32_t frame::get_args_size() const noexcept {
-        return args_size_;
+        return static_cast<uint32_t>(get_call_word()) >> 1;
     }
 
     inline bool frame::is_closure() const noexcept {
-        return is_frame_closure_;
-    }
-
-    inline void frame::is_closure(bool is_frame_closure) noexcept {
-        is_frame_closure_ = is_frame_closure;
+        return (get_link_word() & 2) != 0;
     }
 
     inline uint32_t frame::get_return_address() const noexcept {
-        return return_address_;
+        return static_cast<uint32_t>(get_call_word() >> 32);
     }
 
     inline void frame::set_return_address(uint32_t return_address) noexcept {
-        return_address_ = return_address;
+        auint& call_word = get_call_word();
+        call_word = (static_cast<auint>(return_address) << 32) | static_cast<uint32_t>(call_word);
+    }
+
+    inline auint* frame::get_bottom() const noexcept {
+        return get_args() - (is_closure() ? 1 : 0);
+    }
+
+    inline auint& frame::get_call_word() const noexcept {
+        return locals_[-2];
+    }
+
+    inline auint& frame::get_link_word() const noexcept {
+        return locals_[-1];
+    }
+
+    inline auint* frame::get_args() const noexcept {
+        return locals_ - RECORD_SIZE - get_args_size();
     }
 
     template <bool ValidationRequired>
@@ -454,8 +680,29 @@ namespace assignment_04 {
         return bytefile_.get_int32(ip_ - sizeof(int32_t));
     }
 
+    inline const instruction& state::pop_next_instruction() noexcept {
+        return program_->get_instruction(ip_++);
+    }
+
+    inline uint32_t state::get_ip() const noexcept {
+        return ip_;
+    }
+
+    inline void state::set_ip(uint32_t ip) noexcept {
+        std::atomic_signal_fence(std::memory_order_release);
+        ip_ = ip;
+    }
+
+    inline const program& state::get_program() const noexcept {
+        return *program_;
+    }
+
+    inline auint* state::get_locals() noexcept {
+        return frame_locals_;
+    }
+
     inline bool state::has_frame() const noexcept {
-        return !frames_.empty();
+        return frame_locals_ != nullptr;
     }
 
     inline uint32_t state::get_globals_size() const noexcept {
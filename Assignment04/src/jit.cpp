@@ -0,0 +1,698 @@
+#include "jit.h"
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "interpreter.h"
+#include "runtime_interface.h"
+#include "stack.h"
+
+namespace assignment_04 {
+
+    static void jit_execute(state* interpreter_state, uint32_t index) {
+        interpreter_state->set_ip(index + 1);
+        execute_instruction(*interpreter_state, interpreter_state->get_program().get_instruction(index));
+    }
+
+    static bool jit_ret(state* interpreter_state, uint32_t index) {
+        interpreter_state->set_ip(index + 1);
+        return interpreter_state->execute_ret();
+    }
+
+    static void jit_sexp(state* interpreter_state, uint32_t index, auint tag_hash) {
+        interpreter_state->set_ip(index + 1);
+        interpreter_state->execute_sexp(tag_hash, interpreter_state->get_program().get_instruction(index).get_second_arg());
+    }
+
+    static void jit_tag(state* interpreter_state, uint32_t index, auint tag_hash) {
+        interpreter_state->set_ip(index + 1);
+        interpreter_state->execute_tag(tag_hash, interpreter_state->get_program().get_instruction(index).get_second_arg());
+    }
+
+    enum class call_result : uint32_t {
+        LEAVE,
+        CONTINUE,
+        STOP
+    };
+
+    // Native callees are run on the machine stack, so the nesting is bounded; deeper calls go through the dispatch loop.
+    constexpr static uint32_t MAX_NATIVE_CALL_DEPTH = 4096;
+
+    static uint32_t native_call_depth = 0;
+
+    static call_result jit_call(state* interpreter_state, uint32_t index, const jit_compiler* compiler) {
+        interpreter_state->set_ip(index + 1);
+        execute_instruction(*interpreter_state, interpreter_state->get_program().get_instruction(index));
+        native_code callee = compiler->get_entry(interpreter_state->get_ip());
+        if (callee == nullptr || native_call_depth == MAX_NATIVE_CALL_DEPTH) {
+            return call_result::LEAVE;
+        }
+        ++native_call_depth;
+        bool is_finished = callee(interpreter_state);
+        --native_call_depth;
+        if (is_finished) {
+            return call_result::STOP;
+        }
+        // The callee leaves native code early when it calls something that is not compiled, in which case the rest of
+        // the call chain is resumed by the dispatch loop.
+        return interpreter_state->get_ip() == index + 1 ? call_result::CONTINUE : call_result::LEAVE;
+    }
+
+    static auint* jit_get_locals(state* interpreter_state) {
+        return interpreter_state->get_locals();
+    }
+
+    void assembler::truncate(size_t size) noexcept {
+        code_.resize(size);
+    }
+
+    void assembler::emit(std::initializer_list<uint8_t> bytes) {
+        code_.insert(code_.end(), bytes.begin(), bytes.end());
+    }
+
+    void assembler::push(reg src) {
+        if (static_cast<uint8_t>(src) >= 8) {
+            code_.push_back(0x41);
+        }
+        code_.push_back(0x50 | (static_cast<uint8_t>(src) & 7));
+    }
+
+    void assembler::pop(reg dst) {
+        if (static_cast<uint8_t>(dst) >= 8) {
+            code_.push_back(0x41);
+        }
+        code_.push_back(0x58 | (static_cast<uint8_t>(dst) & 7));
+    }
+
+    void assembler::ret() {
+        code_.push_back(0xC3);
+    }
+
+    void assembler::mov(reg dst, reg src) {
+        emit_rex(src, dst);
+        code_.push_back(0x89);
+        code_.push_back(0xC0 | ((static_cast<uint8_t>(src) & 7) << 3) | (static_cast<uint8_t>(dst) & 7));
+    }
+
+    void assembler::mov(reg dst, uint64_t imm) {
+        emit_rex(reg::RAX, dst);
+        code_.push_back(0xB8 | (static_cast<uint8_t>(dst) & 7));
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            code_.push_back(static_cast<uint8_t>(imm >> (8 * i)));
+        }
+    }
+
+    void assembler::mov32(reg dst, uint32_t imm) {
+        if (static_cast<uint8_t>(dst) >= 8) {
+            code_.push_back(0x41);
+        }
+        code_.push_back(0xB8 | (static_cast<uint8_t>(dst) & 7));
+        emit_int32(static_cast<int32_t>(imm));
+    }
+
+    void assembler::load(reg dst, reg base, int32_t disp) {
+        emit_mem(0x8B, dst, base, disp);
+    }
+
+    void assembler::store(reg base, int32_t disp, reg src) {
+        emit_mem(0x89, src, base, disp);
+    }
+
+    void assembler::store(reg base, int32_t disp, int32_t imm) {
+        emit_mem(0xC7, reg::RAX, base, disp);
+        emit_int32(imm);
+    }
+
+    void assembler::add(reg dst, int32_t imm) {
+        emit_rex(reg::RAX, dst);
+        code_.push_back(0x81);
+        code_.push_back(0xC0 | (static_cast<uint8_t>(dst) & 7));
+        emit_int32(imm);
+    }
+
+    void assembler::sub(reg dst, int32_t imm) {
+        emit_rex(reg::RAX, dst);
+        code_.push_back(0x81);
+        code_.push_back(0xE8 | (static_cast<uint8_t>(dst) & 7));
+        emit_int32(imm);
+    }
+
+    void assembler::call(const void* target) {
+        mov(reg::RAX, reinterpret_cast<uint64_t>(target));
+        emit({0xFF, 0xD0});
+    }
+
+    size_t assembler::jmp() {
+        code_.push_back(0xE9);
+        emit_int32(0);
+        return code_.size() - sizeof(int32_t);
+    }
+
+    size_t assembler::jcc(condition cond) {
+        code_.push_back(0x0F);
+        code_.push_back(0x80 | static_cast<uint8_t>(cond));
+        emit_int32(0);
+        return code_.size() - sizeof(int32_t);
+    }
+
+    void assembler::jmp(size_t target) {
+        patch(jmp(), target);
+    }
+
+    void assembler::patch(size_t pos, size_t target) noexcept {
+        int32_t rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(pos + sizeof(int32_t)));
+        std::memcpy(code_.data() + pos, &rel, sizeof(int32_t));
+    }
+
+    void assembler::emit_rex(reg r, reg b) {
+        code_.push_back(0x48 | ((static_cast<uint8_t>(r) >> 3) << 2) | (static_cast<uint8_t>(b) >> 3));
+    }
+
+    void assembler::emit_mem(uint8_t op, reg r, reg base, int32_t disp) {
+        bool is_short = disp >= std::numeric_limits<int8_t>::min() && disp <= std::numeric_limits<int8_t>::max();
+        emit_rex(r, base);
+        code_.push_back(op);
+        code_.push_back((is_short ? 0x40 : 0x80) | ((static_cast<uint8_t>(r) & 7) << 3) | (static_cast<uint8_t>(base) & 7));
+        if ((static_cast<uint8_t>(base) & 7) == static_cast<uint8_t>(reg::RSP)) {
+            code_.push_back(0x24);
+        }
+        if (is_short) {
+            code_.push_back(static_cast<uint8_t>(disp));
+        } else {
+            emit_int32(disp);
+        }
+    }
+
+    void assembler::emit_int32(int32_t val) {
+        for (size_t i = 0; i < sizeof(int32_t); ++i) {
+            code_.push_back(static_cast<uint8_t>(static_cast<uint32_t>(val) >> (8 * i)));
+        }
+    }
+
+    code_buffer::code_buffer() noexcept
+        : data_(nullptr)
+        , size_(0) {
+    }
+
+    code_buffer::code_buffer(std::span<const uint8_t> code)
+        : data_(nullptr)
+        , size_(0) {
+        if (code.empty()) {
+            return;
+        }
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t size = (code.size() + page_size - 1) / page_size * page_size;
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Failed to allocate memory for native code");
+        }
+        std::memcpy(data, code.data(), code.size());
+        if (mprotect(data, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(data, size);
+            throw std::runtime_error("Failed to make native code executable");
+        }
+        data_ = data;
+        size_ = size;
+    }
+
+    code_buffer::code_buffer(code_buffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr))
+        , size_(std::exchange(other.size_, 0)) {
+    }
+
+    code_buffer& code_buffer::operator=(code_buffer&& rhs) noexcept {
+        if (this != &rhs) {
+            if (data_ != nullptr) {
+                munmap(data_, size_);
+            }
+            data_ = std::exchange(rhs.data_, nullptr);
+            size_ = std::exchange(rhs.size_, 0);
+        }
+        return *this;
+    }
+
+    code_buffer::~code_buffer() {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    jit_compiler::jit_compiler(const program& code, const verification_result& verification)
+        : entries_(code.get_size())
+        , function_ends_(code.get_size(), program::NO_INDEX)
+        , compiled_functions_size_(0)
+        , program_(code)
+        , verification_(verification) {
+        uint32_t begin = program::NO_INDEX;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            bytecode op = program_.get_instruction(i).get_op();
+            if (op == bytecode::BEGIN || op == bytecode::CBEGIN) {
+                if (begin != program::NO_INDEX) {
+                    function_ends_[begin] = i;
+                }
+                begin = i;
+            }
+        }
+        if (begin != program::NO_INDEX) {
+            function_ends_[begin] = program_.get_size();
+        }
+    }
+
+    void jit_compiler::compile() {
+        if (!is_jit_supported()) {
+            return;
+        }
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (function_ends_[i] != program::NO_INDEX && compile_function(i, function_ends_[i])) {
+                ++compiled_functions_size_;
+            }
+        }
+        publish();
+    }
+
+    bool jit_compiler::compile(uint32_t begin) {
+        if (!is_jit_supported() || function_ends_[begin] == program::NO_INDEX || !compile_function(begin, function_ends_[begin])) {
+            return false;
+        }
+        ++compiled_functions_size_;
+        publish();
+        return true;
+    }
+
+    void jit_compiler::publish() {
+        if (pending_entries_.empty()) {
+            return;
+        }
+        const code_buffer& buffer = buffers_.emplace_back(assembler_.get_code());
+        for (auto [index, offset] : pending_entries_) {
+            entries_[index].store(reinterpret_cast<native_code>(const_cast<uint8_t*>(buffer.get_data() + offset)), std::memory_order_release);
+        }
+        pending_entries_.clear();
+        assembler_.truncate(0);
+    }
+
+    bool jit_compiler::compile_function(uint32_t begin, uint32_t end) {
+        size_t start = assembler_.get_size();
+        labels_.assign(end - begin, 0);
+        fixups_.clear();
+        size_t epilogue = assembler_.get_size();
+        assembler_.pop(reg::R15);
+        assembler_.pop(reg::R14);
+        assembler_.pop(reg::R13);
+        assembler_.pop(reg::R12);
+        assembler_.pop(reg::RBX);
+        assembler_.ret();
+        for (uint32_t i = begin; i < end; ++i) {
+            labels_[i - begin] = assembler_.get_size();
+            if (!compile_instruction(i, begin, end, epilogue)) {
+                assembler_.truncate(start);
+                return false;
+            }
+        }
+        for (auto [pos, target] : fixups_) {
+            assembler_.patch(pos, labels_[target - begin]);
+        }
+        std::vector<bool> has_entry(end - begin);
+        compile_entry(begin, begin, verification_result::NO_DEPTH);
+        has_entry[0] = true;
+        for (uint32_t i = begin; i < end; ++i) {
+            const instruction& insn = program_.get_instruction(i);
+            if ((insn.get_op() == bytecode::CALL || insn.get_op() == bytecode::CALLC) && i + 1 < end) {
+                compile_entry(i + 1, begin, verification_result::NO_DEPTH);
+                has_entry[i + 1 - begin] = true;
+            } else if (is_back_edge(insn, i) && insn.get_target() >= begin && !has_entry[insn.get_target() - begin]) {
+                // Loop headers are entered from the interpreter when a running loop is replaced on the stack.
+                int32_t stack_depth = verification_.get_stack_depth(program_.get_offset(insn.get_target()));
+                if (stack_depth != verification_result::NO_DEPTH) {
+                    compile_entry(insn.get_target(), begin, stack_depth);
+                    has_entry[insn.get_target() - begin] = true;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool jit_compiler::compile_instruction(uint32_t index, uint32_t begin, uint32_t end, size_t epilogue) {
+        const instruction& insn = program_.get_instruction(index);
+        bytecode op = insn.get_op();
+        int64_t disp = static_cast<int64_t>(insn.get_first_arg()) * static_cast<int64_t>(sizeof(auint));
+        bool has_disp = disp >= 0 && disp <= std::numeric_limits<int32_t>::max();
+        switch (op) {
+            case bytecode::LOW_ADD:
+            case bytecode::LOW_SUB:
+            case bytecode::LOW_MUL:
+            case bytecode::LOW_DIV:
+            case bytecode::LOW_MOD:
+            case bytecode::LOW_LT:
+            case bytecode::LOW_LE:
+            case bytecode::LOW_GT:
+            case bytecode::LOW_GE:
+            case bytecode::LOW_EQ:
+            case bytecode::LOW_NE:
+            case bytecode::LOW_AND:
+            case bytecode::LOW_OR:
+                compile_binop(index, op);
+                return true;
+            case bytecode::CONST: {
+                int64_t boxed = static_cast<int64_t>(insn.get_first_arg()) * 2 + 1;
+                if (boxed >= std::numeric_limits<int32_t>::min() && boxed <= std::numeric_limits<int32_t>::max()) {
+                    assembler_.store(reg::R12, 0, static_cast<int32_t>(boxed));
+                } else {
+                    assembler_.mov(reg::RAX, static_cast<uint64_t>(boxed));
+                    assembler_.store(reg::R12, 0, reg::RAX);
+                }
+                assembler_.add(reg::R12, sizeof(auint));
+                return true;
+            }
+            case bytecode::LD_GLOBAL:
+            case bytecode::LD_LOCAL:
+            case bytecode::LD_ARGUMENT:
+                if (!has_disp) {
+                    return false;
+                }
+                assembler_.load(reg::RAX, op == bytecode::LD_GLOBAL ? reg::R15 : op == bytecode::LD_LOCAL ? reg::R13 : reg::R14, static_cast<int32_t>(disp));
+                assembler_.store(reg::R12, 0, reg::RAX);
+                assembler_.add(reg::R12, sizeof(auint));
+                return true;
+            case bytecode::ST_GLOBAL:
+            case bytecode::ST_LOCAL:
+            case bytecode::ST_ARGUMENT:
+                if (!has_disp) {
+                    return false;
+                }
+                assembler_.load(reg::RAX, reg::R12, -static_cast<int32_t>(sizeof(auint)));
+                assembler_.store(op == bytecode::ST_GLOBAL ? reg::R15 : op == bytecode::ST_LOCAL ? reg::R13 : reg::R14, static_cast<int32_t>(disp), reg::RAX);
+                return true;
+            case bytecode::DROP:
+                assembler_.sub(reg::R12, sizeof(auint));
+                return true;
+            case bytecode::DUP:
+                assembler_.load(reg::RAX, reg::R12, -static_cast<int32_t>(sizeof(auint)));
+                assembler_.store(reg::R12, 0, reg::RAX);
+                assembler_.add(reg::R12, sizeof(auint));
+                return true;
+            case bytecode::SWAP:
+            case bytecode::LINE:
+                // SWAP pushes the popped values back in their original order in the interpreter, so it leaves the stack
+                // as it is.
+                return true;
+            case bytecode::JMP:
+                if (insn.get_target() < begin || insn.get_target() >= end) {
+                    return false;
+                }
+                fixups_.emplace_back(assembler_.jmp(), insn.get_target());
+                return true;
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ: {
+                if (insn.get_target() < begin || insn.get_target() >= end) {
+                    return false;
+                }
+                assembler_.load(reg::RAX, reg::R12, -static_cast<int32_t>(sizeof(auint)));
+                assembler_.emit({0xA8, 0x01}); // test al, 1
+                size_t slow_path = assembler_.jcc(condition::E);
+                assembler_.sub(reg::R12, sizeof(auint));
+                assembler_.emit({0x48, 0xD1, 0xF8}); // sar rax, 1
+                assembler_.emit({0x83, 0xF8, static_cast<uint8_t>(op == bytecode::CJMPNZ)}); // cmp eax, nz
+                fixups_.emplace_back(assembler_.jcc(condition::E), insn.get_target());
+                size_t done = assembler_.jmp();
+                assembler_.patch(slow_path, assembler_.get_size());
+                compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+                assembler_.patch(done, assembler_.get_size());
+                return true;
+            }
+            case bytecode::BEGIN:
+            case bytecode::CBEGIN:
+                // The locals of the new frame start right above its record, which goes on the current top of the stack.
+                assembler_.mov(reg::R13, reg::R12);
+                assembler_.add(reg::R13, static_cast<int32_t>(frame::RECORD_SIZE * sizeof(auint)));
+                compile_args_load(begin);
+                compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+                return true;
+            case bytecode::CALL:
+            case bytecode::CALLC:
+                // A tail call does not come back here, so the callee is left to the dispatch loop rather than nested on
+                // the machine stack.
+                if (index + 1 == end || insn.is_tail_call()) {
+                    compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+                    assembler_.mov32(reg::RAX, 0);
+                    assembler_.jmp(epilogue);
+                    return true;
+                }
+                compile_helper_call(reinterpret_cast<const void*>(&jit_call), index, reinterpret_cast<uint64_t>(this));
+                assembler_.emit({0x83, 0xF8, static_cast<uint8_t>(call_result::CONTINUE)}); // cmp eax, CONTINUE
+                fixups_.emplace_back(assembler_.jcc(condition::E), index + 1);
+                assembler_.emit({0xD1, 0xE8}); // shr eax, 1
+                assembler_.jmp(epilogue);
+                return true;
+            case bytecode::END:
+            case bytecode::RET:
+                compile_stack_sync();
+                assembler_.mov(reg::RDI, reg::RBX);
+                assembler_.mov32(reg::RSI, index);
+                assembler_.call(reinterpret_cast<const void*>(&jit_ret));
+                assembler_.jmp(epilogue);
+                return true;
+            case bytecode::FAIL:
+                compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+                assembler_.mov32(reg::RAX, 1);
+                assembler_.jmp(epilogue);
+                return true;
+            case bytecode::STOP:
+                compile_stack_sync();
+                assembler_.mov32(reg::RAX, 1);
+                assembler_.jmp(epilogue);
+                return true;
+            case bytecode::ELEM:
+                compile_elem(index);
+                return true;
+            case bytecode::SEXP:
+            case bytecode::TAG:
+                compile_helper_call(reinterpret_cast<const void*>(op == bytecode::SEXP ? &jit_sexp : &jit_tag), index, insn.get_tag_hash());
+                return true;
+            case bytecode::STRING:
+            case bytecode::STI:
+            case bytecode::STA:
+            case bytecode::LD_CAPTURED:
+            case bytecode::LDA_GLOBAL:
+            case bytecode::LDA_LOCAL:
+            case bytecode::LDA_ARGUMENT:
+            case bytecode::LDA_CAPTURED:
+            case bytecode::ST_CAPTURED:
+            case bytecode::CLOSURE:
+            case bytecode::ARRAY:
+            case bytecode::PATT_STR:
+            case bytecode::PATT_STRING:
+            case bytecode::PATT_ARRAY:
+            case bytecode::PATT_SEXP:
+            case bytecode::PATT_REF:
+            case bytecode::PATT_VAL:
+            case bytecode::PATT_FUN:
+            case bytecode::CALL_LREAD:
+            case bytecode::CALL_LWRITE:
+            case bytecode::CALL_LLENGTH:
+            case bytecode::CALL_LSTRING:
+            case bytecode::CALL_BARRAY:
+                compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Operands the verifier has proven to be integers are not tested, and then only a zero divisor needs the interpreter.
+    void jit_compiler::compile_binop(uint32_t index, bytecode op) {
+        uint32_t offset = program_.get_offset(index);
+        bool is_proven = verification_.get_operand_type(offset, 0) == inferred_type::INT && verification_.get_operand_type(offset, 1) == inferred_type::INT;
+        assembler_.load(reg::RAX, reg::R12, -2 * static_cast<int32_t>(sizeof(auint)));
+        assembler_.load(reg::RCX, reg::R12, -static_cast<int32_t>(sizeof(auint)));
+        size_t slow_path = 0;
+        if (!is_proven) {
+            assembler_.emit({0x89, 0xC2}); // mov edx, eax
+            assembler_.emit({0x21, 0xCA}); // and edx, ecx
+            assembler_.emit({0xF6, 0xC2, 0x01}); // test dl, 1
+            slow_path = assembler_.jcc(condition::E);
+        }
+        size_t zero_divisor = 0;
+        assembler_.emit({0x48, 0xD1, 0xF8}); // sar rax, 1
+        assembler_.emit({0x48, 0xD1, 0xF9}); // sar rcx, 1
+        switch (op) {
+            case bytecode::LOW_ADD:
+                assembler_.emit({0x01, 0xC8}); // add eax, ecx
+                break;
+            case bytecode::LOW_SUB:
+                assembler_.emit({0x29, 0xC8}); // sub eax, ecx
+                break;
+            case bytecode::LOW_MUL:
+                assembler_.emit({0x0F, 0xAF, 0xC1}); // imul eax, ecx
+                break;
+            case bytecode::LOW_DIV:
+            case bytecode::LOW_MOD:
+                assembler_.emit({0x85, 0xC9}); // test ecx, ecx
+                zero_divisor = assembler_.jcc(condition::E);
+                assembler_.emit({0x48, 0x63, 0xC0}); // movsxd rax, eax
+                assembler_.emit({0x48, 0x63, 0xC9}); // movsxd rcx, ecx
+                assembler_.emit({0x48, 0x99}); // cqo
+                assembler_.emit({0x48, 0xF7, 0xF9}); // idiv rcx
+                if (op == bytecode::LOW_MOD) {
+                    assembler_.emit({0x89, 0xD0}); // mov eax, edx
+                }
+                break;
+            case bytecode::LOW_AND:
+            case bytecode::LOW_OR:
+                assembler_.emit({0x85, 0xC0}); // test eax, eax
+                assembler_.emit({0x0F, 0x95, 0xC0}); // setne al
+                assembler_.emit({0x85, 0xC9}); // test ecx, ecx
+                assembler_.emit({0x0F, 0x95, 0xC1}); // setne cl
+                assembler_.emit({static_cast<uint8_t>(op == bytecode::LOW_AND ? 0x20 : 0x08), 0xC8}); // and/or al, cl
+                assembler_.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+                break;
+            default: {
+                condition cond = condition::E;
+                switch (op) {
+                    case bytecode::LOW_LT:
+                        cond = condition::L;
+                        break;
+                    case bytecode::LOW_LE:
+                        cond = condition::LE;
+                        break;
+                    case bytecode::LOW_GT:
+                        cond = condition::G;
+                        break;
+                    case bytecode::LOW_GE:
+                        cond = condition::GE;
+                        break;
+                    case bytecode::LOW_NE:
+                        cond = condition::NE;
+                        break;
+                    default:
+                        break;
+                }
+                assembler_.emit({0x39, 0xC8}); // cmp eax, ecx
+                assembler_.emit({0x0F, static_cast<uint8_t>(0x90 | static_cast<uint8_t>(cond)), 0xC0}); // setcc al
+                assembler_.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+                break;
+            }
+        }
+        assembler_.emit({0x48, 0x63, 0xC0}); // movsxd rax, eax
+        assembler_.emit({0x48, 0x8D, 0x44, 0x00, 0x01}); // lea rax, [rax + rax + 1]
+        assembler_.store(reg::R12, -2 * static_cast<int32_t>(sizeof(auint)), reg::RAX);
+        assembler_.sub(reg::R12, sizeof(auint));
+        if (slow_path == 0 && zero_divisor == 0) {
+            return;
+        }
+        size_t done = assembler_.jmp();
+        if (slow_path != 0) {
+            assembler_.patch(slow_path, assembler_.get_size());
+        }
+        if (zero_divisor != 0) {
+            assembler_.patch(zero_divisor, assembler_.get_size());
+        }
+        compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+        assembler_.patch(done, assembler_.get_size());
+    }
+
+    // Arrays and S-expressions are read in place; strings and all the failing cases are left to the interpreter.
+    void jit_compiler::compile_elem(uint32_t index) {
+        assembler_.load(reg::RCX, reg::R12, -static_cast<int32_t>(sizeof(auint)));
+        assembler_.emit({0xF6, 0xC1, 0x01}); // test cl, 1
+        size_t boxed_index = assembler_.jcc(condition::E);
+        assembler_.load(reg::RAX, reg::R12, -2 * static_cast<int32_t>(sizeof(auint)));
+        assembler_.emit({0xA8, 0x01}); // test al, 1
+        size_t unboxed_aggregate = assembler_.jcc(condition::NE);
+        assembler_.load(reg::RDX, reg::RAX, -static_cast<int32_t>(sizeof(data)));
+        assembler_.emit({0x48, 0xD1, 0xF9}); // sar rcx, 1
+        assembler_.emit({0x48, 0x63, 0xC9}); // movsxd rcx, ecx
+        assembler_.emit({0x41, 0x89, 0xD0}); // mov r8d, edx
+        assembler_.emit({0x41, 0x83, 0xE0, 0x07}); // and r8d, 7
+        assembler_.emit({0x41, 0x83, 0xF8, ARRAY_TAG}); // cmp r8d, ARRAY_TAG
+        size_t is_array = assembler_.jcc(condition::E);
+        assembler_.emit({0x41, 0x83, 0xF8, SEXP_TAG}); // cmp r8d, SEXP_TAG
+        size_t not_s_expr = assembler_.jcc(condition::NE);
+        assembler_.emit({0x48, 0x83, 0xC0, static_cast<uint8_t>(offsetof(sexp, contents) - sizeof(data))}); // add rax, tag size
+        assembler_.patch(is_array, assembler_.get_size());
+        assembler_.emit({0x48, 0xC1, 0xEA, 0x03}); // shr rdx, 3
+        assembler_.emit({0x48, 0x39, 0xD1}); // cmp rcx, rdx
+        size_t out_of_bounds = assembler_.jcc(condition::AE);
+        assembler_.emit({0x48, 0x8B, 0x04, 0xC8}); // mov rax, [rax + rcx * 8]
+        assembler_.store(reg::R12, -2 * static_cast<int32_t>(sizeof(auint)), reg::RAX);
+        assembler_.sub(reg::R12, sizeof(auint));
+        size_t done = assembler_.jmp();
+        for (size_t slow_path : {boxed_index, unboxed_aggregate, not_s_expr, out_of_bounds}) {
+            assembler_.patch(slow_path, assembler_.get_size());
+        }
+        compile_helper_call(reinterpret_cast<const void*>(&jit_execute), index);
+        assembler_.patch(done, assembler_.get_size());
+    }
+
+    // The entry rebuilds the frame registers from the interpreter's state. Loop headers take the height of the operand
+    // stack from the verifier instead of the runtime, as it is the same at every iteration.
+    void jit_compiler::compile_entry(uint32_t index, uint32_t begin, int32_t stack_depth) {
+        pending_entries_.emplace_back(index, assembler_.get_size());
+        entry_indices_.push_back(index);
+        assembler_.push(reg::RBX);
+        assembler_.push(reg::R12);
+        assembler_.push(reg::R13);
+        assembler_.push(reg::R14);
+        assembler_.push(reg::R15);
+        assembler_.mov(reg::RBX, reg::RDI);
+        assembler_.mov(reg::R15, reinterpret_cast<uint64_t>(stack_buf.data()));
+        bytecode op = program_.get_instruction(index).get_op();
+        if (op != bytecode::BEGIN && op != bytecode::CBEGIN) {
+            assembler_.mov(reg::RDI, reg::RBX);
+            assembler_.call(reinterpret_cast<const void*>(&jit_get_locals));
+            assembler_.mov(reg::R13, reg::RAX);
+            compile_args_load(begin);
+        }
+        if (stack_depth == verification_result::NO_DEPTH) {
+            compile_stack_reload();
+        } else {
+            int32_t locals_size = program_.get_instruction(begin).get_second_arg() & 0xFFFF;
+            assembler_.mov(reg::R12, reg::R13);
+            assembler_.add(reg::R12, (locals_size + stack_depth) * static_cast<int32_t>(sizeof(auint)));
+        }
+        assembler_.jmp(labels_[index - begin]);
+    }
+
+    void jit_compiler::compile_helper_call(const void* helper, uint32_t index) {
+        compile_stack_sync();
+        assembler_.mov(reg::RDI, reg::RBX);
+        assembler_.mov32(reg::RSI, index);
+        assembler_.call(helper);
+        compile_stack_reload();
+    }
+
+    void jit_compiler::compile_helper_call(const void* helper, uint32_t index, uint64_t arg) {
+        assembler_.mov(reg::RDX, arg);
+        compile_helper_call(helper, index);
+    }
+
+    void jit_compiler::compile_args_load(uint32_t begin) {
+        assembler_.mov(reg::R14, reg::R13);
+        assembler_.sub(reg::R14, (program_.get_instruction(begin).get_first_arg() + static_cast<int32_t>(frame::RECORD_SIZE)) * static_cast<int32_t>(sizeof(auint)));
+    }
+
+    void jit_compiler::compile_stack_sync() {
+        assembler_.mov(reg::RCX, reinterpret_cast<uint64_t>(&__gc_stack_bottom));
+        assembler_.store(reg::RCX, 0, reg::R12);
+    }
+
+    void jit_compiler::compile_stack_reload() {
+        assembler_.mov(reg::RCX, reinterpret_cast<uint64_t>(&__gc_stack_bottom));
+        assembler_.load(reg::R12, reg::RCX, 0);
+    }
+
+    bool is_jit_supported() noexcept {
+#if defined(__x86_64__) && defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+}
@@ -0,0 +1,213 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "decoder.h"
+#include "verifier.h"
+
+namespace assignment_04 {
+
+    class state;
+
+    // Native code is entered at a function's BEGIN/CBEGIN or right after a call made from native code. Calls to other
+    // compiled functions stay in native code; anything else gives control back to the dispatch loop, and the function
+    // returns true once the program ends.
+    using native_code = bool (*)(state*);
+
+    enum class reg : uint8_t {
+        RAX = 0,
+        RCX = 1,
+        RDX = 2,
+        RBX = 3,
+        RSP = 4,
+        RBP = 5,
+        RSI = 6,
+        RDI = 7,
+        R8 = 8,
+        R9 = 9,
+        R10 = 10,
+        R11 = 11,
+        R12 = 12,
+        R13 = 13,
+        R14 = 14,
+        R15 = 15
+    };
+
+    enum class condition : uint8_t {
+        AE = 0x3,
+        E = 0x4,
+        NE = 0x5,
+        L = 0xC,
+        GE = 0xD,
+        LE = 0xE,
+        G = 0xF
+    };
+
+    class assembler {
+    public:
+        assembler() = default;
+
+        [[nodiscard]] size_t get_size() const noexcept;
+
+        [[nodiscard]] std::span<const uint8_t> get_code() const noexcept;
+
+        void truncate(size_t size) noexcept;
+
+        void emit(std::initializer_list<uint8_t> bytes);
+
+        void push(reg src);
+
+        void pop(reg dst);
+
+        void ret();
+
+        void mov(reg dst, reg src);
+
+        void mov(reg dst, uint64_t imm);
+
+        void mov32(reg dst, uint32_t imm);
+
+        void load(reg dst, reg base, int32_t disp);
+
+        void store(reg base, int32_t disp, reg src);
+
+        void store(reg base, int32_t disp, int32_t imm);
+
+        void add(reg dst, int32_t imm);
+
+        void sub(reg dst, int32_t imm);
+
+        void call(const void* target);
+
+        size_t jmp();
+
+        size_t jcc(condition cond);
+
+        void jmp(size_t target);
+
+        void patch(size_t pos, size_t target) noexcept;
+
+    private:
+        std::vector<uint8_t> code_;
+
+        void emit_rex(reg r, reg b);
+
+        void emit_mem(uint8_t op, reg r, reg base, int32_t disp);
+
+        void emit_int32(int32_t val);
+    };
+
+    class code_buffer {
+    public:
+        code_buffer() noexcept;
+
+        explicit code_buffer(std::span<const uint8_t> code);
+
+        code_buffer(const code_buffer& other) = delete;
+
+        code_buffer(code_buffer&& other) noexcept;
+
+        code_buffer& operator=(const code_buffer& rhs) = delete;
+
+        code_buffer& operator=(code_buffer&& rhs) noexcept;
+
+        ~code_buffer();
+
+        [[nodiscard]] const uint8_t* get_data() const noexcept;
+
+    private:
+        void* data_;
+        size_t size_;
+    };
+
+    // Functions are compiled either all at once or one by one. Entries are published atomically once the code is ready,
+    // so they can be looked up while another thread compiles more functions.
+    class jit_compiler {
+    public:
+        jit_compiler(const program& code, const verification_result& verification);
+
+        void compile();
+
+        bool compile(uint32_t begin);
+
+        [[nodiscard]] native_code get_entry(uint32_t index) const noexcept;
+
+        [[nodiscard]] std::span<const uint32_t> get_entry_indices() const noexcept;
+
+        [[nodiscard]] uint32_t get_function_end(uint32_t begin) const noexcept;
+
+        [[nodiscard]] uint32_t get_compiled_functions_size() const noexcept;
+
+    private:
+        std::vector<std::atomic<native_code>> entries_;
+        std::vector<uint32_t> entry_indices_;
+        std::vector<uint32_t> function_ends_;
+        std::vector<std::pair<uint32_t, size_t>> pending_entries_;
+        std::vector<size_t> labels_;
+        std::vector<std::pair<size_t, uint32_t>> fixups_;
+        uint32_t compiled_functions_size_;
+        assembler assembler_;
+        std::vector<code_buffer> buffers_;
+        const program& program_;
+        const verification_result& verification_;
+
+        void publish();
+
+        bool compile_function(uint32_t begin, uint32_t end);
+
+        bool compile_instruction(uint32_t index, uint32_t begin, uint32_t end, size_t epilogue);
+
+        void compile_binop(uint32_t index, bytecode op);
+
+        void compile_elem(uint32_t index);
+
+        void compile_entry(uint32_t index, uint32_t begin, int32_t stack_depth);
+
+        void compile_helper_call(const void* helper, uint32_t index);
+
+        void compile_helper_call(const void* helper, uint32_t index, uint64_t arg);
+
+        void compile_args_load(uint32_t begin);
+
+        void compile_stack_sync();
+
+        void compile_stack_reload();
+    };
+
+    bool is_jit_supported() noexcept;
+
+    inline size_t assembler::get_size() const noexcept {
+        return code_.size();
+    }
+
+    inline std::span<const uint8_t> assembler::get_code() const noexcept {
+        return code_;
+    }
+
+    inline const uint8_t* code_buffer::get_data() const noexcept {
+        return static_cast<const uint8_t*>(data_);
+    }
+
+    inline native_code jit_compiler::get_entry(uint32_t index) const noexcept {
+        return entries_[index].load(std::memory_order_acquire);
+    }
+
+    inline std::span<const uint32_t> jit_compiler::get_entry_indices() const noexcept {
+        return entry_indices_;
+    }
+
+    inline uint32_t jit_compiler::get_function_end(uint32_t begin) const noexcept {
+        return function_ends_[begin];
+    }
+
+    inline uint32_t jit_compiler::get_compiled_functions_size() const noexcept {
+        return compiled_functions_size_;
+    }
+
+}
+
+#endif
@@ -4,17 +4,25 @@
 #include "bytefile.h"
 #include "file_reader.h"
 #include "interpreter.h"
+#include "options.h"
+#include "verification_cache.h"
 #include "verifier.h"
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+    assignment_04::options opts;
+    try {
+        opts = assignment_04::options(argc, argv);
+    } catch (const std::invalid_argument& exc) {
+        std::cerr << exc.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " " << assignment_04::options::get_usage() << std::endl;
         return -1;
     }
     try {
-        assignment_04::bytefile file = assignment_04::read_file(argv[1]);
-        assignment_04::verify(file);
-        assignment_04::interpret(file);
+        assignment_04::mapped_file mapping(opts.get_path());
+        assignment_04::bytefile file = assignment_04::read_file(mapping);
+        assignment_04::verification_result verification = opts.has_verification_cache() ? assignment_04::verify_cached(file, mapping, opts.get_verification_cache_dir(), opts.get_verify_threads())
+                                                                                        : assignment_04::verify(file, opts.get_verify_threads());
+        assignment_04::interpret(file, verification, opts);
     } catch (const std::exception& exc) {
         std::cerr << exc.what() << std::endl;
         return -1;
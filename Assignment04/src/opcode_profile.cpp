@@ -0,0 +1,142 @@
+#include "opcode_profile.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <span>
+#include <utility>
+
+namespace assignment_04 {
+
+    instruction_counter::instruction_counter() noexcept
+        : executed_(0) {
+    }
+
+    opcode_profile::opcode_profile(const bytefile& file)
+        : ops_{}
+        , pairs_(OPS_SIZE * OPS_SIZE)
+        , offsets_(file.get_code_size())
+        , prev_op_(bytecode::STOP)
+        , executed_(0)
+        , bytefile_(file) {
+    }
+
+    // Nonzero counts first by frequency, then by position for equal counts, so the output does not depend on the sort.
+    static std::vector<std::pair<uint64_t, size_t>> sort_counts(std::span<const uint64_t> counts) {
+        std::vector<std::pair<uint64_t, size_t>> sorted;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i] != 0) {
+                sorted.emplace_back(counts[i], i);
+            }
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second < rhs.second;
+        });
+        return sorted;
+    }
+
+    void opcode_profile::print(std::ostream& os, size_t count) const {
+        auto print_count = [this, &os](uint64_t frequency) {
+            os << "  " << std::setw(12) << frequency << "  " << std::setw(6) << std::fixed << std::setprecision(2) << 100.0 * static_cast<double>(frequency) / static_cast<double>(executed_) << "%  ";
+        };
+        os << "Executed instructions: " << executed_ << "\n\nOpcodes:\n";
+        std::vector<std::pair<uint64_t, size_t>> ops = sort_counts(ops_);
+        for (size_t i = 0; i < std::min(count, ops.size()); ++i) {
+            print_count(ops[i].first);
+            os << get_op_name(static_cast<bytecode>(ops[i].second)) << "\n";
+        }
+        os << "\nOpcode pairs:\n";
+        std::vector<std::pair<uint64_t, size_t>> pairs = sort_counts(pairs_);
+        for (size_t i = 0; i < std::min(count, pairs.size()); ++i) {
+            print_count(pairs[i].first);
+            os << get_op_name(static_cast<bytecode>(pairs[i].second / OPS_SIZE)) << "; " << get_op_name(static_cast<bytecode>(pairs[i].second % OPS_SIZE)) << "\n";
+        }
+        os << "\nHottest instructions:\n";
+        std::vector<std::pair<uint64_t, size_t>> offsets = sort_counts(offsets_);
+        for (size_t i = 0; i < std::min(count, offsets.size()); ++i) {
+            print_count(offsets[i].first);
+            os << "0x" << std::hex << std::setw(8) << std::setfill('0') << offsets[i].second << std::dec << std::setfill(' ') << "  " << get_op_name(bytefile_.get_code(offsets[i].second)) << "\n";
+        }
+    }
+
+    void opcode_profile::write(std::ostream& os) const {
+        os << "file " << bytefile_.get_name() << "\n";
+        os << "executed " << executed_ << "\n";
+        for (const auto& [frequency, op] : sort_counts(ops_)) {
+            os << "op " << get_op_name(static_cast<bytecode>(op)) << " " << frequency << "\n";
+        }
+        for (const auto& [frequency, pair] : sort_counts(pairs_)) {
+            os << "pair " << get_op_name(static_cast<bytecode>(pair / OPS_SIZE)) << " " << get_op_name(static_cast<bytecode>(pair % OPS_SIZE)) << " " << frequency << "\n";
+        }
+        for (const auto& [frequency, offset] : sort_counts(offsets_)) {
+            os << "offset " << offset << " " << get_op_name(bytefile_.get_code(offset)) << " " << frequency << "\n";
+        }
+    }
+
+    std::string_view get_op_name(bytecode op) noexcept {
+        switch (op) {
+            case bytecode::LOW_ADD: return "LOW_ADD";
+            case bytecode::LOW_SUB: return "LOW_SUB";
+            case bytecode::LOW_MUL: return "LOW_MUL";
+            case bytecode::LOW_DIV: return "LOW_DIV";
+            case bytecode::LOW_MOD: return "LOW_MOD";
+            case bytecode::LOW_LT: return "LOW_LT";
+            case bytecode::LOW_LE: return "LOW_LE";
+            case bytecode::LOW_GT: return "LOW_GT";
+            case bytecode::LOW_GE: return "LOW_GE";
+            case bytecode::LOW_EQ: return "LOW_EQ";
+            case bytecode::LOW_NE: return "LOW_NE";
+            case bytecode::LOW_AND: return "LOW_AND";
+            case bytecode::LOW_OR: return "LOW_OR";
+            case bytecode::CONST: return "CONST";
+            case bytecode::STRING: return "STRING";
+            case bytecode::SEXP: return "SEXP";
+            case bytecode::STI: return "STI";
+            case bytecode::STA: return "STA";
+            case bytecode::JMP: return "JMP";
+            case bytecode::END: return "END";
+            case bytecode::RET: return "RET";
+            case bytecode::DROP: return "DROP";
+            case bytecode::DUP: return "DUP";
+            case bytecode::SWAP: return "SWAP";
+            case bytecode::ELEM: return "ELEM";
+            case bytecode::LD_GLOBAL: return "LD_GLOBAL";
+            case bytecode::LD_LOCAL: return "LD_LOCAL";
+            case bytecode::LD_ARGUMENT: return "LD_ARGUMENT";
+            case bytecode::LD_CAPTURED: return "LD_CAPTURED";
+            case bytecode::LDA_GLOBAL: return "LDA_GLOBAL";
+            case bytecode::LDA_LOCAL: return "LDA_LOCAL";
+            case bytecode::LDA_ARGUMENT: return "LDA_ARGUMENT";
+            case bytecode::LDA_CAPTURED: return "LDA_CAPTURED";
+            case bytecode::ST_GLOBAL: return "ST_GLOBAL";
+            case bytecode::ST_LOCAL: return "ST_LOCAL";
+            case bytecode::ST_ARGUMENT: return "ST_ARGUMENT";
+            case bytecode::ST_CAPTURED: return "ST_CAPTURED";
+            case bytecode::CJMPZ: return "CJMPZ";
+            case bytecode::CJMPNZ: return "CJMPNZ";
+            case bytecode::BEGIN: return "BEGIN";
+            case bytecode::CBEGIN: return "CBEGIN";
+            case bytecode::CLOSURE: return "CLOSURE";
+            case bytecode::CALLC: return "CALLC";
+            case bytecode::CALL: return "CALL";
+            case bytecode::TAG: return "TAG";
+            case bytecode::ARRAY: return "ARRAY";
+            case bytecode::FAIL: return "FAIL";
+            case bytecode::LINE: return "LINE";
+            case bytecode::PATT_STR: return "PATT_STR";
+            case bytecode::PATT_STRING: return "PATT_STRING";
+            case bytecode::PATT_ARRAY: return "PATT_ARRAY";
+            case bytecode::PATT_SEXP: return "PATT_SEXP";
+            case bytecode::PATT_REF: return "PATT_REF";
+            case bytecode::PATT_VAL: return "PATT_VAL";
+            case bytecode::PATT_FUN: return "PATT_FUN";
+            case bytecode::CALL_LREAD: return "CALL_LREAD";
+            case bytecode::CALL_LWRITE: return "CALL_LWRITE";
+            case bytecode::CALL_LLENGTH: return "CALL_LLENGTH";
+            case bytecode::CALL_LSTRING: return "CALL_LSTRING";
+            case bytecode::CALL_BARRAY: return "CALL_BARRAY";
+            case bytecode::STOP: return "STOP";
+            default: return "UNKNOWN";
+        }
+    }
+
+}
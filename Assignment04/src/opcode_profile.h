@@ -0,0 +1,97 @@
+#ifndef OPCODE_PROFILE_H
+#define OPCODE_PROFILE_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "bytefile.h"
+
+// Instrumentation policies of the switch dispatch. The loop is instantiated once per policy and calls `record` before
+// every instruction, so the policy that records nothing compiles to the loop without instrumentation.
+namespace assignment_04 {
+
+    class no_profile {
+    public:
+        void record(uint32_t offset, bytecode op) noexcept;
+    };
+
+    class instruction_counter {
+    public:
+        instruction_counter() noexcept;
+
+        void record(uint32_t offset, bytecode op) noexcept;
+
+        [[nodiscard]] uint64_t get_executed() const noexcept;
+
+    private:
+        uint64_t executed_;
+    };
+
+    // Counts executed opcodes, pairs of consecutive opcodes, and instructions by offset. A pair also spans a jump, call
+    // or return, as it is what runs one after the other; the counts by offset tell which of them lie next to each
+    // other in the bytefile.
+    class opcode_profile {
+    public:
+        constexpr static size_t OPS_SIZE = std::numeric_limits<std::underlying_type_t<bytecode>>::max() + 1;
+
+        explicit opcode_profile(const bytefile& file);
+
+        void record(uint32_t offset, bytecode op) noexcept;
+
+        [[nodiscard]] uint64_t get_executed() const noexcept;
+
+        // The top `count` entries of every table, sorted by frequency.
+        void print(std::ostream& os, size_t count) const;
+
+        // Every nonzero entry, one per line, in the format Assignment03 reads with --profile. The bytefile is named by
+        // the path it was loaded from.
+        void write(std::ostream& os) const;
+
+    private:
+        std::array<uint64_t, OPS_SIZE> ops_;
+        std::vector<uint64_t> pairs_;
+        std::vector<uint64_t> offsets_;
+        bytecode prev_op_;
+        uint64_t executed_;
+        const bytefile& bytefile_;
+    };
+
+    [[nodiscard]] std::string_view get_op_name(bytecode op) noexcept;
+
+    inline void no_profile::record(uint32_t offset, bytecode op) noexcept {
+        static_cast<void>(offset);
+        static_cast<void>(op);
+    }
+
+    inline void instruction_counter::record(uint32_t offset, bytecode op) noexcept {
+        static_cast<void>(offset);
+        static_cast<void>(op);
+        ++executed_;
+    }
+
+    inline uint64_t instruction_counter::get_executed() const noexcept {
+        return executed_;
+    }
+
+    inline void opcode_profile::record(uint32_t offset, bytecode op) noexcept {
+        ++ops_[static_cast<size_t>(op)];
+        if (executed_ > 0) {
+            ++pairs_[static_cast<size_t>(prev_op_) * OPS_SIZE + static_cast<size_t>(op)];
+        }
+        ++offsets_[offset];
+        prev_op_ = op;
+        ++executed_;
+    }
+
+    inline uint64_t opcode_profile::get_executed() const noexcept {
+        return executed_;
+    }
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "options.h"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace assignment_04 {
+
+    static uint32_t parse_threshold(std::string_view arg, std::string_view value) {
+        uint32_t threshold = 0;
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), threshold);
+        if (error != std::errc{} || end != value.data() + value.size() || threshold == 0) {
+            throw std::invalid_argument("Invalid threshold: " + std::string(arg));
+        }
+        return threshold;
+    }
+
+    options::options() noexcept
+        : dispatch_mode_(DEFAULT_DISPATCH_MODE)
+        , superinstructions_(true)
+        , quickening_(true)
+        , match_tables_(true)
+        , stack_caching_(true)
+        , precise_gc_(true)
+        , jit_mode_(jit_mode::OFF)
+        , call_threshold_(DEFAULT_CALL_THRESHOLD)
+        , back_edge_threshold_(DEFAULT_BACK_EDGE_THRESHOLD)
+        , tiering_log_(false)
+        , call_cache_log_(false)
+        , instruction_count_(false)
+        , verification_cache_(false)
+        , sample_frequency_(DEFAULT_SAMPLE_FREQUENCY)
+        , verify_threads_(std::max(1U, std::thread::hardware_concurrency())) {
+    }
+
+    options::options(int argc, char** argv)
+        : options() {
+        constexpr static std::string_view SWITCH_DISPATCH_OPTION = "--dispatch=switch";
+        constexpr static std::string_view THREADED_DISPATCH_OPTION = "--dispatch=threaded";
+        constexpr static std::string_view REGISTER_DISPATCH_OPTION = "--dispatch=register";
+        constexpr static std::string_view NO_SUPERINSTRUCTIONS_OPTION = "--no-superinstructions";
+        constexpr static std::string_view NO_QUICKENING_OPTION = "--no-quickening";
+        constexpr static std::string_view NO_MATCH_TABLES_OPTION = "--no-match-tables";
+        constexpr static std::string_view NO_STACK_CACHING_OPTION = "--no-stack-caching";
+        constexpr static std::string_view CONSERVATIVE_GC_OPTION = "--conservative-gc";
+        constexpr static std::string_view JIT_OPTION = "--jit";
+        constexpr static std::string_view EAGER_JIT_OPTION = "--jit=eager";
+        constexpr static std::string_view TIERED_JIT_OPTION = "--jit=tiered";
+        constexpr static std::string_view CALL_THRESHOLD_OPTION = "--call-threshold=";
+        constexpr static std::string_view BACK_EDGE_THRESHOLD_OPTION = "--back-edge-threshold=";
+        constexpr static std::string_view LOG_TIERING_OPTION = "--log-tiering";
+        constexpr static std::string_view LOG_CALL_CACHES_OPTION = "--log-call-caches";
+        constexpr static std::string_view COUNT_INSTRUCTIONS_OPTION = "--count-instructions";
+        constexpr static std::string_view PROFILE_OPCODES_OPTION = "--profile-opcodes=";
+        constexpr static std::string_view VERIFICATION_CACHE_OPTION = "--verification-cache";
+        constexpr static std::string_view VERIFICATION_CACHE_DIR_OPTION = "--verification-cache=";
+        constexpr static std::string_view PROFILE_CALLS_OPTION = "--profile-calls=";
+        constexpr static std::string_view PROFILE_SAMPLES_OPTION = "--profile-samples=";
+        constexpr static std::string_view SAMPLE_FREQUENCY_OPTION = "--sample-frequency=";
+        constexpr static std::string_view VERIFY_THREADS_OPTION = "--verify-threads=";
+        bool is_dispatch_requested = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg(argv[i]);
+            if (arg == SWITCH_DISPATCH_OPTION) {
+                dispatch_mode_ = dispatch_mode::SWITCH;
+                is_dispatch_requested = true;
+            } else if (arg == THREADED_DISPATCH_OPTION) {
+                dispatch_mode_ = dispatch_mode::THREADED;
+                is_dispatch_requested = false;
+            } else if (arg == REGISTER_DISPATCH_OPTION) {
+                dispatch_mode_ = dispatch_mode::REGISTER;
+                is_dispatch_requested = true;
+            } else if (arg == NO_SUPERINSTRUCTIONS_OPTION) {
+                superinstructions_ = false;
+            } else if (arg == NO_QUICKENING_OPTION) {
+                quickening_ = false;
+            } else if (arg == NO_MATCH_TABLES_OPTION) {
+                match_tables_ = false;
+            } else if (arg == NO_STACK_CACHING_OPTION) {
+                stack_caching_ = false;
+            } else if (arg == CONSERVATIVE_GC_OPTION) {
+                precise_gc_ = false;
+            } else if (arg == JIT_OPTION || arg == EAGER_JIT_OPTION) {
+                jit_mode_ = jit_mode::EAGER;
+            } else if (arg == TIERED_JIT_OPTION) {
+                jit_mode_ = jit_mode::TIERED;
+            } else if (arg.starts_with(CALL_THRESHOLD_OPTION)) {
+                call_threshold_ = parse_threshold(arg, arg.substr(CALL_THRESHOLD_OPTION.size()));
+            } else if (arg.starts_with(BACK_EDGE_THRESHOLD_OPTION)) {
+                back_edge_threshold_ = parse_threshold(arg, arg.substr(BACK_EDGE_THRESHOLD_OPTION.size()));
+            } else if (arg == LOG_TIERING_OPTION) {
+                tiering_log_ = true;
+            } else if (arg == LOG_CALL_CACHES_OPTION) {
+                call_cache_log_ = true;
+            } else if (arg == COUNT_INSTRUCTIONS_OPTION) {
+                instruction_count_ = true;
+            } else if (arg.starts_with(PROFILE_OPCODES_OPTION) && arg.size() > PROFILE_OPCODES_OPTION.size()) {
+                opcode_profile_path_ = arg.substr(PROFILE_OPCODES_OPTION.size());
+            } else if (arg == VERIFICATION_CACHE_OPTION) {
+                verification_cache_ = true;
+            } else if (arg.starts_with(VERIFICATION_CACHE_DIR_OPTION) && arg.size() > VERIFICATION_CACHE_DIR_OPTION.size()) {
+                verification_cache_ = true;
+                verification_cache_dir_ = arg.substr(VERIFICATION_CACHE_DIR_OPTION.size());
+            } else if (arg.starts_with(PROFILE_CALLS_OPTION) && arg.size() > PROFILE_CALLS_OPTION.size()) {
+                call_profile_path_ = arg.substr(PROFILE_CALLS_OPTION.size());
+            } else if (arg.starts_with(PROFILE_SAMPLES_OPTION) && arg.size() > PROFILE_SAMPLES_OPTION.size()) {
+                sample_profile_path_ = arg.substr(PROFILE_SAMPLES_OPTION.size());
+            } else if (arg.starts_with(SAMPLE_FREQUENCY_OPTION)) {
+                sample_frequency_ = parse_threshold(arg, arg.substr(SAMPLE_FREQUENCY_OPTION.size()));
+            } else if (arg.starts_with(VERIFY_THREADS_OPTION)) {
+                verify_threads_ = parse_threshold(arg, arg.substr(VERIFY_THREADS_OPTION.size()));
+            } else if (path_.empty() && !arg.starts_with("--")) {
+                path_ = arg;
+            } else {
+                throw std::invalid_argument("Unexpected argument: " + std::string(arg));
+            }
+        }
+        if (path_.empty()) {
+            throw std::invalid_argument("No bytecode file given");
+        }
+        if (jit_mode_ != jit_mode::OFF) {
+            // Native code is generated from the decoded program, which only the threaded engine runs.
+            if (is_dispatch_requested) {
+                throw std::invalid_argument("--jit can only be used with --dispatch=threaded");
+            }
+            dispatch_mode_ = dispatch_mode::THREADED;
+        }
+        if (instruction_count_ && dispatch_mode_ == dispatch_mode::THREADED) {
+            // Superinstructions and native code make the threaded engine's count meaningless.
+            throw std::invalid_argument("--count-instructions can only be used with --dispatch=switch or --dispatch=register");
+        }
+        if (has_opcode_profile() && dispatch_mode_ != dispatch_mode::SWITCH) {
+            // Only the switch dispatch runs the instructions of the bytefile one by one.
+            throw std::invalid_argument("--profile-opcodes can only be used with --dispatch=switch");
+        }
+        if (has_call_profile() && dispatch_mode_ != dispatch_mode::SWITCH) {
+            // The other engines enter functions without running their BEGIN.
+            throw std::invalid_argument("--profile-calls can only be used with --dispatch=switch");
+        }
+        if (has_call_profile() && has_opcode_profile()) {
+            throw std::invalid_argument("--profile-calls cannot be used with --profile-opcodes");
+        }
+    }
+
+    std::string_view options::get_usage() noexcept {
+        return "[--dispatch=switch|threaded|register] [--no-superinstructions] [--no-quickening] [--no-match-tables] [--no-stack-caching] [--conservative-gc] "
+               "[--jit[=eager|tiered]] [--call-threshold=N] [--back-edge-threshold=N] [--log-tiering] [--log-call-caches] [--count-instructions] [--profile-opcodes=FILE] [--profile-calls=FILE] "
+               "[--profile-samples=FILE] [--sample-frequency=N] [--verification-cache[=DIR]] [--verify-threads=N] <filename>";
+    }
+
+}
@@ -0,0 +1,205 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstdint>
+#include <string_view>
+
+namespace assignment_04 {
+
+    enum class dispatch_mode : uint8_t {
+        SWITCH,
+        THREADED,
+        REGISTER
+    };
+
+#ifdef ASSIGNMENT04_THREADED_DISPATCH
+    constexpr inline dispatch_mode DEFAULT_DISPATCH_MODE = dispatch_mode::THREADED;
+#else
+    constexpr inline dispatch_mode DEFAULT_DISPATCH_MODE = dispatch_mode::SWITCH;
+#endif
+
+    // Eager compilation translates every function before the program starts, tiered compilation only the functions
+    // whose call or back edge counters reach the thresholds.
+    enum class jit_mode : uint8_t {
+        OFF,
+        EAGER,
+        TIERED
+    };
+
+    constexpr inline uint32_t DEFAULT_CALL_THRESHOLD = 1000;
+    constexpr inline uint32_t DEFAULT_BACK_EDGE_THRESHOLD = 10000;
+    constexpr inline uint32_t DEFAULT_SAMPLE_FREQUENCY = 1000;
+
+    class options {
+    public:
+        options() noexcept;
+
+        options(int argc, char** argv);
+
+        [[nodiscard]] std::string_view get_path() const noexcept;
+
+        [[nodiscard]] dispatch_mode get_dispatch_mode() const noexcept;
+
+        [[nodiscard]] bool has_superinstructions() const noexcept;
+
+        [[nodiscard]] bool has_quickening() const noexcept;
+
+        [[nodiscard]] bool has_match_tables() const noexcept;
+
+        [[nodiscard]] bool has_stack_caching() const noexcept;
+
+        [[nodiscard]] bool has_precise_gc() const noexcept;
+
+        [[nodiscard]] jit_mode get_jit_mode() const noexcept;
+
+        [[nodiscard]] uint32_t get_call_threshold() const noexcept;
+
+        [[nodiscard]] uint32_t get_back_edge_threshold() const noexcept;
+
+        [[nodiscard]] bool has_tiering_log() const noexcept;
+
+        [[nodiscard]] bool has_call_cache_log() const noexcept;
+
+        [[nodiscard]] bool has_instruction_count() const noexcept;
+
+        [[nodiscard]] bool has_opcode_profile() const noexcept;
+
+        [[nodiscard]] std::string_view get_opcode_profile_path() const noexcept;
+
+        [[nodiscard]] bool has_verification_cache() const noexcept;
+
+        // Empty when the cache is kept next to the bytefile.
+        [[nodiscard]] std::string_view get_verification_cache_dir() const noexcept;
+
+        [[nodiscard]] bool has_call_profile() const noexcept;
+
+        [[nodiscard]] std::string_view get_call_profile_path() const noexcept;
+
+        [[nodiscard]] bool has_sample_profile() const noexcept;
+
+        [[nodiscard]] std::string_view get_sample_profile_path() const noexcept;
+
+        [[nodiscard]] uint32_t get_sample_frequency() const noexcept;
+
+        [[nodiscard]] uint32_t get_verify_threads() const noexcept;
+
+        [[nodiscard]] static std::string_view get_usage() noexcept;
+
+    private:
+        std::string_view path_;
+        dispatch_mode dispatch_mode_;
+        bool superinstructions_;
+        bool quickening_;
+        bool match_tables_;
+        bool stack_caching_;
+        bool precise_gc_;
+        jit_mode jit_mode_;
+        uint32_t call_threshold_;
+        uint32_t back_edge_threshold_;
+        bool tiering_log_;
+        bool call_cache_log_;
+        bool instruction_count_;
+        std::string_view opcode_profile_path_;
+        bool verification_cache_;
+        std::string_view verification_cache_dir_;
+        std::string_view call_profile_path_;
+        std::string_view sample_profile_path_;
+        uint32_t sample_frequency_;
+        uint32_t verify_threads_;
+    };
+
+    inline std::string_view options::get_path() const noexcept {
+        return path_;
+    }
+
+    inline dispatch_mode options::get_dispatch_mode() const noexcept {
+        return dispatch_mode_;
+    }
+
+    inline bool options::has_superinstructions() const noexcept {
+        return superinstructions_;
+    }
+
+    inline bool options::has_quickening() const noexcept {
+        return quickening_;
+    }
+
+    inline bool options::has_match_tables() const noexcept {
+        return match_tables_;
+    }
+
+    inline bool options::has_stack_caching() const noexcept {
+        return stack_caching_;
+    }
+
+    inline bool options::has_precise_gc() const noexcept {
+        return precise_gc_;
+    }
+
+    inline jit_mode options::get_jit_mode() const noexcept {
+        return jit_mode_;
+    }
+
+    inline uint32_t options::get_call_threshold() const noexcept {
+        return call_threshold_;
+    }
+
+    inline uint32_t options::get_back_edge_threshold() const noexcept {
+        return back_edge_threshold_;
+    }
+
+    inline bool options::has_tiering_log() const noexcept {
+        return tiering_log_;
+    }
+
+    inline bool options::has_call_cache_log() const noexcept {
+        return call_cache_log_;
+    }
+
+    inline bool options::has_instruction_count() const noexcept {
+        return instruction_count_;
+    }
+
+    inline bool options::has_opcode_profile() const noexcept {
+        return !opcode_profile_path_.empty();
+    }
+
+    inline std::string_view options::get_opcode_profile_path() const noexcept {
+        return opcode_profile_path_;
+    }
+
+    inline bool options::has_verification_cache() const noexcept {
+        return verification_cache_;
+    }
+
+    inline std::string_view options::get_verification_cache_dir() const noexcept {
+        return verification_cache_dir_;
+    }
+
+    inline bool options::has_call_profile() const noexcept {
+        return !call_profile_path_.empty();
+    }
+
+    inline std::string_view options::get_call_profile_path() const noexcept {
+        return call_profile_path_;
+    }
+
+    inline bool options::has_sample_profile() const noexcept {
+        return !sample_profile_path_.empty();
+    }
+
+    inline std::string_view options::get_sample_profile_path() const noexcept {
+        return sample_profile_path_;
+    }
+
+    inline uint32_t options::get_sample_frequency() const noexcept {
+        return sample_frequency_;
+    }
+
+    inline uint32_t options::get_verify_threads() const noexcept {
+        return verify_threads_;
+    }
+
+}
+
+#endif
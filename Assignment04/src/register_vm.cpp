@@ -0,0 +1,567 @@
+#include "register_vm.h"
+
+#include <array>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "interpreter.h"
+#include "stack.h"
+
+namespace assignment_04 {
+
+    using operand_areas = std::array<auint*, 3>;
+
+    static auint& at(const operand_areas& areas, operand op) noexcept {
+        return areas[static_cast<size_t>(op.get_area())][op.get_index()];
+    }
+
+    static bool has_destination(register_op op) noexcept {
+        return op <= register_op::ELEM_AGGREGATE;
+    }
+
+    static bool is_jump(register_op op) noexcept {
+        return op >= register_op::JMP && op <= register_op::JNZ_INT;
+    }
+
+    static void fail(state& interpreter_state, const register_instruction& insn, std::string_view message) {
+        interpreter_state.set_ip(insn.get_source() + 1);
+        interpreter_state.validate(false, message);
+    }
+
+    operand::operand() noexcept
+        : operand(operand_area::FRAME, 0) {
+    }
+
+    operand::operand(operand_area area, int32_t index) noexcept
+        : index_(index)
+        , area_(area) {
+    }
+
+    register_instruction::register_instruction(register_op op, uint32_t source) noexcept
+        : source_(source)
+        , target_(0)
+        , height_(NO_HEIGHT)
+        , op_(op) {
+    }
+
+    register_program::register_program(const program& code)
+        : pcs_(code.get_size(), 0)
+        , program_(code) {
+    }
+
+    void register_program::add_instruction(register_instruction insn) {
+        instructions_.push_back(insn);
+    }
+
+    int32_t register_program::add_constant(int32_t constant) {
+        auto [it, is_inserted] = constant_indices_.try_emplace(constant, static_cast<int32_t>(constants_.size()));
+        if (is_inserted) {
+            constants_.push_back(value{constant}.get_repr());
+        }
+        return it->second;
+    }
+
+    register_translator::register_translator(const program& code, const verification_result& verification)
+        : program_(code)
+        , verification_(verification)
+        , result_(code)
+        , leaders_(code.get_size(), false)
+        , needs_reset_(true)
+        , block_start_(0)
+        , locals_size_(0)
+        , args_size_(0) {
+    }
+
+    register_program register_translator::translate() {
+        find_leaders();
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            if (leaders_[i]) {
+                sync(i);
+                needs_reset_ = true;
+            }
+            result_.set_pc(i, result_.get_size());
+            translate_instruction(i);
+        }
+        for (uint32_t pc = 0; pc < result_.get_size(); ++pc) {
+            register_instruction& insn = result_.get_instruction(pc);
+            if (is_jump(insn.get_op())) {
+                insn.set_target(result_.get_pc(insn.get_target()));
+            }
+        }
+        return std::move(result_);
+    }
+
+    // Values are only kept out of their slots within a basic block, so everything is synced before a jump target, a
+    // function entry or a call return point.
+    void register_translator::find_leaders() {
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            const instruction& insn = program_.get_instruction(i);
+            switch (insn.get_op()) {
+                case bytecode::BEGIN:
+                case bytecode::CBEGIN:
+                    leaders_[i] = true;
+                    break;
+                case bytecode::JMP:
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ:
+                    leaders_[insn.get_target()] = true;
+                    break;
+                case bytecode::CALL:
+                case bytecode::CALLC:
+                    leaders_[i + 1] = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void register_translator::translate_instruction(uint32_t index) {
+        const instruction& insn = program_.get_instruction(index);
+        bytecode op = insn.get_op();
+        if (op == bytecode::BEGIN || op == bytecode::CBEGIN) {
+            args_size_ = insn.get_first_arg();
+            locals_size_ = insn.get_second_arg() & 0xFFFF;
+        }
+        if (op == bytecode::STOP) {
+            emit(register_instruction{register_op::STOP, index});
+            needs_reset_ = true;
+            return;
+        }
+        int32_t depth = verification_.get_stack_depth(insn.get_offset());
+        if (depth == verification_result::NO_DEPTH) {
+            // Never reached, so there is nothing to translate.
+            needs_reset_ = true;
+            return;
+        }
+        if (needs_reset_) {
+            stack_.clear();
+            for (int32_t i = 0; i < depth; ++i) {
+                stack_.push_back(get_slot(i));
+            }
+            needs_reset_ = false;
+            block_start_ = result_.get_size();
+        }
+        if (stack_.size() != static_cast<size_t>(depth)) {
+            std::array<char, 16> offset{};
+            std::snprintf(offset.data(), offset.size(), "%#X", insn.get_offset());
+            throw std::runtime_error("Stack height mismatch at offset " + std::string(offset.data()));
+        }
+        switch (op) {
+            case bytecode::LOW_ADD:
+                translate_binop(index, register_op::ADD, register_op::ADD_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_SUB:
+                translate_binop(index, register_op::SUB, register_op::SUB_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_MUL:
+                translate_binop(index, register_op::MUL, register_op::MUL_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_DIV:
+                translate_binop(index, register_op::DIV, register_op::DIV_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_MOD:
+                translate_binop(index, register_op::MOD, register_op::MOD_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_LT:
+                translate_binop(index, register_op::LT, register_op::LT_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_LE:
+                translate_binop(index, register_op::LE, register_op::LE_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_GT:
+                translate_binop(index, register_op::GT, register_op::GT_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_GE:
+                translate_binop(index, register_op::GE, register_op::GE_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_EQ:
+                translate_binop(index, register_op::EQ, register_op::EQ_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_NE:
+                translate_binop(index, register_op::NE, register_op::NE_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_AND:
+                translate_binop(index, register_op::AND, register_op::AND_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::LOW_OR:
+                translate_binop(index, register_op::OR, register_op::OR_INT, inferred_type::INT, inferred_type::INT);
+                break;
+            case bytecode::ELEM:
+                translate_binop(index, register_op::ELEM, register_op::ELEM_AGGREGATE, inferred_type::AGGREGATE, inferred_type::INT);
+                break;
+            case bytecode::CONST:
+                stack_.emplace_back(operand_area::CONSTANT, result_.add_constant(insn.get_first_arg()));
+                break;
+            case bytecode::LD_GLOBAL:
+                stack_.emplace_back(operand_area::GLOBAL, insn.get_first_arg());
+                break;
+            case bytecode::LD_LOCAL:
+                stack_.emplace_back(operand_area::FRAME, insn.get_first_arg());
+                break;
+            case bytecode::LD_ARGUMENT:
+                stack_.emplace_back(operand_area::FRAME, insn.get_first_arg() - args_size_ - static_cast<int32_t>(frame::RECORD_SIZE));
+                break;
+            case bytecode::ST_GLOBAL:
+                translate_store(index, operand{operand_area::GLOBAL, insn.get_first_arg()});
+                break;
+            case bytecode::ST_LOCAL:
+                translate_store(index, operand{operand_area::FRAME, insn.get_first_arg()});
+                break;
+            case bytecode::ST_ARGUMENT:
+                translate_store(index, operand{operand_area::FRAME, insn.get_first_arg() - args_size_ - static_cast<int32_t>(frame::RECORD_SIZE)});
+                break;
+            case bytecode::DUP:
+                stack_.push_back(stack_.back());
+                break;
+            case bytecode::DROP:
+                stack_.pop_back();
+                break;
+            case bytecode::SWAP:
+            case bytecode::LINE:
+                break;
+            case bytecode::JMP: {
+                sync(index);
+                register_instruction jmp(register_op::JMP, index);
+                jmp.set_target(insn.get_target());
+                emit(jmp);
+                needs_reset_ = true;
+                break;
+            }
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ: {
+                bool is_proven = verification_.get_operand_type(insn.get_offset(), 0) == inferred_type::INT;
+                register_op cjmp_op = op == bytecode::CJMPZ ? register_op::JZ : register_op::JNZ;
+                if (is_proven) {
+                    cjmp_op = op == bytecode::CJMPZ ? register_op::JZ_INT : register_op::JNZ_INT;
+                }
+                register_instruction cjmp(cjmp_op, index);
+                cjmp.set_lhs(pop());
+                cjmp.set_target(insn.get_target());
+                sync(index);
+                emit(cjmp);
+                break;
+            }
+            case bytecode::BEGIN:
+            case bytecode::CBEGIN:
+            case bytecode::CALL:
+            case bytecode::CALLC:
+                translate_execute(index, register_op::TRANSFER, depth);
+                break;
+            case bytecode::END:
+            case bytecode::RET:
+                translate_execute(index, register_op::RET, depth);
+                break;
+            case bytecode::FAIL:
+                translate_execute(index, register_op::EXECUTE, depth);
+                emit(register_instruction{register_op::STOP, index});
+                break;
+            default:
+                translate_execute(index, register_op::EXECUTE, depth);
+                break;
+        }
+    }
+
+    void register_translator::translate_binop(uint32_t index, register_op op, register_op proven_op, inferred_type lhs_type, inferred_type rhs_type) {
+        uint32_t offset = program_.get_offset(index);
+        bool is_proven = verification_.get_operand_type(offset, 1) == lhs_type && verification_.get_operand_type(offset, 0) == rhs_type;
+        register_instruction binop(is_proven ? proven_op : op, index);
+        binop.set_rhs(pop());
+        binop.set_lhs(pop());
+        binop.set_dst(get_slot(stack_.size()));
+        emit(binop);
+        stack_.push_back(binop.get_dst());
+    }
+
+    void register_translator::translate_store(uint32_t index, operand dst) {
+        operand val = stack_.back();
+        if (val == dst) {
+            return;
+        }
+        // Values still waiting below the top may be the variable's old value.
+        bool is_aliased = false;
+        for (size_t i = 0; i + 1 < stack_.size(); ++i) {
+            if (stack_[i] == dst) {
+                register_instruction move(register_op::MOVE, index);
+                move.set_dst(get_slot(i));
+                move.set_lhs(dst);
+                emit(move);
+                stack_[i] = get_slot(i);
+                is_aliased = true;
+            }
+        }
+        if (!is_aliased && val == get_slot(stack_.size() - 1) && result_.get_size() > block_start_) {
+            register_instruction& last = result_.get_instruction(result_.get_size() - 1);
+            if (has_destination(last.get_op()) && last.get_dst() == val) {
+                last.set_dst(dst);
+                stack_.back() = dst;
+                return;
+            }
+        }
+        register_instruction move(register_op::MOVE, index);
+        move.set_dst(dst);
+        move.set_lhs(val);
+        emit(move);
+    }
+
+    void register_translator::translate_execute(uint32_t index, register_op op, int32_t depth) {
+        sync(index);
+        register_instruction execute(op, index);
+        bytecode source_op = program_.get_instruction(index).get_op();
+        // A function entry runs on top of the caller's stack, which the call has already left in place.
+        if (source_op != bytecode::BEGIN && source_op != bytecode::CBEGIN) {
+            execute.set_height(static_cast<uint32_t>(locals_size_ + depth));
+        }
+        emit(execute);
+        needs_reset_ = true;
+    }
+
+    void register_translator::emit(register_instruction insn) {
+        result_.add_instruction(insn);
+    }
+
+    void register_translator::sync(uint32_t index) {
+        for (size_t i = 0; i < stack_.size(); ++i) {
+            operand slot = get_slot(i);
+            if (stack_[i] != slot) {
+                register_instruction move(register_op::MOVE, index);
+                move.set_dst(slot);
+                move.set_lhs(stack_[i]);
+                emit(move);
+                stack_[i] = slot;
+            }
+        }
+    }
+
+    operand register_translator::get_slot(uint32_t depth) const noexcept {
+        return operand{operand_area::FRAME, locals_size_ + static_cast<int32_t>(depth)};
+    }
+
+    operand register_translator::pop() {
+        operand val = stack_.back();
+        stack_.pop_back();
+        return val;
+    }
+
+    register_program translate_to_registers(const program& code, const verification_result& verification) {
+        register_translator translator(code, verification);
+        return translator.translate();
+    }
+
+    template <register_op Op, bool Checked>
+    static void execute_binop(state& interpreter_state, const register_instruction& insn, const operand_areas& areas) {
+        value lhs(from_repr_t, at(areas, insn.get_lhs()));
+        value rhs(from_repr_t, at(areas, insn.get_rhs()));
+        int32_t res = 0;
+        if constexpr (Op == register_op::EQ) {
+            if constexpr (Checked) {
+                if (!lhs.is_integer() && !rhs.is_integer()) {
+                    fail(interpreter_state, insn, "EQ: one of the operands must be integer. Bytecode offset: %#X\n");
+                }
+                res = lhs.is_integer() && rhs.is_integer() && lhs.as_integer() == rhs.as_integer();
+            } else {
+                res = lhs.as_integer() == rhs.as_integer();
+            }
+        } else {
+            if (Checked && (!lhs.is_integer() || !rhs.is_integer())) {
+                fail(interpreter_state, insn, "BINOP: operand must be integer. Bytecode offset: %#X\n");
+            }
+            int32_t lhs_int = lhs.as_integer();
+            int32_t rhs_int = rhs.as_integer();
+            if constexpr (Op == register_op::ADD) {
+                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) + static_cast<int64_t>(rhs_int));
+            } else if constexpr (Op == register_op::SUB) {
+                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) - static_cast<int64_t>(rhs_int));
+            } else if constexpr (Op == register_op::MUL) {
+                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) * static_cast<int64_t>(rhs_int));
+            } else if constexpr (Op == register_op::DIV) {
+                if (rhs_int == 0) {
+                    fail(interpreter_state, insn, "DIV: division by zero. Bytecode offset: %#X\n");
+                }
+                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) / static_cast<int64_t>(rhs_int));
+            } else if constexpr (Op == register_op::MOD) {
+                if (rhs_int == 0) {
+                    fail(interpreter_state, insn, "MOD: division by zero. Bytecode offset: %#X\n");
+                }
+                res = static_cast<int32_t>(static_cast<int64_t>(lhs_int) % static_cast<int64_t>(rhs_int));
+            } else if constexpr (Op == register_op::LT) {
+                res = (lhs_int < rhs_int);
+            } else if constexpr (Op == register_op::LE) {
+                res = (lhs_int <= rhs_int);
+            } else if constexpr (Op == register_op::GT) {
+                res = (lhs_int > rhs_int);
+            } else if constexpr (Op == register_op::GE) {
+                res = (lhs_int >= rhs_int);
+            } else if constexpr (Op == register_op::NE) {
+                res = (lhs_int != rhs_int);
+            } else if constexpr (Op == register_op::AND) {
+                res = (lhs_int && rhs_int);
+            } else if constexpr (Op == register_op::OR) {
+                res = (lhs_int || rhs_int);
+            } else {
+                static_assert(Op != Op, "BINOP: unknown register instruction");
+            }
+        }
+        at(areas, insn.get_dst()) = value{res}.get_repr();
+    }
+
+    template <bool Checked>
+    static void execute_elem(state& interpreter_state, const register_instruction& insn, const operand_areas& areas) {
+        value agg(from_repr_t, at(areas, insn.get_lhs()));
+        value idx(from_repr_t, at(areas, insn.get_rhs()));
+        if (Checked && !idx.is_integer()) {
+            fail(interpreter_state, insn, "ELEM: index must be integer. Bytecode offset: %#X\n");
+        }
+        int32_t idx_int = idx.as_integer();
+        if (Checked && !agg.is_aggregate()) {
+            fail(interpreter_state, insn, "ELEM: argument must be aggregate. Bytecode offset: %#X\n");
+        }
+        aggregate agg_val = agg.as_aggregate();
+        if (idx_int < 0 || idx_int >= static_cast<int32_t>(agg_val.get_elements_size())) {
+            fail(interpreter_state, insn, "ELEM: index out of bounds. Bytecode offset: %#X\n");
+        }
+        at(areas, insn.get_dst()) = agg_val.get_element(idx_int).get_repr();
+    }
+
+    template <bool Checked>
+    static bool execute_cjmp(state& interpreter_state, const register_instruction& insn, const operand_areas& areas, int32_t expected) {
+        value cond(from_repr_t, at(areas, insn.get_lhs()));
+        if (Checked && !cond.is_integer()) {
+            fail(interpreter_state, insn, "CJMPZ/CJMPNZ: argument must be integer. Bytecode offset: %#X\n");
+        }
+        return cond.as_integer() == expected;
+    }
+
+    // The stack interpreter reports errors at its ip and finds the top of the stack through the runtime's bounds.
+    static void sync_state(state& interpreter_state, const register_instruction& insn, const operand_areas& areas) {
+        interpreter_state.set_ip(insn.get_source() + 1);
+        if (insn.get_height() != register_instruction::NO_HEIGHT) {
+            stack<auint>{stack_buf.data(), areas[static_cast<size_t>(operand_area::FRAME)] + insn.get_height()};
+        }
+    }
+
+    // Number of operand type checks the checked form of the instruction runs.
+    static uint64_t get_type_checks_size(register_op op) noexcept {
+        switch (op) {
+            case register_op::EQ:
+            case register_op::EQ_INT:
+            case register_op::JZ:
+            case register_op::JNZ:
+            case register_op::JZ_INT:
+            case register_op::JNZ_INT:
+                return 1;
+            case register_op::MOVE:
+            case register_op::JMP:
+            case register_op::EXECUTE:
+            case register_op::TRANSFER:
+            case register_op::RET:
+            case register_op::STOP:
+                return 0;
+            default:
+                return 2;
+        }
+    }
+
+    static bool is_check_free(register_op op) noexcept {
+        return (op >= register_op::ADD_INT && op <= register_op::ELEM_AGGREGATE) || op == register_op::JZ_INT || op == register_op::JNZ_INT;
+    }
+
+    template <bool Counting>
+    static register_statistics run(state& interpreter_state, const register_program& code) {
+        operand_areas areas{nullptr, stack_buf.data(), const_cast<auint*>(code.get_constants().data())};
+        auint*& locals = areas[static_cast<size_t>(operand_area::FRAME)];
+        const program& stack_program = code.get_program();
+        register_statistics statistics;
+        uint32_t pc = code.get_pc(0);
+        while (true) {
+            const register_instruction& insn = code.get_instruction(pc);
+            if constexpr (Counting) {
+                ++statistics.instructions;
+                (is_check_free(insn.get_op()) ? statistics.eliminated_checks : statistics.executed_checks) += get_type_checks_size(insn.get_op());
+            }
+            switch (insn.get_op()) {
+                case register_op::MOVE:
+                    at(areas, insn.get_dst()) = at(areas, insn.get_lhs());
+                    ++pc;
+                    break;
+#define BINOP(op)                                                                   \
+    case register_op::op:                                                           \
+        execute_binop<register_op::op, true>(interpreter_state, insn, areas);       \
+        ++pc;                                                                       \
+        break;                                                                      \
+    case register_op::op##_INT:                                                     \
+        execute_binop<register_op::op, false>(interpreter_state, insn, areas);      \
+        ++pc;                                                                       \
+        break;
+                BINOP(ADD)
+                BINOP(SUB)
+                BINOP(MUL)
+                BINOP(DIV)
+                BINOP(MOD)
+                BINOP(LT)
+                BINOP(LE)
+                BINOP(GT)
+                BINOP(GE)
+                BINOP(EQ)
+                BINOP(NE)
+                BINOP(AND)
+                BINOP(OR)
+#undef BINOP
+                case register_op::ELEM:
+                    execute_elem<true>(interpreter_state, insn, areas);
+                    ++pc;
+                    break;
+                case register_op::ELEM_AGGREGATE:
+                    execute_elem<false>(interpreter_state, insn, areas);
+                    ++pc;
+                    break;
+                case register_op::JMP:
+                    pc = insn.get_target();
+                    break;
+                case register_op::JZ:
+                    pc = execute_cjmp<true>(interpreter_state, insn, areas, 0) ? insn.get_target() : pc + 1;
+                    break;
+                case register_op::JNZ:
+                    pc = execute_cjmp<true>(interpreter_state, insn, areas, 1) ? insn.get_target() : pc + 1;
+                    break;
+                case register_op::JZ_INT:
+                    pc = execute_cjmp<false>(interpreter_state, insn, areas, 0) ? insn.get_target() : pc + 1;
+                    break;
+                case register_op::JNZ_INT:
+                    pc = execute_cjmp<false>(interpreter_state, insn, areas, 1) ? insn.get_target() : pc + 1;
+                    break;
+                case register_op::EXECUTE:
+                    sync_state(interpreter_state, insn, areas);
+                    execute_instruction(interpreter_state, stack_program.get_instruction(insn.get_source()));
+                    ++pc;
+                    break;
+                case register_op::TRANSFER:
+                    sync_state(interpreter_state, insn, areas);
+                    execute_instruction(interpreter_state, stack_program.get_instruction(insn.get_source()));
+                    pc = code.get_pc(interpreter_state.get_ip());
+                    // A tail call from the outermost function leaves no frame until the callee's BEGIN.
+                    if (interpreter_state.has_frame()) {
+                        locals = interpreter_state.get_locals();
+                    }
+                    break;
+                case register_op::RET:
+                    sync_state(interpreter_state, insn, areas);
+                    if (interpreter_state.execute_ret()) {
+                        return statistics;
+                    }
+                    pc = code.get_pc(interpreter_state.get_ip());
+                    locals = interpreter_state.get_locals();
+                    break;
+                case register_op::STOP:
+                    return statistics;
+            }
+        }
+    }
+
+    register_statistics interpret_registers(state& interpreter_state, const register_program& code, bool count_instructions) {
+        return count_instructions ? run<true>(interpreter_state, code) : run<false>(interpreter_state, code);
+    }
+
+}
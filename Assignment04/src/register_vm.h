@@ -0,0 +1,296 @@
+#ifndef REGISTER_VM_H
+#define REGISTER_VM_H
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder.h"
+#include "runtime_interface.h"
+#include "verifier.h"
+
+namespace assignment_04 {
+
+    class state;
+
+    enum class register_op : uint8_t {
+        MOVE,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        LT,
+        LE,
+        GT,
+        GE,
+        EQ,
+        NE,
+        AND,
+        OR,
+        ELEM,
+        // Variants whose operand types the verifier has proven, so they skip the type checks.
+        ADD_INT,
+        SUB_INT,
+        MUL_INT,
+        DIV_INT,
+        MOD_INT,
+        LT_INT,
+        LE_INT,
+        GT_INT,
+        GE_INT,
+        EQ_INT,
+        NE_INT,
+        AND_INT,
+        OR_INT,
+        ELEM_AGGREGATE,
+        JMP,
+        JZ,
+        JNZ,
+        JZ_INT,
+        JNZ_INT,
+        EXECUTE,
+        TRANSFER,
+        RET,
+        STOP
+    };
+
+    // Locals are at non-negative frame indices, followed by the operand stack slots; arguments are below the frame record.
+    enum class operand_area : uint8_t {
+        FRAME,
+        GLOBAL,
+        CONSTANT
+    };
+
+    class operand {
+    public:
+        operand() noexcept;
+
+        operand(operand_area area, int32_t index) noexcept;
+
+        [[nodiscard]] operand_area get_area() const noexcept;
+
+        [[nodiscard]] int32_t get_index() const noexcept;
+
+        bool operator==(const operand& rhs) const noexcept = default;
+
+    private:
+        int32_t index_;
+        operand_area area_;
+    };
+
+    // EXECUTE and TRANSFER run the source instruction through the stack interpreter with the top of the stack at
+    // `height` frame slots. TRANSFER continues wherever the instruction left the interpreter's ip, which is how calls,
+    // returns and function entries move between frames.
+    class register_instruction {
+    public:
+        constexpr static uint32_t NO_HEIGHT = static_cast<uint32_t>(-1);
+
+        register_instruction(register_op op, uint32_t source) noexcept;
+
+        [[nodiscard]] register_op get_op() const noexcept;
+
+        [[nodiscard]] uint32_t get_source() const noexcept;
+
+        [[nodiscard]] operand get_dst() const noexcept;
+
+        void set_dst(operand dst) noexcept;
+
+        [[nodiscard]] operand get_lhs() const noexcept;
+
+        void set_lhs(operand lhs) noexcept;
+
+        [[nodiscard]] operand get_rhs() const noexcept;
+
+        void set_rhs(operand rhs) noexcept;
+
+        [[nodiscard]] uint32_t get_target() const noexcept;
+
+        void set_target(uint32_t target) noexcept;
+
+        [[nodiscard]] uint32_t get_height() const noexcept;
+
+        void set_height(uint32_t height) noexcept;
+
+    private:
+        operand dst_;
+        operand lhs_;
+        operand rhs_;
+        uint32_t source_;
+        uint32_t target_;
+        uint32_t height_;
+        register_op op_;
+    };
+
+    class register_program {
+    public:
+        explicit register_program(const program& code);
+
+        [[nodiscard]] const program& get_program() const noexcept;
+
+        [[nodiscard]] uint32_t get_size() const noexcept;
+
+        [[nodiscard]] const register_instruction& get_instruction(uint32_t pc) const noexcept;
+
+        [[nodiscard]] register_instruction& get_instruction(uint32_t pc) noexcept;
+
+        void add_instruction(register_instruction insn);
+
+        // First register instruction of the code translated from the stack instruction at the index.
+        [[nodiscard]] uint32_t get_pc(uint32_t index) const noexcept;
+
+        void set_pc(uint32_t index, uint32_t pc) noexcept;
+
+        [[nodiscard]] std::span<const auint> get_constants() const noexcept;
+
+        [[nodiscard]] int32_t add_constant(int32_t constant);
+
+    private:
+        std::vector<register_instruction> instructions_;
+        std::vector<uint32_t> pcs_;
+        std::vector<auint> constants_;
+        std::unordered_map<int32_t, int32_t> constant_indices_;
+        const program& program_;
+    };
+
+    // Every operand stack slot becomes a frame slot right above the locals, at the height the verifier computed for it.
+    // Loads and constants are not copied to their slots until something needs them there: arithmetic, ELEM, stores
+    // and conditional jumps read them where they are, and stores write straight into the variable when the value was
+    // computed by the instruction before. Everything else is synced back to the stack layout and run by the stack
+    // interpreter, so the garbage collector and the frames see exactly what the stack interpreter would leave.
+    class register_translator {
+    public:
+        register_translator(const program& code, const verification_result& verification);
+
+        register_program translate();
+
+    private:
+        const program& program_;
+        const verification_result& verification_;
+        register_program result_;
+        std::vector<bool> leaders_;
+        std::vector<operand> stack_;
+        bool needs_reset_;
+        uint32_t block_start_;
+        int32_t locals_size_;
+        int32_t args_size_;
+
+        void find_leaders();
+
+        void translate_instruction(uint32_t index);
+
+        void translate_binop(uint32_t index, register_op op, register_op proven_op, inferred_type lhs_type, inferred_type rhs_type);
+
+        void translate_store(uint32_t index, operand dst);
+
+        void translate_execute(uint32_t index, register_op op, int32_t depth);
+
+        void emit(register_instruction insn);
+
+        void sync(uint32_t index);
+
+        [[nodiscard]] operand get_slot(uint32_t depth) const noexcept;
+
+        [[nodiscard]] operand pop();
+    };
+
+    // Counted only when asked for. A type check is eliminated when it would have run but the instruction was
+    // translated to a variant that skips it.
+    struct register_statistics {
+        uint64_t instructions = 0;
+        uint64_t executed_checks = 0;
+        uint64_t eliminated_checks = 0;
+    };
+
+    register_program translate_to_registers(const program& code, const verification_result& verification);
+
+    register_statistics interpret_registers(state& interpreter_state, const register_program& code, bool count_instructions);
+
+    inline operand_area operand::get_area() const noexcept {
+        return area_;
+    }
+
+    inline int32_t operand::get_index() const noexcept {
+        return index_;
+    }
+
+    inline register_op register_instruction::get_op() const noexcept {
+        return op_;
+    }
+
+    inline uint32_t register_instruction::get_source() const noexcept {
+        return source_;
+    }
+
+    inline operand register_instruction::get_dst() const noexcept {
+        return dst_;
+    }
+
+    inline void register_instruction::set_dst(operand dst) noexcept {
+        dst_ = dst;
+    }
+
+    inline operand register_instruction::get_lhs() const noexcept {
+        return lhs_;
+    }
+
+    inline void register_instruction::set_lhs(operand lhs) noexcept {
+        lhs_ = lhs;
+    }
+
+    inline operand register_instruction::get_rhs() const noexcept {
+        return rhs_;
+    }
+
+    inline void register_instruction::set_rhs(operand rhs) noexcept {
+        rhs_ = rhs;
+    }
+
+    inline uint32_t register_instruction::get_target() const noexcept {
+        return target_;
+    }
+
+    inline void register_instruction::set_target(uint32_t target) noexcept {
+        target_ = target;
+    }
+
+    inline uint32_t register_instruction::get_height() const noexcept {
+        return height_;
+    }
+
+    inline void register_instruction::set_height(uint32_t height) noexcept {
+        height_ = height;
+    }
+
+    inline const program& register_program::get_program() const noexcept {
+        return program_;
+    }
+
+    inline uint32_t register_program::get_size() const noexcept {
+        return instructions_.size();
+    }
+
+    inline const register_instruction& register_program::get_instruction(uint32_t pc) const noexcept {
+        return instructions_[pc];
+    }
+
+    inline register_instruction& register_program::get_instruction(uint32_t pc) noexcept {
+        return instructions_[pc];
+    }
+
+    inline uint32_t register_program::get_pc(uint32_t index) const noexcept {
+        return pcs_[index];
+    }
+
+    inline void register_program::set_pc(uint32_t index, uint32_t pc) noexcept {
+        pcs_[index] = pc;
+    }
+
+    inline std::span<const auint> register_program::get_constants() const noexcept {
+        return constants_;
+    }
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "sampling_profiler.h"
+
+#include <iterator>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// Older glibc headers do not name the field that selects the thread a SIGEV_THREAD_ID timer signals.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace assignment_04 {
+
+    static sampling_profiler* active_profiler = nullptr;
+
+    sampling_profiler::sampling_profiler(const state& interpreter_state, const program& code)
+        : state_(interpreter_state)
+        , program_(code)
+        , buffer_(new uint32_t[BUFFER_SIZE])
+        , size_(0)
+        , samples_(0)
+        , dropped_(0)
+        , timer_{}
+        , prev_action_{}
+        , is_running_(false) {
+    }
+
+    sampling_profiler::~sampling_profiler() {
+        stop();
+    }
+
+    void sampling_profiler::start(uint32_t frequency) {
+        active_profiler = this;
+        struct sigaction sa{};
+        sa.sa_handler = handle_sigprof;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, &prev_action_) != 0) {
+            std::perror("sigaction failed");
+            std::exit(EXIT_FAILURE);
+        }
+        struct sigevent sev{};
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev.sigev_notify_thread_id = gettid();
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer_) != 0) {
+            std::perror("timer_create failed");
+            std::exit(EXIT_FAILURE);
+        }
+        is_running_ = true;
+        long interval = 1000000000L / frequency;
+        struct itimerspec spec{};
+        spec.it_interval.tv_sec = interval / 1000000000L;
+        spec.it_interval.tv_nsec = interval % 1000000000L;
+        spec.it_value = spec.it_interval;
+        if (timer_settime(timer_, 0, &spec, nullptr) != 0) {
+            std::perror("timer_settime failed");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // A signal still pending after the timer is deleted finds no profiler and is ignored.
+    void sampling_profiler::stop() noexcept {
+        if (!is_running_) {
+            return;
+        }
+        timer_delete(timer_);
+        active_profiler = nullptr;
+        sigaction(SIGPROF, &prev_action_, nullptr);
+        is_running_ = false;
+    }
+
+    void sampling_profiler::record() noexcept {
+        if (BUFFER_SIZE - size_ < MAX_DEPTH + 2) {
+            ++dropped_;
+            return;
+        }
+        uint32_t* sample = buffer_.get() + size_;
+        size_t depth = state_.sample_stack(std::span<uint32_t>{sample + 1, MAX_DEPTH + 1});
+        if (depth > MAX_DEPTH) {
+            sample[MAX_DEPTH] = TRUNCATED;
+            depth = MAX_DEPTH;
+        }
+        sample[0] = static_cast<uint32_t>(depth);
+        size_ += depth + 1;
+        ++samples_;
+    }
+
+    void sampling_profiler::handle_sigprof(int sig) noexcept {
+        static_cast<void>(sig);
+        if (active_profiler != nullptr) {
+            active_profiler->record();
+        }
+    }
+
+    void sampling_profiler::write(std::ostream& os) const {
+        std::map<uint32_t, std::string> functions;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            const instruction& insn = program_.get_instruction(i);
+            if (insn.get_op() == bytecode::BEGIN || insn.get_op() == bytecode::CBEGIN) {
+                functions.emplace(insn.get_offset(), get_function_name(program_.get_bytefile(), insn.get_offset()));
+            }
+        }
+        // The interpreter is at or inside the instruction its own offset points to, a caller right after its call.
+        auto get_running_offset = [this](uint32_t offset, bool is_caller) {
+            uint32_t low = 0;
+            uint32_t high = program_.get_size();
+            while (high - low > 1) {
+                uint32_t mid = low + (high - low) / 2;
+                uint32_t mid_offset = program_.get_instruction(mid).get_offset();
+                if (mid_offset < offset || (!is_caller && mid_offset == offset)) {
+                    low = mid;
+                } else {
+                    high = mid;
+                }
+            }
+            return program_.get_instruction(low).get_offset();
+        };
+        auto get_function_name = [&functions](uint32_t offset) -> std::string_view {
+            auto function = functions.upper_bound(offset);
+            return function == functions.begin() ? std::string_view{"[unknown]"} : std::string_view{std::prev(function)->second};
+        };
+        std::map<std::string, uint64_t> stacks;
+        std::string stack;
+        for (size_t pos = 0; pos < size_;) {
+            size_t depth = buffer_[pos];
+            std::span<const uint32_t> offsets(buffer_.get() + pos + 1, depth);
+            pos += depth + 1;
+            stack.clear();
+            for (size_t i = depth; i-- > 0;) {
+                if (offsets[i] == TRUNCATED) {
+                    stack += "[truncated]";
+                } else {
+                    stack += get_function_name(get_running_offset(offsets[i], i > 0));
+                }
+                stack += ';';
+            }
+            char leaf[16];
+            std::snprintf(leaf, sizeof(leaf), "%#x", depth == 0 ? 0 : get_running_offset(offsets[0], false));
+            stack += leaf;
+            ++stacks[stack];
+        }
+        for (const auto& [folded, samples] : stacks) {
+            os << folded << " " << samples << "\n";
+        }
+    }
+
+}
@@ -0,0 +1,71 @@
+#ifndef SAMPLING_PROFILER_H
+#define SAMPLING_PROFILER_H
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <ostream>
+#include <signal.h>
+
+#include "decoder.h"
+#include "interpreter.h"
+
+namespace assignment_04 {
+
+    // Samples the Lama call stack on a timer that counts the CPU time of the interpreter thread. The signal handler
+    // only copies the offsets of the frames into a buffer allocated up front; they are mapped to functions when the
+    // profile is written. Samples that no longer fit in the buffer are counted and dropped.
+    class sampling_profiler {
+    public:
+        constexpr static size_t MAX_DEPTH = 128;
+        constexpr static size_t BUFFER_SIZE = size_t{1} << 22;
+
+        sampling_profiler(const state& interpreter_state, const program& code);
+
+        sampling_profiler(const sampling_profiler&) = delete;
+
+        sampling_profiler& operator=(const sampling_profiler&) = delete;
+
+        ~sampling_profiler();
+
+        void start(uint32_t frequency);
+
+        void stop() noexcept;
+
+        [[nodiscard]] uint64_t get_samples() const noexcept;
+
+        [[nodiscard]] uint64_t get_dropped() const noexcept;
+
+        // One line per distinct stack in the folded format of flame graph tools: the functions from the outermost one,
+        // then the offset of the running instruction, and the number of samples.
+        void write(std::ostream& os) const;
+
+    private:
+        constexpr static uint32_t TRUNCATED = static_cast<uint32_t>(-1);
+
+        const state& state_;
+        const program& program_;
+        std::unique_ptr<uint32_t[]> buffer_;
+        size_t size_;
+        uint64_t samples_;
+        uint64_t dropped_;
+        timer_t timer_;
+        struct sigaction prev_action_;
+        bool is_running_;
+
+        void record() noexcept;
+
+        static void handle_sigprof(int sig) noexcept;
+    };
+
+    inline uint64_t sampling_profiler::get_samples() const noexcept {
+        return samples_;
+    }
+
+    inline uint64_t sampling_profiler::get_dropped() const noexcept {
+        return dropped_;
+    }
+
+}
+
+#endif
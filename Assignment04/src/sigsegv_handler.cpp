@@ -0,0 +1,89 @@
+#include "sigsegv_handler.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+
+namespace assignment_04 {
+
+    class guard {
+    public:
+        guard() noexcept = default;
+
+        guard(const std::byte* first, const std::byte* last, std::string_view message) noexcept;
+
+        [[nodiscard]] bool contains(const std::byte* addr) const noexcept;
+
+        [[nodiscard]] std::string_view get_message() const noexcept;
+
+    private:
+        const std::byte* first_ = nullptr;
+        const std::byte* last_ = nullptr;
+        std::string_view message_;
+    };
+
+    constexpr static size_t MAX_GUARDS = 4;
+
+    static std::array<guard, MAX_GUARDS> guards;
+    static size_t guards_size = 0;
+    static struct sigaction prev_handler;
+
+    guard::guard(const std::byte* first, const std::byte* last, std::string_view message) noexcept
+        : first_(first)
+        , last_(last)
+        , message_(message) {
+    }
+
+    bool guard::contains(const std::byte* addr) const noexcept {
+        return addr >= first_ && addr < last_;
+    }
+
+    std::string_view guard::get_message() const noexcept {
+        return message_;
+    }
+
+    static void sigsegv_handler(int sig, siginfo_t* info, void* ucontext) {
+        const std::byte* mem_hit = static_cast<const std::byte*>(info->si_addr);
+        for (size_t i = 0; i < guards_size; ++i) {
+            if (guards[i].contains(mem_hit)) {
+                static std::array<std::string_view, 3> messages{"*** FAILURE: ", guards[i].get_message(), "\n"};
+                for (std::string_view message : messages) {
+                    write(STDERR_FILENO, message.data(), message.length());
+                }
+                std::_Exit(255);
+            }
+        }
+        if (prev_handler.sa_handler == SIG_DFL) {
+            sigaction(sig, &prev_handler, nullptr);
+            raise(sig);
+        } else if (prev_handler.sa_handler != SIG_IGN) {
+            prev_handler.sa_sigaction(sig, info, ucontext);
+        }
+    }
+
+    void register_guard(const std::byte* guard_first, const std::byte* guard_last, std::string_view message) {
+        if (guards_size == MAX_GUARDS) {
+            std::fputs("too many guards\n", stderr);
+            std::exit(EXIT_FAILURE);
+        }
+        guards[guards_size++] = guard{guard_first, guard_last, message};
+    }
+
+    void register_sigsegv_handler() {
+        struct sigaction current;
+        if (sigaction(SIGSEGV, nullptr, &current) == 0 && (current.sa_flags & SA_SIGINFO) != 0 && current.sa_sigaction == sigsegv_handler) {
+            return;
+        }
+        struct sigaction sa;
+        sa.sa_flags = SA_SIGINFO;
+        sa.sa_sigaction = sigsegv_handler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGSEGV, &sa, &prev_handler) != 0) {
+            std::perror("sigaction failed");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+}
@@ -0,0 +1,17 @@
+#ifndef SIGSEGV_HANDLER_H
+#define SIGSEGV_HANDLER_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace assignment_04 {
+
+    // A fault inside a registered guard ends the program with the message, reported the way the interpreter reports
+    // its own errors. The message must outlive the program.
+    void register_guard(const std::byte* guard_first, const std::byte* guard_last, std::string_view message);
+
+    void register_sigsegv_handler();
+
+}
+
+#endif
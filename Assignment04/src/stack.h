@@ -1,18 +1,56 @@
 #ifndef STACK_H
 #define STACK_H
 
-#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <iterator>
 #include <new>
+#include <sys/mman.h>
 #include <type_traits>
+#include <unistd.h>
 #include <utility>
 
 #include "runtime_interface.h"
 
 namespace assignment_04 {
 
-    constexpr inline size_t MAX_STACK_SIZE = 0xFFFFF;
-    inline std::array<auint, MAX_STACK_SIZE> stack_buf{};
+    // The buffer is reserved address space with an inaccessible guard right after its end. Pages are only backed by
+    // memory once the stack reaches them, and running into the guard faults instead of needing a bounds check.
+    template <class T>
+    class guarded_buffer {
+    public:
+        guarded_buffer(size_t capacity, size_t guard_capacity) noexcept;
+
+        guarded_buffer(const guarded_buffer<T>& other) = delete;
+
+        guarded_buffer<T>& operator=(const guarded_buffer<T>& rhs) = delete;
+
+        ~guarded_buffer();
+
+        [[nodiscard]] T* data() noexcept;
+
+        [[nodiscard]] T* begin() noexcept;
+
+        T& operator[](size_t idx) noexcept;
+
+        [[nodiscard]] std::byte* get_guard_first() const noexcept;
+
+        [[nodiscard]] std::byte* get_guard_last() const noexcept;
+
+    private:
+        size_t size_;
+        size_t guard_size_;
+        std::byte* base_;
+
+        static size_t next_pagesize(size_t size);
+    };
+
+    constexpr inline size_t MAX_STACK_SIZE = size_t{1} << 27;
+    // BEGIN moves the top of the stack over a two-word frame record and at most 0xFFFF locals, and a frame never grows by
+    // more than 0xFFFF operands past them, so no write can land beyond a guard this large.
+    constexpr inline size_t STACK_GUARD_SIZE = size_t{2} << 16;
+    inline guarded_buffer<auint> stack_buf(MAX_STACK_SIZE, STACK_GUARD_SIZE);
 
     template <class T>
     class stack {
@@ -92,6 +130,57 @@ namespace assignment_04 {
         constexpr typename stack<T>::reference operator[](size_t idx) noexcept;
     };
 
+    template <class T>
+    guarded_buffer<T>::guarded_buffer(size_t capacity, size_t guard_capacity) noexcept
+        : size_(next_pagesize(capacity * sizeof(T)))
+        , guard_size_(next_pagesize(guard_capacity * sizeof(T)))
+        , base_(static_cast<std::byte*>(mmap(nullptr, size_ + guard_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0))) {
+        if (base_ == MAP_FAILED) {
+            std::perror("mmap failed");
+            std::exit(EXIT_FAILURE);
+        }
+        if (mprotect(base_ + size_, guard_size_, PROT_NONE) == -1) {
+            std::perror("mprotect failed");
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    template <class T>
+    guarded_buffer<T>::~guarded_buffer() {
+        munmap(base_, size_ + guard_size_);
+    }
+
+    template <class T>
+    T* guarded_buffer<T>::data() noexcept {
+        return reinterpret_cast<T*>(base_);
+    }
+
+    template <class T>
+    T* guarded_buffer<T>::begin() noexcept {
+        return reinterpret_cast<T*>(base_);
+    }
+
+    template <class T>
+    T& guarded_buffer<T>::operator[](size_t idx) noexcept {
+        return reinterpret_cast<T*>(base_)[idx];
+    }
+
+    template <class T>
+    std::byte* guarded_buffer<T>::get_guard_first() const noexcept {
+        return base_ + size_;
+    }
+
+    template <class T>
+    std::byte* guarded_buffer<T>::get_guard_last() const noexcept {
+        return base_ + size_ + guard_size_;
+    }
+
+    template <class T>
+    size_t guarded_buffer<T>::next_pagesize(size_t size) {
+        static size_t pagesize = sysconf(_SC_PAGESIZE);
+        return (size + pagesize - 1) & ~(pagesize - 1);
+    }
+
     template <class T>
     constexpr stack<T>::stack(pointer first, size_t count) noexcept {
         __gc_stack_top = reinterpret_cast<size_t>(first);
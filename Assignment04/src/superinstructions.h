@@ -0,0 +1,10 @@
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+// Empty until it is generated by Assignment03 --superinstructions=N from the lamac-compiled regression and performance
+// tests, see README.md. Each entry is X(name, opcodes...), ordered by the number of dispatches it saves on the corpus on
+// top of the entries before it.
+
+#define ASSIGNMENT04_SUPERINSTRUCTIONS(X)
+
+#endif
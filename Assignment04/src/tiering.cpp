@@ -0,0 +1,121 @@
+#include "tiering.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace assignment_04 {
+
+    function_profile::function_profile(uint32_t begin) noexcept
+        : begin_(begin)
+        , calls_(0)
+        , back_edges_(0)
+        , tier_(tier::INTERPRETED)
+        , handler_(nullptr) {
+    }
+
+    tiering_manager::tiering_manager(const program& code, const verification_result& verification, const options& opts)
+        : code_(code)
+        , compiler_(code_, verification)
+        , function_ids_(code_.get_size(), program::NO_INDEX)
+        , call_threshold_(opts.get_call_threshold())
+        , back_edge_threshold_(opts.get_back_edge_threshold())
+        , log_(opts.has_tiering_log())
+        , has_ready_(false)
+        , stopped_(false) {
+        for (uint32_t i = 0; i < code_.get_size(); ++i) {
+            uint32_t end = compiler_.get_function_end(i);
+            if (end == program::NO_INDEX) {
+                continue;
+            }
+            for (uint32_t j = i; j < end; ++j) {
+                function_ids_[j] = profiles_.size();
+            }
+            profiles_.emplace_back(i);
+        }
+    }
+
+    tiering_manager::~tiering_manager() {
+        if (!worker_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard lock(mutex_);
+            stopped_ = true;
+        }
+        queue_updated_.notify_one();
+        worker_.join();
+    }
+
+    void tiering_manager::set_handler(uint32_t begin, const void* handler) noexcept {
+        profiles_[function_ids_[begin]].set_handler(handler);
+    }
+
+    std::vector<uint32_t> tiering_manager::take_ready() {
+        std::vector<uint32_t> entries;
+        std::lock_guard lock(mutex_);
+        has_ready_.store(false, std::memory_order_relaxed);
+        for (auto [function, is_compiled] : results_) {
+            function_profile& profile = profiles_[function];
+            if (!is_compiled) {
+                profile.set_tier(tier::FAILED);
+                continue;
+            }
+            profile.set_tier(tier::NATIVE);
+            size_t entries_size = entries.size();
+            for (uint32_t i = profile.get_begin(); i < compiler_.get_function_end(profile.get_begin()); ++i) {
+                if (compiler_.get_entry(i) != nullptr) {
+                    entries.push_back(i);
+                }
+            }
+            if (log_) {
+                std::fprintf(stderr, "[tiering] function at %#X switched to native code (%zu entries)\n", code_.get_offset(profile.get_begin()), entries.size() - entries_size);
+            }
+        }
+        results_.clear();
+        return entries;
+    }
+
+    void tiering_manager::enqueue(uint32_t function) {
+        function_profile& profile = profiles_[function];
+        profile.set_tier(tier::QUEUED);
+        if (log_) {
+            std::fprintf(stderr, "[tiering] function at %#X queued for compilation (calls: %u, back edges: %u)\n", code_.get_offset(profile.get_begin()), profile.get_calls(), profile.get_back_edges());
+        }
+        {
+            std::lock_guard lock(mutex_);
+            queue_.push_back(function);
+        }
+        if (!worker_.joinable()) {
+            worker_ = std::thread(&tiering_manager::run, this);
+        }
+        queue_updated_.notify_one();
+    }
+
+    void tiering_manager::run() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            queue_updated_.wait(lock, [this] { return stopped_ || !queue_.empty(); });
+            if (stopped_) {
+                return;
+            }
+            uint32_t function = queue_.front();
+            queue_.pop_front();
+            uint32_t begin = profiles_[function].get_begin();
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            bool is_compiled = compiler_.compile(begin);
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            if (log_) {
+                if (is_compiled) {
+                    std::fprintf(stderr, "[tiering] function at %#X compiled in %lld us\n", code_.get_offset(begin), static_cast<long long>(duration.count()));
+                } else {
+                    std::fprintf(stderr, "[tiering] function at %#X can not be compiled, staying in the interpreter\n", code_.get_offset(begin));
+                }
+            }
+            lock.lock();
+            results_.emplace_back(function, is_compiled);
+            has_ready_.store(true, std::memory_order_release);
+        }
+    }
+
+}
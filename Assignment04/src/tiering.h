@@ -0,0 +1,168 @@
+#ifndef TIERING_H
+#define TIERING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "decoder.h"
+#include "jit.h"
+#include "options.h"
+
+namespace assignment_04 {
+
+    enum class tier : uint8_t {
+        INTERPRETED,
+        QUEUED,
+        NATIVE,
+        FAILED
+    };
+
+    class function_profile {
+    public:
+        explicit function_profile(uint32_t begin) noexcept;
+
+        [[nodiscard]] uint32_t get_begin() const noexcept;
+
+        [[nodiscard]] uint32_t get_calls() const noexcept;
+
+        [[nodiscard]] uint32_t get_back_edges() const noexcept;
+
+        uint32_t add_call() noexcept;
+
+        uint32_t add_back_edge() noexcept;
+
+        [[nodiscard]] tier get_tier() const noexcept;
+
+        void set_tier(tier new_tier) noexcept;
+
+        [[nodiscard]] const void* get_handler() const noexcept;
+
+        void set_handler(const void* handler) noexcept;
+
+    private:
+        uint32_t begin_;
+        uint32_t calls_;
+        uint32_t back_edges_;
+        tier tier_;
+        const void* handler_;
+    };
+
+    // Counts calls and back edges per function and compiles the functions that get hot on a background thread. The
+    // counters and the switch to native code are owned by the interpreter thread; the compiler works on its own copy of
+    // the program, since the interpreter keeps quickening the original one.
+    class tiering_manager {
+    public:
+        tiering_manager(const program& code, const verification_result& verification, const options& opts);
+
+        tiering_manager(const tiering_manager& other) = delete;
+
+        tiering_manager& operator=(const tiering_manager& rhs) = delete;
+
+        ~tiering_manager();
+
+        [[nodiscard]] const jit_compiler& get_compiler() const noexcept;
+
+        void set_handler(uint32_t begin, const void* handler) noexcept;
+
+        [[nodiscard]] const void* record_call(uint32_t begin);
+
+        void record_back_edge(uint32_t index);
+
+        [[nodiscard]] bool has_ready() const noexcept;
+
+        [[nodiscard]] std::vector<uint32_t> take_ready();
+
+    private:
+        program code_;
+        jit_compiler compiler_;
+        std::vector<uint32_t> function_ids_;
+        std::vector<function_profile> profiles_;
+        uint32_t call_threshold_;
+        uint32_t back_edge_threshold_;
+        bool log_;
+        std::atomic<bool> has_ready_;
+        std::mutex mutex_;
+        std::condition_variable queue_updated_;
+        std::deque<uint32_t> queue_;
+        std::vector<std::pair<uint32_t, bool>> results_;
+        bool stopped_;
+        std::thread worker_;
+
+        void enqueue(uint32_t function);
+
+        void run();
+    };
+
+    inline uint32_t function_profile::get_begin() const noexcept {
+        return begin_;
+    }
+
+    inline uint32_t function_profile::get_calls() const noexcept {
+        return calls_;
+    }
+
+    inline uint32_t function_profile::get_back_edges() const noexcept {
+        return back_edges_;
+    }
+
+    inline uint32_t function_profile::add_call() noexcept {
+        return ++calls_;
+    }
+
+    inline uint32_t function_profile::add_back_edge() noexcept {
+        return ++back_edges_;
+    }
+
+    inline tier function_profile::get_tier() const noexcept {
+        return tier_;
+    }
+
+    inline void function_profile::set_tier(tier new_tier) noexcept {
+        tier_ = new_tier;
+    }
+
+    inline const void* function_profile::get_handler() const noexcept {
+        return handler_;
+    }
+
+    inline void function_profile::set_handler(const void* handler) noexcept {
+        handler_ = handler;
+    }
+
+    inline const jit_compiler& tiering_manager::get_compiler() const noexcept {
+        return compiler_;
+    }
+
+    inline const void* tiering_manager::record_call(uint32_t begin) {
+        uint32_t function = function_ids_[begin];
+        function_profile& profile = profiles_[function];
+        if (profile.get_tier() == tier::INTERPRETED && profile.add_call() == call_threshold_) {
+            enqueue(function);
+        }
+        return profile.get_handler();
+    }
+
+    inline void tiering_manager::record_back_edge(uint32_t index) {
+        uint32_t function = function_ids_[index];
+        if (function == program::NO_INDEX) {
+            return;
+        }
+        function_profile& profile = profiles_[function];
+        if (profile.get_tier() == tier::INTERPRETED && profile.add_back_edge() == back_edge_threshold_) {
+            enqueue(function);
+        }
+    }
+
+    inline bool tiering_manager::has_ready() const noexcept {
+        return has_ready_.load(std::memory_order_relaxed);
+    }
+
+}
+
+#endif
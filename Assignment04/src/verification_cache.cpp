@@ -0,0 +1,244 @@
+#include "verification_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "stack.h"
+
+namespace assignment_04 {
+
+    constexpr static std::array<char, 8> CACHE_MAGIC = {'L', 'A', 'M', 'A', 'V', 'R', 'F', 'Y'};
+    constexpr static uint32_t CACHE_VERSION = 3;
+    constexpr static std::string_view CACHE_EXTENSION = ".vcache";
+
+    // Followed by the sections in this order, each starting at a multiple of eight bytes: a copy of the bytefile, stack
+    // depths, operand types, stack map indices, frame sizes, stack map records and the slots of all stack maps.
+    struct cache_header {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t code_size;
+        uint64_t hash;
+        uint64_t bytefile_size;
+        uint32_t stack_depths_size;
+        uint32_t operand_types_size;
+        uint32_t stack_map_indices_size;
+        uint32_t frame_sizes_size;
+        uint32_t stack_maps_size;
+        uint32_t slots_size;
+    };
+
+    struct stack_map_record {
+        uint32_t args_size;
+        uint32_t locals_size;
+        uint32_t slots_size;
+    };
+
+    struct cache_mapping {
+        std::string path;
+        mapped_file file;
+
+        explicit cache_mapping(std::string cache_path)
+            : path(std::move(cache_path))
+            , file(path) {
+        }
+    };
+
+    static uint64_t align_section(uint64_t size) noexcept {
+        return (size + 7) & ~uint64_t{7};
+    }
+
+    uint64_t hash_contents(std::span<const char> data) noexcept {
+        constexpr static uint64_t MULTIPLIER = 0x9E3779B97F4A7C15;
+        uint64_t hash = 0xCBF29CE484222325 ^ data.size();
+        size_t pos = 0;
+        for (; pos + sizeof(uint64_t) <= data.size(); pos += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            std::memcpy(&word, data.data() + pos, sizeof(uint64_t));
+            hash = (hash ^ word) * MULTIPLIER;
+            hash ^= hash >> 29;
+        }
+        for (; pos < data.size(); ++pos) {
+            hash = (hash ^ static_cast<uint8_t>(data[pos])) * MULTIPLIER;
+        }
+        return hash ^ (hash >> 32);
+    }
+
+    std::string get_cache_path(std::string_view bytefile_path, std::string_view cache_dir, uint64_t hash) {
+        if (cache_dir.empty()) {
+            return std::string(bytefile_path) + std::string(CACHE_EXTENSION);
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+        return (std::filesystem::path(cache_dir) / (name + std::string(CACHE_EXTENSION))).string();
+    }
+
+    // The hash only finds the cache, and a hit needs the copy of the bytefile in it to match byte for byte. Every size is
+    // checked against the file and the code, and every depth, type, index and slot against its range, before anything is
+    // used, so a damaged cache is only a miss.
+    static std::optional<verification_result> load_cache(const std::string& path, uint64_t hash, bytefile& file, std::span<const char> contents) {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error) || error) {
+            return std::nullopt;
+        }
+        std::shared_ptr<const cache_mapping> mapping;
+        try {
+            mapping = std::make_shared<const cache_mapping>(path);
+        } catch (const std::runtime_error&) {
+            return std::nullopt;
+        }
+        std::span<const char> data = mapping->file.get_data();
+        cache_header header{};
+        if (data.size() < sizeof(cache_header)) {
+            return std::nullopt;
+        }
+        std::memcpy(&header, data.data(), sizeof(cache_header));
+        if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.hash != hash || header.bytefile_size != contents.size()
+            || header.code_size != file.get_code_size() || header.stack_depths_size != header.code_size || header.operand_types_size != header.code_size
+            || header.stack_map_indices_size != static_cast<uint64_t>(header.code_size) + 1) {
+            return std::nullopt;
+        }
+        uint64_t pos = align_section(sizeof(cache_header));
+        auto take = [&data, &pos](uint64_t count, size_t size) -> const char* {
+            uint64_t start = pos;
+            pos = align_section(pos + count * size);
+            return pos <= data.size() ? data.data() + start : nullptr;
+        };
+        const char* bytefile_copy = take(header.bytefile_size, sizeof(char));
+        if (bytefile_copy == nullptr || std::memcmp(bytefile_copy, contents.data(), contents.size()) != 0) {
+            return std::nullopt;
+        }
+        const char* stack_depths = take(header.stack_depths_size, sizeof(int32_t));
+        const char* types = take(header.operand_types_size, sizeof(operand_types));
+        const char* stack_map_indices = take(header.stack_map_indices_size, sizeof(uint32_t));
+        const char* frame_sizes_data = take(header.frame_sizes_size, sizeof(frame_size));
+        const char* records = take(header.stack_maps_size, sizeof(stack_map_record));
+        const char* slots = take(header.slots_size, sizeof(slot_kind));
+        if (stack_depths == nullptr || types == nullptr || stack_map_indices == nullptr || frame_sizes_data == nullptr || records == nullptr || slots == nullptr) {
+            return std::nullopt;
+        }
+        std::span<const int32_t> depths{static_cast<const int32_t*>(static_cast<const void*>(stack_depths)), header.stack_depths_size};
+        std::span<const operand_types> types_span{static_cast<const operand_types*>(static_cast<const void*>(types)), header.operand_types_size};
+        std::span<const uint32_t> indices{static_cast<const uint32_t*>(static_cast<const void*>(stack_map_indices)), header.stack_map_indices_size};
+        std::span<const slot_kind> slots_span{static_cast<const slot_kind*>(static_cast<const void*>(slots)), header.slots_size};
+        auto is_valid_type = [](inferred_type type) {
+            return type <= inferred_type::AGGREGATE;
+        };
+        if (!std::all_of(depths.begin(), depths.end(), [](int32_t depth) { return depth >= verification_result::NO_DEPTH && depth < static_cast<int32_t>(MAX_STACK_SIZE); })
+            || !std::all_of(types_span.begin(), types_span.end(), [&is_valid_type](const operand_types& pair) { return is_valid_type(pair[0]) && is_valid_type(pair[1]); })
+            || !std::all_of(indices.begin(), indices.end(), [&header](uint32_t index) { return index == verification_result::NO_STACK_MAP || index < header.stack_maps_size; })
+            || !std::all_of(slots_span.begin(), slots_span.end(), [](slot_kind kind) { return kind <= slot_kind::ROOT; })) {
+            return std::nullopt;
+        }
+        // The frame sizes are written into the code, so each must land on a BEGIN or CBEGIN and keep its locals size.
+        std::vector<frame_size> frame_sizes(header.frame_sizes_size);
+        std::memcpy(frame_sizes.data(), frame_sizes_data, frame_sizes.size() * sizeof(frame_size));
+        for (const frame_size& frame : frame_sizes) {
+            if (static_cast<uint64_t>(frame.offset) + sizeof(bytecode) + 2 * sizeof(int32_t) > file.get_code_size()) {
+                return std::nullopt;
+            }
+            bytecode op = file.get_code(frame.offset);
+            int32_t locals_word = file.get_int32(frame.offset + sizeof(bytecode) + sizeof(int32_t));
+            if ((op != bytecode::BEGIN && op != bytecode::CBEGIN) || (frame.locals_word & 0xFFFF) != (locals_word & 0xFFFF)) {
+                return std::nullopt;
+            }
+        }
+        std::vector<stack_map> stack_maps;
+        stack_maps.reserve(header.stack_maps_size);
+        uint64_t slots_pos = 0;
+        for (uint32_t i = 0; i < header.stack_maps_size; ++i) {
+            stack_map_record record{};
+            std::memcpy(&record, records + i * sizeof(stack_map_record), sizeof(stack_map_record));
+            if (slots_pos + record.slots_size > header.slots_size || static_cast<uint64_t>(record.args_size) + record.locals_size > record.slots_size) {
+                return std::nullopt;
+            }
+            const slot_kind* first = static_cast<const slot_kind*>(static_cast<const void*>(slots + slots_pos));
+            stack_maps.emplace_back(record.args_size, record.locals_size, std::vector<slot_kind>(first, first + record.slots_size));
+            slots_pos += record.slots_size;
+        }
+        for (const frame_size& frame : frame_sizes) {
+            file.set_int32(frame.offset + sizeof(bytecode) + sizeof(int32_t), frame.locals_word);
+        }
+        return verification_result{std::move(mapping), depths, types_span, indices, std::move(stack_maps), std::move(frame_sizes)};
+    }
+
+    template <typename T>
+    static void write_section(std::ostream& os, std::span<const T> values) {
+        constexpr static std::array<char, 8> PADDING{};
+        uint64_t size = values.size() * sizeof(T);
+        os.write(static_cast<const char*>(static_cast<const void*>(values.data())), static_cast<std::streamsize>(size));
+        os.write(PADDING.data(), static_cast<std::streamsize>(align_section(size) - size));
+    }
+
+    // The cache is written to a temporary file first and renamed over the old one, so a run reading it concurrently
+    // sees either of them whole. A cache that can not be written is only a slower next start.
+    static void store_cache(const std::string& path, uint64_t hash, const bytefile& file, std::span<const char> contents, const verification_result& verification) {
+        std::vector<stack_map_record> records;
+        std::vector<slot_kind> slots;
+        for (const stack_map& map : verification.get_stack_maps()) {
+            records.push_back(stack_map_record{map.get_args_size(), map.get_locals_size(), static_cast<uint32_t>(map.get_slots().size())});
+            slots.insert(slots.end(), map.get_slots().begin(), map.get_slots().end());
+        }
+        cache_header header{CACHE_MAGIC,
+                            CACHE_VERSION,
+                            file.get_code_size(),
+                            hash,
+                            contents.size(),
+                            static_cast<uint32_t>(verification.get_stack_depths().size()),
+                            static_cast<uint32_t>(verification.get_operand_types().size()),
+                            static_cast<uint32_t>(verification.get_stack_map_indices().size()),
+                            static_cast<uint32_t>(verification.get_frame_sizes().size()),
+                            static_cast<uint32_t>(records.size()),
+                            static_cast<uint32_t>(slots.size())};
+        std::error_code error;
+        std::filesystem::path cache_path(path);
+        if (cache_path.has_parent_path()) {
+            std::filesystem::create_directories(cache_path.parent_path(), error);
+        }
+        std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream os(tmp_path, std::ios::binary);
+            write_section(os, std::span<const cache_header>{&header, 1});
+            write_section(os, contents);
+            write_section(os, verification.get_stack_depths());
+            write_section(os, verification.get_operand_types());
+            write_section(os, verification.get_stack_map_indices());
+            write_section(os, verification.get_frame_sizes());
+            write_section(os, std::span<const stack_map_record>{records});
+            write_section(os, std::span<const slot_kind>{slots});
+            if (!os) {
+                std::filesystem::remove(tmp_path, error);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp_path, cache_path, error);
+        if (error) {
+            std::filesystem::remove(tmp_path, error);
+        }
+    }
+
+    verification_result verify_cached(bytefile& file, const mapped_file& mapping, std::string_view cache_dir, uint32_t threads_size) {
+        std::span<const char> data = mapping.get_data();
+        uint64_t hash = hash_contents(data);
+        std::string path = get_cache_path(mapping.get_path(), cache_dir, hash);
+        std::optional<verification_result> cached = load_cache(path, hash, file, data);
+        if (cached) {
+            return std::move(*cached);
+        }
+        // The verifier writes the frame sizes into the code, so the copy is taken first.
+        std::vector<char> contents(data.begin(), data.end());
+        verification_result verification = verify(file, threads_size);
+        store_cache(path, hash, file, contents, verification);
+        return verification;
+    }
+
+}
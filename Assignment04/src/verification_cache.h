@@ -0,0 +1,30 @@
+#ifndef VERIFICATION_CACHE_H
+#define VERIFICATION_CACHE_H
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "bytefile.h"
+#include "file_reader.h"
+#include "verifier.h"
+
+// The verifier's results are saved to a cache file together with a copy of the bytefile. A later run over the same
+// contents, compared byte for byte, maps the cache file, uses its tables in place and only restores the frame sizes the
+// verifier writes into the code, so the bytefile is not verified again. A cache made for other contents, by another
+// version of the format, cut short or with tables that do not fit the code is ignored and replaced. The cache is
+// trusted as much as the interpreter itself.
+namespace assignment_04 {
+
+    [[nodiscard]] uint64_t hash_contents(std::span<const char> data) noexcept;
+
+    // Next to the bytefile when no directory is given, and named by the hash in the directory otherwise.
+    [[nodiscard]] std::string get_cache_path(std::string_view bytefile_path, std::string_view cache_dir, uint64_t hash);
+
+    // Verifies the bytefile unless the cache has the results for its contents, which must not have been changed yet.
+    verification_result verify_cached(bytefile& file, const mapped_file& mapping, std::string_view cache_dir, uint32_t threads_size);
+
+}
+
+#endif
@@ -1,89 +1,493 @@
 #include "verifier.h"
 
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <functional>
+#include <memory>
 #include <optional>
+#include <tuple>
+#include <utility>
 
 #include "stack.h"
+#include "thread_pool.h"
 
 namespace assignment_04 {
 
-    stack_size::stack_size() noexcept
-        : stack_size(NO_VALUE) {
+    stack_map::stack_map(uint32_t args_size, uint32_t locals_size, std::vector<slot_kind> slots)
+        : slots_(std::move(slots))
+        , args_size_(args_size)
+        , locals_size_(locals_size) {
+    }
+
+    // The tables are kept together on the heap, where moving the result leaves them.
+    verification_result::verification_result(std::vector<int32_t> stack_depths, std::vector<operand_types> operand_types, std::vector<uint32_t> stack_map_indices,
+                                             std::vector<stack_map> stack_maps, std::vector<frame_size> frame_sizes)
+        : stack_maps_(std::move(stack_maps))
+        , frame_sizes_(std::move(frame_sizes)) {
+        using tables = std::tuple<std::vector<int32_t>, std::vector<assignment_04::operand_types>, std::vector<uint32_t>>;
+        auto storage = std::make_shared<const tables>(std::move(stack_depths), std::move(operand_types), std::move(stack_map_indices));
+        stack_depths_ = std::get<0>(*storage);
+        operand_types_ = std::get<1>(*storage);
+        stack_map_indices_ = std::get<2>(*storage);
+        storage_ = std::move(storage);
+    }
+
+    verification_result::verification_result(std::shared_ptr<const void> storage, std::span<const int32_t> stack_depths, std::span<const operand_types> operand_types,
+                                             std::span<const uint32_t> stack_map_indices, std::vector<stack_map> stack_maps, std::vector<frame_size> frame_sizes) noexcept
+        : storage_(std::move(storage))
+        , stack_depths_(stack_depths)
+        , operand_types_(operand_types)
+        , stack_map_indices_(stack_map_indices)
+        , stack_maps_(std::move(stack_maps))
+        , frame_sizes_(std::move(frame_sizes)) {
+    }
+
+    static inferred_type join(inferred_type lhs, inferred_type rhs) noexcept {
+        if (lhs == rhs) {
+            return lhs;
+        }
+        bool is_lhs_reference = lhs == inferred_type::REF || lhs == inferred_type::AGGREGATE;
+        bool is_rhs_reference = rhs == inferred_type::REF || rhs == inferred_type::AGGREGATE;
+        return is_lhs_reference && is_rhs_reference ? inferred_type::REF : inferred_type::UNKNOWN;
     }
 
-    stack_size::stack_size(int32_t repr) noexcept
-        : repr_(repr) {
+    type_frame::type_frame(uint32_t variables_size)
+        : variables_(variables_size, inferred_type::UNKNOWN) {
     }
 
-    stack_size::stack_size(from_initial, uint32_t val) noexcept
-        : stack_size(-1 * static_cast<int32_t>(val) - 2) {
+    void type_frame::push(inferred_type type) {
+        stack_.push_back(type);
     }
 
-    stack_size::stack_size(from_processed, uint32_t val) noexcept
-        : stack_size(static_cast<int32_t>(val)) {
+    inferred_type type_frame::pop() noexcept {
+        if (stack_.empty()) {
+            return inferred_type::UNKNOWN;
+        }
+        inferred_type type = stack_.back();
+        stack_.pop_back();
+        return type;
     }
 
-    workset_entry::workset_entry(auint repr) noexcept
-        : repr_(repr) {
+    void type_frame::pop(uint32_t count) noexcept {
+        stack_.resize(count < stack_.size() ? stack_.size() - count : 0);
     }
 
-    workset_entry::workset_entry(from_instruction, uint32_t val) noexcept
-        : workset_entry(static_cast<auint>(val) << 1) {
+    bool type_frame::join(const type_frame& other) noexcept {
+        bool is_changed = false;
+        for (size_t i = 0; i < variables_.size(); ++i) {
+            inferred_type type = assignment_04::join(variables_[i], other.variables_[i]);
+            is_changed |= type != variables_[i];
+            variables_[i] = type;
+        }
+        // The verifier has checked that the heights agree at merge points.
+        for (size_t i = 0; i < stack_.size() && i < other.stack_.size(); ++i) {
+            inferred_type type = assignment_04::join(stack_[i], other.stack_[i]);
+            is_changed |= type != stack_[i];
+            stack_[i] = type;
+        }
+        return is_changed;
     }
 
-    workset_entry::workset_entry(from_frame, uint32_t val) noexcept
-        : workset_entry((static_cast<auint>(val) << 1) | 1) {
+    type_inference::type_inference(const program& code)
+        : program_(code)
+        , operand_types_(code.get_bytefile().get_code_size(), operand_types{inferred_type::UNKNOWN, inferred_type::UNKNOWN})
+        , stack_map_indices_(code.get_bytefile().get_code_size() + 1, verification_result::NO_STACK_MAP) {
     }
 
-    verifier::verifier(bytefile& file, public_symbol entrypoint)
-        : addr_(0)
-        , frames_depth_(0)
-        , current_frame_addr_(entrypoint.get_address())
-        , current_frame_stack_size_(0)
-        , stack_sizes_(file.get_code_size())
-        , current_stack_size_(0)
-        , workset_(stack_buf.begin(), 0)
-        , bytefile_(file)
-        , entrypoint_(entrypoint) {
+    // Runs the action on the calling thread and on threads_size - 1 pool threads. The action must only return once there
+    // is nothing left for any thread to do: stopping the pool waits for the actions that are running and skips the ones
+    // that have not started.
+    template <std::invocable T>
+    static void run_on_threads(uint32_t threads_size, const T& action) {
+        std::optional<assignment_10::thread_pool<std::function<void()>>> pool;
+        if (threads_size > 1) {
+            pool.emplace(threads_size - 1, threads_size - 1);
+            for (uint32_t thread = 1; thread < threads_size; ++thread) {
+                pool->submit(action);
+            }
+        }
+        action();
     }
 
-    void verifier::traverse_bytecode() {
-        push(workset_entry{from_instruction_t, entrypoint_.get_address()});
-        while (!workset_.empty()) {
-            if (peek().is_frame()) {
-                current_frame_addr_ = pop().get_value();
-                current_frame_stack_size_ = pop().get_value();
-                --frames_depth_;
+    void type_inference::infer(uint32_t threads_size) {
+        std::vector<std::pair<uint32_t, uint32_t>> functions;
+        uint32_t begin = program::NO_INDEX;
+        for (uint32_t i = 0; i < program_.get_size(); ++i) {
+            bytecode op = program_.get_instruction(i).get_op();
+            if (op != bytecode::BEGIN && op != bytecode::CBEGIN && op != bytecode::STOP) {
                 continue;
             }
-            addr_ = pop().get_value();
-            if (stack_sizes_.at(addr_).is_initial()) {
-                current_stack_size_ = static_cast<int32_t>(stack_sizes_.at(addr_).get_value());
+            if (begin != program::NO_INDEX) {
+                functions.emplace_back(begin, i);
             }
-            current_stack_size_ += get_stack_delta();
-            validate(current_stack_size_ >= 0, "Stack underflow. Bytecode offset: %#X\n");
-            validate(current_stack_size_ < MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n");
-            if (stack_sizes_.at(addr_).is_processed()) {
-                if (!workset_.empty() && peek().is_instruction()) {
-                    uint32_t next_addr = peek().get_value();
-                    current_stack_size_ = static_cast<int32_t>(stack_sizes_.at(next_addr).get_value());
-                    validate(stack_sizes_.at(next_addr).has_value(), "Ill-formed control-flow. Bytecode offset: %#X\n");
-                    if (stack_sizes_.at(next_addr).is_processed()) {
-                        stack_sizes_[next_addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
+            begin = i;
+        }
+        std::vector<std::vector<std::pair<uint32_t, stack_map>>> function_stack_maps(functions.size());
+        std::atomic<size_t> next_function = 0;
+        run_on_threads(threads_size, [this, &functions, &function_stack_maps, &next_function]() {
+            for (size_t i = next_function++; i < functions.size(); i = next_function++) {
+                infer_function(functions[i].first, functions[i].second, function_stack_maps[i]);
+            }
+        });
+        for (std::vector<std::pair<uint32_t, stack_map>>& stack_maps : function_stack_maps) {
+            for (auto& [resume_offset, map] : stack_maps) {
+                stack_map_indices_[resume_offset] = static_cast<uint32_t>(stack_maps_.size());
+                stack_maps_.push_back(std::move(map));
+            }
+        }
+    }
+
+    void type_inference::infer_function(uint32_t begin, uint32_t end, std::vector<std::pair<uint32_t, stack_map>>& stack_maps) {
+        const instruction& entry = program_.get_instruction(begin);
+        uint32_t args_size = static_cast<uint32_t>(entry.get_first_arg());
+        uint32_t locals_size = static_cast<uint32_t>(entry.get_second_arg()) & 0xFFFF;
+        // Variables whose address is taken may be changed by any store through a reference.
+        std::vector<bool> is_escaping(args_size + locals_size, false);
+        for (uint32_t i = begin; i < end; ++i) {
+            const instruction& insn = program_.get_instruction(i);
+            uint32_t addr = static_cast<uint32_t>(insn.get_first_arg());
+            if (insn.get_op() == bytecode::LDA_ARGUMENT && addr < args_size) {
+                is_escaping[addr] = true;
+            } else if (insn.get_op() == bytecode::LDA_LOCAL && addr < locals_size) {
+                is_escaping[args_size + addr] = true;
+            }
+        }
+        std::vector<std::optional<type_frame>> frames(end - begin);
+        frames[0].emplace(args_size + locals_size);
+        std::vector<uint32_t> workset{begin};
+        auto propagate = [&](uint32_t target, const type_frame& frame) {
+            if (target < begin || target >= end) {
+                return;
+            }
+            std::optional<type_frame>& target_frame = frames[target - begin];
+            if (!target_frame.has_value()) {
+                target_frame = frame;
+                workset.push_back(target);
+            } else if (target_frame->join(frame)) {
+                workset.push_back(target);
+            }
+        };
+        while (!workset.empty()) {
+            uint32_t index = workset.back();
+            workset.pop_back();
+            const instruction& insn = program_.get_instruction(index);
+            type_frame frame = *frames[index - begin];
+            transfer(insn, frame, args_size, is_escaping);
+            switch (insn.get_op()) {
+                case bytecode::JMP:
+                    propagate(insn.get_target(), frame);
+                    break;
+                case bytecode::CJMPZ:
+                case bytecode::CJMPNZ:
+                    propagate(insn.get_target(), frame);
+                    propagate(index + 1, frame);
+                    break;
+                case bytecode::END:
+                case bytecode::RET:
+                case bytecode::FAIL:
+                case bytecode::STOP:
+                    break;
+                default:
+                    propagate(index + 1, frame);
+                    break;
+            }
+        }
+        for (uint32_t i = begin; i < end; ++i) {
+            if (frames[i - begin].has_value()) {
+                operand_types_[program_.get_offset(i)] = operand_types{frames[i - begin]->peek(0), frames[i - begin]->peek(1)};
+            }
+        }
+        map_function(begin, end, frames, is_escaping, stack_maps);
+    }
+
+    static bool is_collection_point(bytecode op) noexcept {
+        switch (op) {
+            case bytecode::STRING:
+            case bytecode::SEXP:
+            case bytecode::CLOSURE:
+            case bytecode::CALLC:
+            case bytecode::CALL:
+            case bytecode::CALL_LSTRING:
+            case bytecode::CALL_BARRAY:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // A variable is live before an instruction if some path from it reads the variable before storing to it. Variables
+    // whose address is taken are live everywhere. The maps are keyed by the offset right after the collection point,
+    // which is where the interpreter's ip is while the instruction runs and where a call returns to.
+    void type_inference::map_function(uint32_t begin, uint32_t end, const std::vector<std::optional<type_frame>>& frames, const std::vector<bool>& is_escaping,
+                                      std::vector<std::pair<uint32_t, stack_map>>& stack_maps) {
+        const instruction& entry = program_.get_instruction(begin);
+        uint32_t args_size = static_cast<uint32_t>(entry.get_first_arg());
+        uint32_t locals_size = static_cast<uint32_t>(entry.get_second_arg()) & 0xFFFF;
+        auto get_variable = [&](varspec type, int32_t addr) -> std::optional<uint32_t> {
+            uint32_t pos = static_cast<uint32_t>(addr);
+            if (type == varspec::ARGUMENT && pos < args_size) {
+                return pos;
+            }
+            if (type == varspec::LOCAL && pos < locals_size) {
+                return args_size + pos;
+            }
+            return std::nullopt;
+        };
+        std::vector<std::vector<bool>> live(end - begin, std::vector<bool>(is_escaping.size(), false));
+        bool is_changed = true;
+        while (is_changed) {
+            is_changed = false;
+            for (uint32_t i = end; i-- > begin;) {
+                if (!frames[i - begin].has_value()) {
+                    continue;
+                }
+                const instruction& insn = program_.get_instruction(i);
+                std::vector<bool> live_in(is_escaping.size(), false);
+                auto add_successor = [&](uint32_t target) {
+                    if (target >= begin && target < end) {
+                        for (size_t pos = 0; pos < live_in.size(); ++pos) {
+                            live_in[pos] = live_in[pos] || live[target - begin][pos];
+                        }
                     }
+                };
+                switch (insn.get_op()) {
+                    case bytecode::JMP:
+                        add_successor(insn.get_target());
+                        break;
+                    case bytecode::CJMPZ:
+                    case bytecode::CJMPNZ:
+                        add_successor(insn.get_target());
+                        add_successor(i + 1);
+                        break;
+                    case bytecode::END:
+                    case bytecode::RET:
+                    case bytecode::FAIL:
+                    case bytecode::STOP:
+                        break;
+                    default:
+                        add_successor(i + 1);
+                        break;
+                }
+                switch (insn.get_op()) {
+                    case bytecode::ST_LOCAL:
+                    case bytecode::ST_ARGUMENT:
+                        if (std::optional<uint32_t> pos = get_variable(insn.get_op() == bytecode::ST_LOCAL ? varspec::LOCAL : varspec::ARGUMENT, insn.get_first_arg())) {
+                            live_in[*pos] = false;
+                        }
+                        break;
+                    case bytecode::LD_LOCAL:
+                    case bytecode::LD_ARGUMENT:
+                        if (std::optional<uint32_t> pos = get_variable(insn.get_op() == bytecode::LD_LOCAL ? varspec::LOCAL : varspec::ARGUMENT, insn.get_first_arg())) {
+                            live_in[*pos] = true;
+                        }
+                        break;
+                    case bytecode::CLOSURE:
+                        for (const capture& spec : insn.get_captures()) {
+                            if (std::optional<uint32_t> pos = get_variable(spec.get_type(), spec.get_addr())) {
+                                live_in[*pos] = true;
+                            }
+                        }
+                        break;
+                    default:
+                        break;
                 }
+                for (size_t pos = 0; pos < live_in.size(); ++pos) {
+                    live_in[pos] = live_in[pos] || is_escaping[pos];
+                }
+                if (live_in != live[i - begin]) {
+                    live[i - begin] = std::move(live_in);
+                    is_changed = true;
+                }
+            }
+        }
+        for (uint32_t i = begin; i < end; ++i) {
+            const std::optional<type_frame>& frame = frames[i - begin];
+            if (!frame.has_value() || !is_collection_point(program_.get_instruction(i).get_op())) {
                 continue;
             }
-            stack_sizes_[addr_] = stack_size{from_processed_t, static_cast<uint32_t>(current_stack_size_)};
+            std::vector<slot_kind> slots;
+            slots.reserve(is_escaping.size() + frame->get_stack_size());
+            for (uint32_t pos = 0; pos < is_escaping.size(); ++pos) {
+                if (is_escaping[pos]) {
+                    slots.push_back(slot_kind::ROOT);
+                } else if (!live[i - begin][pos]) {
+                    slots.push_back(slot_kind::DEAD);
+                } else {
+                    slots.push_back(frame->get_variable(pos) == inferred_type::INT ? slot_kind::VALUE : slot_kind::ROOT);
+                }
+            }
+            for (uint32_t depth = frame->get_stack_size(); depth-- > 0;) {
+                slots.push_back(frame->peek(depth) == inferred_type::INT ? slot_kind::VALUE : slot_kind::ROOT);
+            }
+            stack_maps.emplace_back(program_.get_offset(i + 1), stack_map{args_size, locals_size, std::move(slots)});
+        }
+    }
+
+    void type_inference::transfer(const instruction& insn, type_frame& frame, uint32_t args_size, const std::vector<bool>& is_escaping) {
+        auto load = [&](uint32_t pos) {
+            return pos < is_escaping.size() && !is_escaping[pos] ? frame.get_variable(pos) : inferred_type::UNKNOWN;
+        };
+        auto store = [&](uint32_t pos) {
+            if (pos < is_escaping.size() && !is_escaping[pos]) {
+                frame.set_variable(pos, frame.peek());
+            }
+        };
+        uint32_t addr = static_cast<uint32_t>(insn.get_first_arg());
+        switch (insn.get_op()) {
+            case bytecode::LOW_ADD:
+            case bytecode::LOW_SUB:
+            case bytecode::LOW_MUL:
+            case bytecode::LOW_DIV:
+            case bytecode::LOW_MOD:
+            case bytecode::LOW_LT:
+            case bytecode::LOW_LE:
+            case bytecode::LOW_GT:
+            case bytecode::LOW_GE:
+            case bytecode::LOW_EQ:
+            case bytecode::LOW_NE:
+            case bytecode::LOW_AND:
+            case bytecode::LOW_OR:
+            case bytecode::PATT_STR:
+                frame.pop(2);
+                frame.push(inferred_type::INT);
+                break;
+            case bytecode::CONST:
+            case bytecode::CALL_LREAD:
+                frame.push(inferred_type::INT);
+                break;
+            case bytecode::STRING:
+                frame.push(inferred_type::AGGREGATE);
+                break;
+            case bytecode::SEXP:
+                frame.pop(static_cast<uint32_t>(insn.get_second_arg()));
+                frame.push(inferred_type::AGGREGATE);
+                break;
+            case bytecode::CALL_BARRAY:
+                frame.pop(addr);
+                frame.push(inferred_type::AGGREGATE);
+                break;
+            case bytecode::STI: {
+                inferred_type type = frame.pop();
+                frame.pop();
+                frame.push(type);
+                break;
+            }
+            case bytecode::STA:
+                frame.pop(3);
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::DROP:
+            case bytecode::CJMPZ:
+            case bytecode::CJMPNZ:
+                frame.pop();
+                break;
+            case bytecode::DUP:
+                frame.push(frame.peek());
+                break;
+            case bytecode::ELEM:
+                frame.pop(2);
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::LD_GLOBAL:
+            case bytecode::LD_CAPTURED:
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::LD_LOCAL:
+                frame.push(load(args_size + addr));
+                break;
+            case bytecode::LD_ARGUMENT:
+                frame.push(load(addr));
+                break;
+            case bytecode::LDA_GLOBAL:
+            case bytecode::LDA_LOCAL:
+            case bytecode::LDA_ARGUMENT:
+            case bytecode::LDA_CAPTURED:
+            case bytecode::CLOSURE:
+                frame.push(inferred_type::REF);
+                break;
+            case bytecode::ST_LOCAL:
+                store(args_size + addr);
+                break;
+            case bytecode::ST_ARGUMENT:
+                store(addr);
+                break;
+            case bytecode::CALLC:
+                frame.pop(addr + 1);
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::CALL:
+                frame.pop(static_cast<uint32_t>(insn.get_second_arg()));
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::TAG:
+            case bytecode::ARRAY:
+            case bytecode::PATT_STRING:
+            case bytecode::PATT_ARRAY:
+            case bytecode::PATT_SEXP:
+            case bytecode::PATT_REF:
+            case bytecode::PATT_VAL:
+            case bytecode::PATT_FUN:
+            case bytecode::CALL_LLENGTH:
+                frame.pop();
+                frame.push(inferred_type::INT);
+                break;
+            case bytecode::CALL_LWRITE:
+                // The runtime's write returns an untagged zero, which is not an integer.
+                frame.pop();
+                frame.push(inferred_type::UNKNOWN);
+                break;
+            case bytecode::CALL_LSTRING:
+                frame.pop();
+                frame.push(inferred_type::AGGREGATE);
+                break;
+            default:
+                break;
+        }
+    }
+
+    verifier::verifier(bytefile& file, std::span<std::atomic<uint64_t>> claims)
+        : addr_(0)
+        , insn_addr_(0)
+        , function_index_(0)
+        , current_frame_addr_(0)
+        , current_frame_stack_size_(0)
+        , current_stack_size_(0)
+        , call_sites_(nullptr)
+        , bytefile_(file)
+        , claims_(claims) {
+    }
+
+    void verifier::verify_function(uint32_t function_index, uint32_t begin_addr, std::vector<call_site>& call_sites) {
+        function_index_ = function_index;
+        current_frame_addr_ = begin_addr;
+        current_frame_stack_size_ = 0;
+        call_sites_ = &call_sites;
+        addr_ = begin_addr;
+        validate(begin_addr < bytefile_.get_code_size(), "Unexpected end of code. Bytecode offset: %#X\n");
+        validate(peek_next_op() == bytecode::BEGIN || peek_next_op() == bytecode::CBEGIN, "CALL/CALLC destination instruction must be BEGIN or CBEGIN. Bytecode offset: %#X\n");
+        workset_.clear();
+        push(begin_addr, 0);
+        while (!workset_.empty()) {
+            auto [addr, stack_size] = workset_.back();
+            workset_.pop_back();
+            addr_ = addr;
+            insn_addr_ = addr;
+            if (!claim(stack_size)) {
+                continue;
+            }
+            current_stack_size_ = stack_size + get_stack_delta();
+            validate(current_stack_size_ >= 0, "Stack underflow. Bytecode offset: %#X\n");
+            validate(current_stack_size_ < MAX_STACK_SIZE, "Stack overflow. Bytecode offset: %#X\n");
             current_frame_stack_size_ = current_stack_size_ > static_cast<int32_t>(current_frame_stack_size_) ? static_cast<uint32_t>(current_stack_size_) : current_frame_stack_size_;
             bytecode op = pop_next_op();
-            if (op != bytecode::BEGIN && op != bytecode::CBEGIN) {
-                validate(frames_depth_ > 0, "CALL/CALLC destination instruction must be BEGIN or CBEGIN. Bytecode offset: %#X\n");
-            }
             visit_op();
             if (op != bytecode::END && op != bytecode::RET && op != bytecode::FAIL) {
-                push(workset_entry{from_instruction_t, addr_});
+                push(addr_, current_stack_size_);
             }
         }
+        // The frame's largest stack size goes to the upper half of the locals size, which BEGIN masks off.
+        set_locals_size((current_frame_stack_size_ << 16) | (get_locals_size() & 0xFFFF));
     }
 
     bytecode verifier::peek_current_op() const {
@@ -112,19 +516,21 @@ namespace assignment_04 {
         return bytefile_.get_int32(addr_ - sizeof(int32_t));
     }
 
-    workset_entry verifier::peek() const {
-        return workset_entry{workset_[workset_.size() - 1]};
-    }
-
-    void verifier::push(workset_entry val) {
-        workset_ = std::span{stack_buf.begin(), workset_.size() + 1};
-        workset_[workset_.size() - 1] = val.get_repr();
+    void verifier::push(uint32_t addr, int32_t stack_size) {
+        workset_.emplace_back(addr, stack_size);
     }
 
-    workset_entry verifier::pop() {
-        workset_entry val(workset_.back());
-        workset_ = workset_.subspan(0, workset_.size() - 1);
-        return val;
+    // A claim is the index of the function plus one above the stack height the instruction starts with.
+    bool verifier::claim(int32_t stack_size) {
+        std::atomic<uint64_t>& claim = claims_[addr_];
+        uint64_t owner = static_cast<uint64_t>(function_index_ + 1) << 32;
+        uint64_t expected = claim.load(std::memory_order_relaxed);
+        if (expected == 0 && claim.compare_exchange_strong(expected, owner | static_cast<uint32_t>(stack_size), std::memory_order_relaxed)) {
+            return true;
+        }
+        validate((expected & ~uint64_t{0xFFFFFFFF}) == owner, "Ill-formed control-flow. Bytecode offset: %#X\n");
+        validate(static_cast<int32_t>(expected) == stack_size, "Stack size mismatch at merge point. Bytecode offset: %#X\n");
+        return false;
     }
 
         int32_t verifier::get_stack_delta() const {
@@ -161,6 +567,7 @@ namespace assignment_04 {
             case bytecode::LDA_LOCAL:
             case bytecode::LDA_ARGUMENT:
             case bytecode::LDA_CAPTURED:
+            case bytecode::CLOSURE:
             case bytecode::CALL_LREAD:
                 return 1;
             case bytecode::SEXP:
@@ -192,10 +599,6 @@ namespace assignment_04 {
             case bytecode::CALL_LSTRING:
             case bytecode::STOP:
                 return 0;
-            case bytecode::CLOSURE: {
-                int32_t captured_size = bytefile_.get_int32(addr_ + sizeof(bytecode) + sizeof(int32_t));
-                return captured_size + 1;
-            }
             case bytecode::CALLC: {
                 int32_t args_size = bytefile_.get_int32(addr_ + sizeof(bytecode));
                 return -args_size;
@@ -232,10 +635,6 @@ namespace assignment_04 {
             case bytecode::JMP:
                 process_jmp();
                 break;
-            case bytecode::END:
-            case bytecode::RET:
-                process_ret();
-                break;
             case bytecode::LD_GLOBAL:
             case bytecode::LDA_GLOBAL:
             case bytecode::ST_GLOBAL:
@@ -307,6 +706,8 @@ namespace assignment_04 {
             case bytecode::CALL_LWRITE:
             case bytecode::CALL_LLENGTH:
             case bytecode::CALL_LSTRING:
+            case bytecode::END:
+            case bytecode::RET:
             case bytecode::STOP:
                 break;
             default:
@@ -333,33 +734,9 @@ namespace assignment_04 {
     void verifier::process_jmp() {
         int32_t addr = pop_next_int32();
         validate(addr >= 0 && addr < bytefile_.get_code_size(), "JMP: incorrect destination. Bytecode offset: %#X\n");
-        if (!stack_sizes_.at(addr).has_value()) {
-            stack_sizes_[addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
-        } else {
-            validate(stack_sizes_.at(addr_ - sizeof(bytecode) - sizeof(int32_t)).get_value() == static_cast<uint32_t>(current_stack_size_), "JMP: stack size mismatch at merge point. Bytecode offset: %#X\n");
-        }
         addr_ = addr;
     }
 
-    void verifier::process_ret() {
-        if (!workset_.empty() && peek().is_frame()) {
-            pop();
-            pop();
-            --frames_depth_;
-        }
-        uint32_t locals_size = get_locals_size();
-        locals_size = (current_frame_stack_size_ << 16) | (locals_size & 0xFFFF);
-        set_locals_size(locals_size);
-        if (workset_.empty()) {
-            return;
-        }
-        uint32_t next_addr = peek().get_value();
-        current_stack_size_ = static_cast<int32_t>(stack_sizes_.at(next_addr).get_value());
-        if (stack_sizes_.at(next_addr).is_processed()) {
-            stack_sizes_[next_addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
-        }
-    }
-
     void verifier::process_global() {
         int32_t addr = pop_next_int32();
         validate(addr >= 0 && addr < get_globals_size(), "LD/LDA/ST: global index out of bounds. Bytecode offset: %#X\n");
@@ -378,12 +755,7 @@ namespace assignment_04 {
     void verifier::process_cjmp() {
         int32_t addr = pop_next_int32();
         validate(addr >= 0 && addr < bytefile_.get_code_size(), "CJMPZ/CJMPNZ: incorrect destination. Bytecode offset: %#X\n");
-        if (!stack_sizes_.at(addr).has_value()) {
-            stack_sizes_[addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
-            push(workset_entry{from_instruction_t, static_cast<uint32_t>(addr)});
-        } else {
-            validate(stack_sizes_.at(addr_ - sizeof(bytecode) - sizeof(int32_t)).get_value() == static_cast<uint32_t>(current_stack_size_), "JMP: stack size mismatch at merge point. Bytecode offset: %#X\n");
-        }
+        push(static_cast<uint32_t>(addr), current_stack_size_);
     }
 
     void verifier::process_begin() {
@@ -391,10 +763,7 @@ namespace assignment_04 {
         int32_t locals_size = pop_next_int32();
         validate(args_size >= 0, "BEGIN/CBEGIN: args size must be non-negative. Bytecode offset: %#X\n");
         validate(locals_size >= 0, "BEGIN/CBEGIN: locals size must be non-negative. Bytecode offset: %#X\n");
-        push(workset_entry{from_frame_t, current_frame_stack_size_});
-        push(workset_entry{from_frame_t, current_frame_addr_});
-        current_frame_addr_ = addr_ - sizeof(bytecode) - sizeof(int32_t) - sizeof(int32_t);
-        ++frames_depth_;
+        validate(insn_addr_ == current_frame_addr_, "BEGIN/CBEGIN: must start a function. Bytecode offset: %#X\n");
     }
 
     void verifier::process_closure() {
@@ -421,6 +790,12 @@ namespace assignment_04 {
                     validate(false, "CLOSURE: invalid varspec. Bytecode offset: %#X\n");
             }
         }
+        // The captured values are pushed before they are packed into the closure.
+        uint32_t peak_stack_size = static_cast<uint32_t>(current_stack_size_ + captured_size);
+        current_frame_stack_size_ = peak_stack_size > current_frame_stack_size_ ? peak_stack_size : current_frame_stack_size_;
+        // The closure body is verified like a callee, so its stack heights are known even if it is only ever reached
+        // through CALLC.
+        call_sites_->push_back(call_site{insn_addr_, static_cast<uint32_t>(addr), bytecode::CLOSURE, 0});
     }
 
     void verifier::process_callc() {
@@ -433,8 +808,7 @@ namespace assignment_04 {
         int32_t args_size = pop_next_int32();
         validate(addr >= 0 && addr < bytefile_.get_code_size(), "CALL: incorrect destination. Bytecode offset: %#X\n");
         validate(args_size >= 0, "CALL: args size must be non-negative. Bytecode offset: %#X\n");
-        stack_sizes_[addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
-        push(workset_entry{from_instruction_t, static_cast<uint32_t>(addr)});
+        call_sites_->push_back(call_site{insn_addr_, static_cast<uint32_t>(addr), bytecode::CALL, args_size});
     }
 
     void verifier::process_tag() {
@@ -447,22 +821,6 @@ namespace assignment_04 {
     void verifier::process_fail() {
         static_cast<void>(pop_next_int32());
         static_cast<void>(pop_next_int32());
-        if (!workset_.empty() && peek().is_frame()) {
-            pop();
-            pop();
-            --frames_depth_;
-        }
-        uint32_t locals_size = get_locals_size();
-        locals_size = (current_frame_stack_size_ << 16) | (locals_size & 0xFFFF);
-        set_locals_size(locals_size);
-        if (workset_.empty()) {
-            return;
-        }
-        uint32_t next_addr = peek().get_value();
-        current_stack_size_ = static_cast<int32_t>(stack_sizes_.at(next_addr).get_value());
-        if (stack_sizes_.at(next_addr).is_processed()) {
-            stack_sizes_[next_addr] = stack_size{from_initial_t, static_cast<uint32_t>(current_stack_size_)};
-        }
     }
 
     void verifier::process_call_barray() {
@@ -482,13 +840,110 @@ namespace assignment_04 {
         return bytefile_.get_int32(current_frame_addr_ + sizeof(bytecode));
     }
 
-    void verifier::validate(bool condition, std::string_view message) const noexcept {
+    void verifier::validate(bool condition, std::string_view message) const {
         if (!condition) {
-            failure(const_cast<char*>(message.data()), addr_);
+            throw verification_error{message, addr_};
+        }
+    }
+
+    verification_worklist::verification_worklist(bytefile& file, uint32_t entrypoint)
+        : bytefile_(file)
+        , claims_(file.get_code_size())
+        , functions_{entrypoint}
+        , found_{entrypoint}
+        , pending_{0}
+        , busy_size_(0) {
+    }
+
+    void verification_worklist::run() {
+        verifier function_verifier(bytefile_, claims_);
+        std::vector<call_site> call_sites;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (pending_.empty() && busy_size_ > 0) {
+                cond_.wait(lock);
+            }
+            if (pending_.empty()) {
+                cond_.notify_all();
+                return;
+            }
+            uint32_t index = pending_.back();
+            uint32_t begin_addr = functions_[index];
+            pending_.pop_back();
+            ++busy_size_;
+            lock.unlock();
+            call_sites.clear();
+            std::optional<verification_error> error;
+            std::exception_ptr exception;
+            try {
+                function_verifier.verify_function(index, begin_addr, call_sites);
+            } catch (const verification_error& exc) {
+                error = exc;
+            } catch (...) {
+                exception = std::current_exception();
+            }
+            lock.lock();
+            --busy_size_;
+            if (exception) {
+                // The other threads finish the functions they have and find nothing more to do.
+                if (!exception_) {
+                    exception_ = exception;
+                }
+                pending_.clear();
+            } else if (error) {
+                errors_.emplace_back(begin_addr, *error);
+            } else {
+                for (const call_site& site : call_sites) {
+                    if (found_.insert(site.target).second) {
+                        pending_.push_back(static_cast<uint32_t>(functions_.size()));
+                        functions_.push_back(site.target);
+                    }
+                }
+                call_sites_.insert(call_sites_.end(), call_sites.begin(), call_sites.end());
+            }
+            cond_.notify_all();
+        }
+    }
+
+    bool verification_worklist::has_errors() const noexcept {
+        return !errors_.empty();
+    }
+
+    // Which functions fail and what the call sites are does not depend on the order the functions were verified in, so
+    // sorting both makes the reported error the same on every run.
+    void verification_worklist::check() const {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        if (!errors_.empty()) {
+            const verification_error& error = std::min_element(errors_.begin(), errors_.end(), [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+            })->second;
+            failure(const_cast<char*>(error.message.data()), error.offset);
+        }
+        std::vector<call_site> call_sites = call_sites_;
+        std::sort(call_sites.begin(), call_sites.end(), [](const call_site& lhs, const call_site& rhs) {
+            return lhs.offset < rhs.offset;
+        });
+        for (const call_site& site : call_sites) {
+            if (site.op == bytecode::CALL && bytefile_.get_int32(site.target + sizeof(bytecode)) != site.args_size) {
+                failure(const_cast<char*>("CALL: args size does not match the callee. Bytecode offset: %#X\n"), site.offset);
+            }
+        }
+    }
+
+    std::vector<int32_t> verification_worklist::get_stack_depths() const {
+        std::vector<int32_t> stack_depths(claims_.size(), verification_result::NO_DEPTH);
+        for (size_t addr = 0; addr < claims_.size(); ++addr) {
+            uint64_t claim = claims_[addr].load(std::memory_order_relaxed);
+            if (claim != 0) {
+                stack_depths[addr] = static_cast<int32_t>(claim);
+            }
         }
+        return stack_depths;
     }
 
-    void verify(bytefile& file) {
+    verification_result verify(bytefile& file, uint32_t threads_size) {
         constexpr static std::string_view ENTRYPOINT = "main";
         std::optional<public_symbol> entrypoint;
         uint32_t i = 0;
@@ -501,8 +956,34 @@ namespace assignment_04 {
         if (!entrypoint) {
             failure(const_cast<char*>("Entrypoint is not specified\n"));
         }
-        verifier bytecode_verifier(file, *entrypoint);
-        bytecode_verifier.traverse_bytecode();
+        // A thread only pays off once it has a few milliseconds of work.
+        constexpr static uint32_t CODE_SIZE_PER_THREAD = 1 << 16;
+        threads_size = std::clamp(file.get_code_size() / CODE_SIZE_PER_THREAD, 1U, threads_size);
+        std::optional<verification_worklist> worklist;
+        worklist.emplace(file, entrypoint->get_address());
+        run_on_threads(threads_size, [&worklist]() {
+            worklist->run();
+        });
+        // Of two functions sharing code, the one claiming it first passes and the other fails, and which one that is
+        // depends on timing. Shared code only ever comes with an error, so a failed pass is repeated on one thread with
+        // fresh claims, where the functions are taken in a fixed order.
+        if (threads_size > 1 && worklist->has_errors()) {
+            worklist.emplace(file, entrypoint->get_address());
+            worklist->run();
+        }
+        worklist->check();
+        program code = decode(file, false);
+        type_inference inference(code);
+        inference.infer(threads_size);
+        std::vector<frame_size> frame_sizes;
+        for (uint32_t pos = 0; pos < code.get_size(); ++pos) {
+            const instruction& insn = code.get_instruction(pos);
+            if (insn.get_op() == bytecode::BEGIN || insn.get_op() == bytecode::CBEGIN) {
+                frame_sizes.push_back(frame_size{insn.get_offset(), file.get_int32(insn.get_offset() + sizeof(bytecode) + sizeof(int32_t))});
+            }
+        }
+        return verification_result{worklist->get_stack_depths(), inference.get_operand_types(), inference.get_stack_map_indices(), inference.get_stack_maps(),
+                                   std::move(frame_sizes)};
     }
 
 }
@@ -1,89 +1,216 @@
 #ifndef VERIFIER_H
 #define VERIFIER_H
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
 #include <string_view>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "bytefile.h"
+#include "decoder.h"
 #include "runtime_interface.h"
 
 namespace assignment_04 {
 
-    struct from_initial {};
-    struct from_processed {};
+    // AGGREGATE is a string, an array or an S-expression; REF is any reference, aggregate or not.
+    enum class inferred_type : uint8_t {
+        UNKNOWN,
+        INT,
+        REF,
+        AGGREGATE
+    };
 
-    [[maybe_unused]] constexpr static from_initial from_initial_t;
-    [[maybe_unused]] constexpr static from_processed from_processed_t;
+    using operand_types = std::array<inferred_type, 2>;
 
-    class stack_size {
-    public:
-        stack_size() noexcept;
+    // What a garbage collection finds in a frame slot: a value that is never read again, an integer, or a possible
+    // reference.
+    enum class slot_kind : uint8_t {
+        DEAD,
+        VALUE,
+        ROOT
+    };
 
-        explicit stack_size(int32_t repr) noexcept;
+    // The slots of a frame at a point where the garbage collector may run: arguments, then locals, then operand stack
+    // values from the bottom. Allocating instructions are such points for their own frame and calls are for the frame
+    // they return to.
+    class stack_map {
+    public:
+        stack_map(uint32_t args_size, uint32_t locals_size, std::vector<slot_kind> slots);
 
-        stack_size(from_initial, uint32_t val) noexcept;
+        [[nodiscard]] uint32_t get_args_size() const noexcept;
 
-        stack_size(from_processed, uint32_t val) noexcept;
+        [[nodiscard]] uint32_t get_locals_size() const noexcept;
 
-        [[nodiscard]] int32_t get_repr() const noexcept;
+        [[nodiscard]] uint32_t get_operands_size() const noexcept;
 
-        [[nodiscard]] bool has_value() const noexcept;
+        [[nodiscard]] slot_kind get_arg(uint32_t pos) const noexcept;
 
-        [[nodiscard]] bool is_initial() const noexcept;
+        [[nodiscard]] slot_kind get_local(uint32_t pos) const noexcept;
 
-        [[nodiscard]] bool is_processed() const noexcept;
+        [[nodiscard]] slot_kind get_operand(uint32_t pos) const noexcept;
 
-        [[nodiscard]] uint32_t get_value() const noexcept;
+        [[nodiscard]] std::span<const slot_kind> get_slots() const noexcept;
 
     private:
-        constexpr static int32_t NO_VALUE = -1;
-        int32_t repr_;
+        std::vector<slot_kind> slots_;
+        uint32_t args_size_;
+        uint32_t locals_size_;
+    };
+
+    // The operand of a function's BEGIN after the verifier has added the function's maximal stack size to it.
+    struct frame_size {
+        uint32_t offset;
+        int32_t locals_word;
     };
 
-    struct from_instruction {};
-    struct from_frame {};
+    // Facts established by the verifier that the later stages may rely on without checking them again. The tables by
+    // offset may live in memory the result shares, such as a mapped cache file.
+    class verification_result {
+    public:
+        constexpr static int32_t NO_DEPTH = -1;
+        constexpr static uint32_t NO_STACK_MAP = static_cast<uint32_t>(-1);
+
+        verification_result() = default;
+
+        verification_result(std::vector<int32_t> stack_depths, std::vector<operand_types> operand_types, std::vector<uint32_t> stack_map_indices,
+                            std::vector<stack_map> stack_maps, std::vector<frame_size> frame_sizes);
+
+        verification_result(std::shared_ptr<const void> storage, std::span<const int32_t> stack_depths, std::span<const operand_types> operand_types,
+                            std::span<const uint32_t> stack_map_indices, std::vector<stack_map> stack_maps, std::vector<frame_size> frame_sizes) noexcept;
 
-    [[maybe_unused]] constexpr static from_instruction from_instruction_t;
-    [[maybe_unused]] constexpr static from_frame from_frame_t;
+        // Number of operand stack values above the frame's locals right before the instruction at the offset runs.
+        [[nodiscard]] int32_t get_stack_depth(uint32_t offset) const noexcept;
+
+        // Type of the operand stack value `pos` positions below the top right before the instruction at the offset runs,
+        // for the two topmost values.
+        [[nodiscard]] inferred_type get_operand_type(uint32_t offset, uint32_t pos) const noexcept;
+
+        // Map of the frame for the collection point the instruction right before the offset is, or null if the
+        // instruction is not one.
+        [[nodiscard]] const stack_map* get_stack_map(uint32_t resume_offset) const noexcept;
+
+        [[nodiscard]] std::span<const int32_t> get_stack_depths() const noexcept;
+
+        [[nodiscard]] std::span<const operand_types> get_operand_types() const noexcept;
+
+        [[nodiscard]] std::span<const uint32_t> get_stack_map_indices() const noexcept;
+
+        [[nodiscard]] std::span<const stack_map> get_stack_maps() const noexcept;
+
+        [[nodiscard]] std::span<const frame_size> get_frame_sizes() const noexcept;
+
+    private:
+        std::shared_ptr<const void> storage_;
+        std::span<const int32_t> stack_depths_;
+        std::span<const operand_types> operand_types_;
+        std::span<const uint32_t> stack_map_indices_;
+        std::vector<stack_map> stack_maps_;
+        std::vector<frame_size> frame_sizes_;
+    };
 
-    class workset_entry {
+    class type_frame {
     public:
-        explicit workset_entry(auint repr) noexcept;
+        explicit type_frame(uint32_t variables_size);
+
+        [[nodiscard]] inferred_type get_variable(uint32_t pos) const noexcept;
+
+        void set_variable(uint32_t pos, inferred_type type) noexcept;
 
-        workset_entry(from_instruction, uint32_t val) noexcept;
+        [[nodiscard]] inferred_type peek(uint32_t offset = 0) const noexcept;
 
-        workset_entry(from_frame, uint32_t val) noexcept;
+        [[nodiscard]] uint32_t get_stack_size() const noexcept;
 
-        [[nodiscard]] auint get_repr() const noexcept;
+        void push(inferred_type type);
 
-        [[nodiscard]] bool is_instruction() const noexcept;
+        inferred_type pop() noexcept;
 
-        [[nodiscard]] bool is_frame() const noexcept;
+        void pop(uint32_t count) noexcept;
 
-        [[nodiscard]] uint32_t get_value() const noexcept;
+        // Returns whether anything got less precise.
+        bool join(const type_frame& other) noexcept;
 
     private:
-        auint repr_;
+        std::vector<inferred_type> variables_;
+        std::vector<inferred_type> stack_;
+    };
+
+    // Abstract interpretation of every function over the lattice UNKNOWN > {INT, REF > AGGREGATE}, iterated to a fixed
+    // point. Arguments and locals are tracked unless their address is taken with LDA; globals, captured variables,
+    // call results and elements are unknown. The types, together with a backward liveness analysis of the variables,
+    // give the stack maps of the collection points. Functions are inferred independently of each other.
+    class type_inference {
+    public:
+        explicit type_inference(const program& code);
+
+        void infer(uint32_t threads_size);
+
+        [[nodiscard]] const std::vector<operand_types>& get_operand_types() const noexcept;
+
+        [[nodiscard]] const std::vector<uint32_t>& get_stack_map_indices() const noexcept;
+
+        [[nodiscard]] const std::vector<stack_map>& get_stack_maps() const noexcept;
+
+    private:
+        const program& program_;
+        std::vector<operand_types> operand_types_;
+        std::vector<uint32_t> stack_map_indices_;
+        std::vector<stack_map> stack_maps_;
+
+        // Keys the function's stack maps by their resume offsets, which are numbered in function order afterwards.
+        void infer_function(uint32_t begin, uint32_t end, std::vector<std::pair<uint32_t, stack_map>>& stack_maps);
+
+        void map_function(uint32_t begin, uint32_t end, const std::vector<std::optional<type_frame>>& frames, const std::vector<bool>& is_escaping,
+                          std::vector<std::pair<uint32_t, stack_map>>& stack_maps);
+
+        static void transfer(const instruction& insn, type_frame& frame, uint32_t args_size, const std::vector<bool>& is_escaping);
+    };
+
+    // A check some function failed. Functions are verified concurrently, so the error is only reported once all of them
+    // are done.
+    struct verification_error {
+        std::string_view message;
+        uint32_t offset;
+    };
+
+    // A CALL or CLOSURE naming a function, checked against the function once every function is verified.
+    struct call_site {
+        uint32_t offset;
+        uint32_t target;
+        bytecode op;
+        int32_t args_size;
     };
 
+    // Verifies a single function from its BEGIN or CBEGIN without following calls, so stack heights are counted from the
+    // function's own frame and a function is verified once however it is reached. Every instruction is claimed with its
+    // stack height by the first function reaching it, and reaching it from another function is an error, so verifiers
+    // running at the same time never work on the same code.
     class verifier {
     public:
-        verifier(bytefile& file, public_symbol entrypoint);
+        verifier(bytefile& file, std::span<std::atomic<uint64_t>> claims);
 
-        void traverse_bytecode();
+        // Appends the functions the function calls or makes closures of; throws verification_error.
+        void verify_function(uint32_t function_index, uint32_t begin_addr, std::vector<call_site>& call_sites);
 
     private:
         uint32_t addr_;
-        size_t frames_depth_;
+        uint32_t insn_addr_;
+        uint32_t function_index_;
         uint32_t current_frame_addr_;
         uint32_t current_frame_stack_size_;
-        std::vector<stack_size> stack_sizes_;
         int32_t current_stack_size_;
-        std::span<auint> workset_;
+        std::vector<std::pair<uint32_t, int32_t>> workset_;
+        std::vector<call_site>* call_sites_;
         bytefile& bytefile_;
-        public_symbol entrypoint_;
+        std::span<std::atomic<uint64_t>> claims_;
 
         [[nodiscard]] bytecode peek_current_op() const;
 
@@ -95,11 +222,10 @@ namespace assignment_04 {
 
         [[nodiscard]] int32_t pop_next_int32();
 
-        workset_entry peek() const;
+        void push(uint32_t addr, int32_t stack_size);
 
-        void push(workset_entry val);
-
-        workset_entry pop();
+        // Returns whether the instruction at the current address still has to be processed.
+        bool claim(int32_t stack_size);
 
         [[nodiscard]] int32_t get_stack_delta() const;
 
@@ -113,8 +239,6 @@ namespace assignment_04 {
 
         void process_jmp();
 
-        void process_ret();
-
         void process_global();
 
         void process_local();
@@ -145,45 +269,133 @@ namespace assignment_04 {
 
         [[nodiscard]] uint32_t get_args_size() const;
 
-        void validate(bool condition, std::string_view message) const noexcept;
+        void validate(bool condition, std::string_view message) const;
     };
 
-    void verify(bytefile& file);
+    // The functions found so far, handed out to the threads verifying them. Every thread runs its own verifier and
+    // reports back the functions it found; the call sites are checked once none is left.
+    class verification_worklist {
+    public:
+        verification_worklist(bytefile& file, uint32_t entrypoint);
+
+        // Verifies functions until none is left to verify or being verified by another thread. An exception other than a
+        // verification error stops the verification and is kept for check().
+        void run();
+
+        [[nodiscard]] bool has_errors() const noexcept;
+
+        // Rethrows an exception that stopped the verification, fails with the error of the first failed function by
+        // offset, then checks every call site against its callee.
+        void check() const;
+
+        [[nodiscard]] std::vector<int32_t> get_stack_depths() const;
+
+    private:
+        bytefile& bytefile_;
+        std::vector<std::atomic<uint64_t>> claims_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::vector<uint32_t> functions_;
+        std::unordered_set<uint32_t> found_;
+        std::vector<uint32_t> pending_;
+        size_t busy_size_;
+        std::vector<call_site> call_sites_;
+        std::vector<std::pair<uint32_t, verification_error>> errors_;
+        std::exception_ptr exception_;
+    };
+
+    // Verifies the functions on threads_size threads, the calling one included.
+    verification_result verify(bytefile& file, uint32_t threads_size);
+
+    inline int32_t verification_result::get_stack_depth(uint32_t offset) const noexcept {
+        return offset < stack_depths_.size() ? stack_depths_[offset] : NO_DEPTH;
+    }
+
+    inline inferred_type verification_result::get_operand_type(uint32_t offset, uint32_t pos) const noexcept {
+        return offset < operand_types_.size() ? operand_types_[offset][pos] : inferred_type::UNKNOWN;
+    }
+
+    inline const stack_map* verification_result::get_stack_map(uint32_t resume_offset) const noexcept {
+        if (resume_offset >= stack_map_indices_.size() || stack_map_indices_[resume_offset] == NO_STACK_MAP) {
+            return nullptr;
+        }
+        return &stack_maps_[stack_map_indices_[resume_offset]];
+    }
+
+    inline std::span<const int32_t> verification_result::get_stack_depths() const noexcept {
+        return stack_depths_;
+    }
+
+    inline std::span<const operand_types> verification_result::get_operand_types() const noexcept {
+        return operand_types_;
+    }
+
+    inline std::span<const uint32_t> verification_result::get_stack_map_indices() const noexcept {
+        return stack_map_indices_;
+    }
+
+    inline std::span<const stack_map> verification_result::get_stack_maps() const noexcept {
+        return stack_maps_;
+    }
+
+    inline std::span<const frame_size> verification_result::get_frame_sizes() const noexcept {
+        return frame_sizes_;
+    }
+
+    inline uint32_t stack_map::get_args_size() const noexcept {
+        return args_size_;
+    }
+
+    inline uint32_t stack_map::get_locals_size() const noexcept {
+        return locals_size_;
+    }
+
+    inline uint32_t stack_map::get_operands_size() const noexcept {
+        return slots_.size() - args_size_ - locals_size_;
+    }
+
+    inline slot_kind stack_map::get_arg(uint32_t pos) const noexcept {
+        return slots_[pos];
+    }
+
+    inline slot_kind stack_map::get_local(uint32_t pos) const noexcept {
+        return slots_[args_size_ + pos];
+    }
 
-    inline int32_t stack_size::get_repr() const noexcept {
-        return repr_;
+    inline slot_kind stack_map::get_operand(uint32_t pos) const noexcept {
+        return slots_[args_size_ + locals_size_ + pos];
     }
 
-    inline bool stack_size::has_value() const noexcept {
-        return repr_ != NO_VALUE;
+    inline std::span<const slot_kind> stack_map::get_slots() const noexcept {
+        return slots_;
     }
 
-    inline bool stack_size::is_initial() const noexcept {
-        return repr_ < NO_VALUE;
+    inline inferred_type type_frame::get_variable(uint32_t pos) const noexcept {
+        return variables_[pos];
     }
 
-    inline bool stack_size::is_processed() const noexcept {
-        return repr_ > NO_VALUE;
+    inline void type_frame::set_variable(uint32_t pos, inferred_type type) noexcept {
+        variables_[pos] = type;
     }
 
-    inline uint32_t stack_size::get_value() const noexcept {
-        return repr_ < NO_VALUE ? -1 * repr_ - 2 : repr_;
+    inline inferred_type type_frame::peek(uint32_t offset) const noexcept {
+        return offset < stack_.size() ? stack_[stack_.size() - offset - 1] : inferred_type::UNKNOWN;
     }
 
-    inline auint workset_entry::get_repr() const noexcept {
-        return repr_;
+    inline uint32_t type_frame::get_stack_size() const noexcept {
+        return stack_.size();
     }
 
-    inline bool workset_entry::is_instruction() const noexcept {
-        return (repr_ & 1) == 0;
+    inline const std::vector<operand_types>& type_inference::get_operand_types() const noexcept {
+        return operand_types_;
     }
 
-    inline bool workset_entry::is_frame() const noexcept {
-        return repr_ & 1;
+    inline const std::vector<uint32_t>& type_inference::get_stack_map_indices() const noexcept {
+        return stack_map_indices_;
     }
 
-    inline uint32_t workset_entry::get_value() const noexcept {
-        return repr_ >> 1;
+    inline const std::vector<stack_map>& type_inference::get_stack_maps() const noexcept {
+        return stack_maps_;
     }
 
     inline uint32_t verifier::get_globals_size() const noexcept {
@@ -0,0 +1,92 @@
+; Builds a 1000-element list, maps a closure capturing a local over it with CALLC and writes the sum.
+main:
+BEGIN 2 3
+CONST 0
+ST L 0
+DROP
+CONST 1000
+ST L 1
+DROP
+bl:
+LD L 1
+CONST 0
+BINOP >
+CJMPZ bld
+LD L 1
+LD L 0
+SEXP cons 2
+ST L 0
+DROP
+LD L 1
+CONST 1
+BINOP -
+ST L 1
+DROP
+JMP bl
+bld:
+CONST 7
+ST L 2
+DROP
+CLOSURE lam L:2
+LD L 0
+CALL map 2
+CALL sum 1
+LWRITE
+DROP
+CONST 0
+END
+map:
+BEGIN 2 0
+LD A 1
+DUP
+TAG cons 2
+CJMPZ mnil
+LD A 0
+LD A 1
+CONST 0
+ELEM
+CALLC 1
+LD A 0
+LD A 1
+CONST 1
+ELEM
+CALL map 2
+SEXP cons 2
+SWAP
+DROP
+mnil:
+END
+lam:
+CBEGIN 1 0
+LD A 0
+CONST 2
+BINOP *
+LD C 0
+BINOP +
+END
+sum:
+BEGIN 1 1
+CONST 0
+ST L 0
+DROP
+sl:
+LD A 0
+DUP
+TAG cons 2
+CJMPZ sd
+DUP
+CONST 0
+ELEM
+LD L 0
+BINOP +
+ST L 0
+DROP
+CONST 1
+ELEM
+ST A 0
+DROP
+JMP sl
+sd:
+DROP
+LD L 0
+END
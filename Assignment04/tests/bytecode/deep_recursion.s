@@ -0,0 +1,27 @@
+; f(n) = if n == 0 then 0 else f(n - 1) + 1, called with 1000000, so every frame stays live.
+; Fails on an engine that bounds the number of nested calls below that.
+main:
+BEGIN 2 0
+CONST 1000000
+CALL f 1
+LWRITE
+DROP
+CONST 0
+END
+f:
+BEGIN 1 0
+LD A 0
+CONST 0
+BINOP ==
+CJMPZ go
+CONST 0
+JMP fe
+go:
+LD A 0
+CONST 1
+BINOP -
+CALL f 1
+CONST 1
+BINOP +
+fe:
+END
@@ -0,0 +1,70 @@
+; Writes fib(0) .. fib(21) computed by naive recursion, then a sum over a 300000-iteration loop.
+main:
+BEGIN 2 2
+CONST 0
+ST L 0
+DROP
+loop:
+LD L 0
+CONST 22
+BINOP <
+CJMPZ done
+LD L 0
+CALL fib 1
+LWRITE
+DROP
+LD L 0
+CONST 1
+BINOP +
+ST L 0
+DROP
+JMP loop
+done:
+CONST 0
+ST L 1
+DROP
+CONST 0
+ST L 0
+DROP
+l2:
+LD L 0
+CONST 300000
+BINOP <
+CJMPZ d2
+LD L 1
+LD L 0
+BINOP +
+ST L 1
+DROP
+LD L 0
+CONST 1
+BINOP +
+ST L 0
+DROP
+JMP l2
+d2:
+LD L 1
+LWRITE
+DROP
+CONST 0
+END
+fib:
+BEGIN 1 0
+LD A 0
+CONST 2
+BINOP <
+CJMPZ rec
+LD A 0
+JMP fe
+rec:
+LD A 0
+CONST 1
+BINOP -
+CALL fib 1
+LD A 0
+CONST 2
+BINOP -
+CALL fib 1
+BINOP +
+fe:
+END
@@ -0,0 +1,102 @@
+; Maps a closure over a 100000-element list, so the heap is collected several times while frames hold references.
+main:
+BEGIN 2 3
+CONST 0
+ST L 0
+DROP
+CONST 100000
+ST L 1
+DROP
+bl:
+LD L 1
+CONST 0
+BINOP >
+CJMPZ bld
+LD L 1
+LD L 0
+SEXP cons 2
+ST L 0
+DROP
+LD L 1
+CONST 1
+BINOP -
+ST L 1
+DROP
+JMP bl
+bld:
+CONST 7
+ST L 2
+DROP
+CLOSURE lam L:2
+LD L 0
+CALL map 2
+ST L 0
+DROP
+CLOSURE lam L:2
+LD L 0
+CALL map 2
+CALL sum 1
+LD L 0
+CALL sum 1
+BINOP +
+LWRITE
+DROP
+CONST 0
+END
+map:
+BEGIN 2 0
+LD A 1
+DUP
+TAG cons 2
+CJMPZ mnil
+LD A 0
+LD A 1
+CONST 0
+ELEM
+CALLC 1
+LD A 0
+LD A 1
+CONST 1
+ELEM
+CALL map 2
+SEXP cons 2
+ST A 1
+DROP
+DROP
+LD A 1
+mnil:
+END
+lam:
+CBEGIN 1 0
+LD A 0
+CONST 2
+BINOP *
+LD C 0
+BINOP +
+END
+sum:
+BEGIN 1 1
+CONST 0
+ST L 0
+DROP
+sl:
+LD A 0
+DUP
+TAG cons 2
+CJMPZ sd
+DUP
+CONST 0
+ELEM
+LD L 0
+BINOP +
+ST L 0
+DROP
+CONST 1
+ELEM
+ST A 0
+DROP
+JMP sl
+sd:
+DROP
+LD L 0
+END
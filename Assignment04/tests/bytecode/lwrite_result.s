@@ -0,0 +1,15 @@
+; x := write(5); write(x + 1)
+; The result of write is not an integer, so every engine must fail on the addition with the same message.
+main:
+BEGIN 2 1
+CONST 5
+LWRITE
+ST L 0
+DROP
+LD L 0
+CONST 1
+BINOP +
+LWRITE
+DROP
+CONST 0
+END
@@ -0,0 +1,93 @@
+; Classifies S-expressions, arrays, integers and strings by TAG and ARRAY, including tags with the wrong arity.
+main:
+BEGIN 2 0
+SEXP A 0
+CALL classify 1
+LWRITE
+DROP
+CONST 9
+SEXP B 1
+CALL classify 1
+LWRITE
+DROP
+CONST 1
+CONST 2
+SEXP C 2
+CALL classify 1
+LWRITE
+DROP
+CONST 1
+CONST 2
+BARRAY 2
+CALL classify 1
+LWRITE
+DROP
+CONST 1
+CONST 2
+SEXP B 2
+CALL classify 1
+LWRITE
+DROP
+CONST 5
+CALL classify 1
+LWRITE
+DROP
+STRING "zz"
+CALL classify 1
+LWRITE
+DROP
+SEXP B 0
+CALL classify 1
+LWRITE
+DROP
+CONST 1
+CONST 2
+CONST 3
+BARRAY 3
+CALL classify 1
+LWRITE
+DROP
+CONST 0
+END
+classify:
+BEGIN 1 0
+LD A 0
+DUP
+TAG A 0
+CJMPZ t2
+DROP
+CONST 1
+JMP out
+t2:
+DUP
+TAG B 1
+CJMPZ t3
+DROP
+CONST 2
+JMP out
+t3:
+DUP
+TAG C 2
+CJMPZ t4
+DROP
+CONST 3
+JMP out
+t4:
+DUP
+ARRAY 2
+CJMPZ t5
+DROP
+CONST 4
+JMP out
+t5:
+DUP
+TAG B 2
+CJMPZ t6
+DROP
+CONST 5
+JMP out
+t6:
+DROP
+CONST 0
+out:
+END
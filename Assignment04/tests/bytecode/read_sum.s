@@ -0,0 +1,28 @@
+; n := read(); s := 0; repeat s := s + read(); n := n - 1 until n == 0; write(s)
+; Reads its input from read_sum.input, so every engine must see the same stdin.
+main:
+BEGIN 2 2
+LREAD
+ST L 0
+DROP
+CONST 0
+ST L 1
+DROP
+loop:
+LD L 1
+LREAD
+BINOP +
+ST L 1
+DROP
+LD L 0
+CONST 1
+BINOP -
+ST L 0
+CONST 0
+BINOP ==
+CJMPZ loop
+LD L 1
+LWRITE
+DROP
+CONST 0
+END
@@ -0,0 +1,29 @@
+; loop(n, acc) = if n == 0 then acc else loop(n - 1, acc + 1), called with 50000000.
+; Without tail call elimination the frames do not fit on the stack and the program fails with a stack overflow.
+main:
+BEGIN 2 0
+CONST 50000000
+CONST 0
+CALL loop 2
+LWRITE
+DROP
+CONST 0
+END
+loop:
+BEGIN 2 0
+LD A 0
+CONST 0
+BINOP ==
+CJMPZ go
+LD A 1
+JMP le
+go:
+LD A 0
+CONST 1
+BINOP -
+LD A 1
+CONST 1
+BINOP +
+CALL loop 2
+le:
+END
@@ -25,6 +25,7 @@ size_t cur_id = 0;
 static extra_roots_pool extra_roots;
 
 size_t __gc_stack_top = 0, __gc_stack_bottom = 0;
+void (*__gc_root_scanner) (void) = NULL;
 #ifdef LAMA_ENV
 #ifdef __linux__
 extern const size_t __start_custom_data, __stop_custom_data;
@@ -40,6 +41,8 @@ memory_chunk heap;
 static memory_chunk heap;
 #endif
 
+memory_chunk *const __gc_heap = &heap;
+
 #ifdef DEBUG_VERSION
 void dump_heap ();
 #endif
@@ -254,7 +257,11 @@ void mark_phase (void) {
           (void *)__gc_stack_top,
           (void *)__gc_stack_bottom);
 #endif
-  gc_root_scan_stack();
+  if (__gc_root_scanner) {
+    __gc_root_scanner();
+  } else {
+    gc_root_scan_stack();
+  }
 #if defined(DEBUG_VERSION) && defined(DEBUG_PRINT)
   fprintf(stderr, "gc_root_scan_stack has finished\n");
   fprintf(stderr, "scan_extra_roots has started\n");
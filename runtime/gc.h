@@ -121,6 +121,28 @@ void __init (void);
 // to deallocate all object allocated via GC
 extern void __shutdown (void);
 
+// ============================================================================
+//                         Precise root scanning
+// ============================================================================
+// By default every word of the stack is taken for a possible root. A virtual
+// machine that knows its frames can set `__gc_root_scanner` to report the
+// roots itself: the scanner is called instead of the conservative scan and
+// passes each root of [__gc_stack_top + sizeof(size_t), __gc_stack_bottom) to
+// `gc_test_and_mark_root`. References from the stack are still updated word
+// by word after marking, so the scanner must not leave a pointer to a dead
+// object in any other word of that range.
+extern void (*__gc_root_scanner) (void);
+
+// ============================================================================
+//                            Inline allocation
+// ============================================================================
+// A virtual machine may allocate without calling `alloc` while the object
+// fits: it takes `__gc_heap->current` as the object's header, advances it by
+// the object's size in words (not past `end`) and writes every word itself,
+// the header, a zero forwarding address and the contents up to the last word,
+// padding included. Otherwise it calls `alloc`, which collects garbage first.
+extern memory_chunk *const __gc_heap;
+
 // ============================================================================
 //                    invoked from GASM: see gc_runtime.s
 // ============================================================================